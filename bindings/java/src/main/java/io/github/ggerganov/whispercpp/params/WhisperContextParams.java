@@ -40,6 +40,12 @@ public class WhisperContextParams extends Structure {
     /** DTW memory size (internal use) */
     public NativeLong dtw_mem_size;
 
+    /** [EXPERIMENTAL] Number of encoder layers to run, 0 for all (default = 0) */
+    public int encoder_n_layer;
+
+    /** [EXPERIMENTAL] Run every n-th of those encoder layers (default = 1) */
+    public int encoder_layer_step;
+
     /** Use GPU for inference */
     public void useGpu(boolean enable) {
         use_gpu = enable ? CBool.TRUE : CBool.FALSE;
@@ -70,7 +76,9 @@ public class WhisperContextParams extends Structure {
             "dtw_aheads_preset",
             "dtw_n_top",
             "dtw_aheads",
-            "dtw_mem_size"
+            "dtw_mem_size",
+            "encoder_n_layer",
+            "encoder_layer_step"
         );
     }
 
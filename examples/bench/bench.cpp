@@ -1,14 +1,29 @@
+#include "common.h"
 #include "whisper.h"
 
+#define MA_NO_DEVICE_IO
+#define MA_NO_THREADING
+#define MA_NO_ENCODING
+#define MA_NO_GENERATION
+#define MA_NO_RESOURCE_MANAGER
+#define MA_NO_NODE_GRAPH
+#include "miniaudio.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <string>
 #include <thread>
+#include <vector>
 
 // command-line parameters
 struct whisper_params {
     int32_t n_threads = std::min(4, (int32_t) std::thread::hardware_concurrency());
-    int32_t what = 0; // what to benchmark: 0 - whisper encoder, 1 - memcpy, 2 - ggml_mul_mat
+    int32_t what = 0; // what to benchmark: 0 - whisper encoder, 1 - memcpy, 2 - ggml_mul_mat, 3 - resampling, 4 - conv stem
+    int32_t n_batch = 1; // encoder windows per batched pass, 1 - no batched encoder run
 
     std::string model = "models/ggml-base.en.bin";
 
@@ -29,6 +44,7 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-t"  || arg == "--threads")    { params.n_threads  = std::stoi(argv[++i]); }
         else if (arg == "-m"  || arg == "--model")      { params.model      = argv[++i]; }
         else if (arg == "-w"  || arg == "--what")       { params.what       = atoi(argv[++i]); }
+        else if (arg == "-b"  || arg == "--batch")      { params.n_batch    = std::max(1, atoi(argv[++i])); }
         else if (arg == "-ng" || arg == "--no-gpu")     { params.use_gpu    = false; }
         else if (arg == "-fa" || arg == "--flash-attn") { params.flash_attn = true; }
         else {
@@ -53,11 +69,77 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "                           %-7s  0 - whisper\n",                                 "");
     fprintf(stderr, "                           %-7s  1 - memcpy\n",                                  "");
     fprintf(stderr, "                           %-7s  2 - ggml_mul_mat\n",                            "");
+    fprintf(stderr, "                           %-7s  3 - resampling to 16 kHz\n",                    "");
+    fprintf(stderr, "                           %-7s  4 - encoder conv stem, im2col vs fused\n",      "");
+    fprintf(stderr, "  -b N,     --batch N     [%-7d] also time N encoder windows in one batched pass\n", params.n_batch);
     fprintf(stderr, "  -ng,      --no-gpu      [%-7s] disable GPU\n",                                 params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,      --flash-attn  [%-7s] enable flash attention\n",                      params.flash_attn ? "true" : "false");
     fprintf(stderr, "\n");
 }
 
+// encode n_batch windows of random mel one at a time, then in a single batched pass
+static int whisper_bench_encode_batch(struct whisper_context * ctx, const whisper_params & params) {
+    const int n_batch = params.n_batch;
+    const int n_mels  = whisper_model_n_mels(ctx);
+    const int n_len   = 2*whisper_model_n_audio_ctx(ctx) + 2;
+
+    std::vector<float> mel(n_mels*n_len);
+    for (size_t i = 0; i < mel.size(); ++i) {
+        mel[i] = float(rand())/RAND_MAX;
+    }
+
+    std::vector<whisper_state *> states(n_batch);
+    for (auto & state : states) {
+        state = whisper_init_state(ctx);
+        if (state == nullptr || whisper_set_mel_with_state(ctx, state, mel.data(), n_len, n_mels) != 0) {
+            fprintf(stderr, "error: failed to initialize state\n");
+            return 5;
+        }
+    }
+
+    // each run uses a new offset: an unchanged window would be served from the encoder cache
+    std::vector<int> offsets(n_batch, 0);
+
+    // heat
+    if (whisper_encode_batch(ctx, states.data(), offsets.data(), n_batch, params.n_threads) != 0) {
+        fprintf(stderr, "error: failed to encode\n");
+        return 4;
+    }
+
+    const auto t_single = std::chrono::high_resolution_clock::now();
+
+    for (auto & state : states) {
+        if (whisper_encode_with_state(ctx, state, 1, params.n_threads) != 0) {
+            fprintf(stderr, "error: failed to encode\n");
+            return 4;
+        }
+    }
+
+    const auto t_batch = std::chrono::high_resolution_clock::now();
+
+    std::fill(offsets.begin(), offsets.end(), 2);
+
+    if (whisper_encode_batch(ctx, states.data(), offsets.data(), n_batch, params.n_threads) != 0) {
+        fprintf(stderr, "error: failed to encode\n");
+        return 4;
+    }
+
+    const auto t_end = std::chrono::high_resolution_clock::now();
+
+    const double ms_single = std::chrono::duration<double, std::milli>(t_batch - t_single).count()/n_batch;
+    const double ms_batch  = std::chrono::duration<double, std::milli>(t_end   - t_batch ).count()/n_batch;
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "%s: %d windows, one at a time = %8.2f ms per window\n", __func__, n_batch, ms_single);
+    fprintf(stderr, "%s: %d windows, batched       = %8.2f ms per window (%.2fx)\n", __func__, n_batch, ms_batch, ms_single/ms_batch);
+
+    for (auto & state : states) {
+        whisper_free_state(state);
+    }
+
+    return 0;
+}
+
 static int whisper_bench_full(const whisper_params & params) {
     // whisper init
 
@@ -107,6 +189,16 @@ static int whisper_bench_full(const whisper_params & params) {
 
     whisper_reset_timings(ctx);
 
+    // an unchanged window would be served from the encoder cache, so the timed run gets a different one
+    {
+        std::vector<float> mel(n_mels, 1.0f);
+
+        if (int ret = whisper_set_mel(ctx, mel.data(), 1, n_mels)) {
+            fprintf(stderr, "error: failed to set mel: %d\n", ret);
+            return 3;
+        }
+    }
+
     // actual run
     if (int ret = whisper_encode(ctx, 0, params.n_threads) != 0) {
         fprintf(stderr, "error: failed to encode: %d\n", ret);
@@ -138,6 +230,14 @@ static int whisper_bench_full(const whisper_params & params) {
     }
 
     whisper_print_timings(ctx);
+
+    if (params.n_batch > 1) {
+        if (int ret = whisper_bench_encode_batch(ctx, params)) {
+            whisper_free(ctx);
+            return ret;
+        }
+    }
+
     whisper_free(ctx);
 
     fprintf(stderr, "\n");
@@ -155,6 +255,115 @@ static int whisper_bench_full(const whisper_params & params) {
     return 0;
 }
 
+// resample a tone of freq Hz with both resamplers
+// returns the output level in dB relative to the input, and the speed as a multiple of real time
+struct bench_resample_result {
+    double level_db = 0.0;
+    double speed    = 0.0;
+};
+
+static bench_resample_result bench_resample_tone(bool use_miniaudio, int rate_in, double freq, double seconds) {
+    const size_t n_in  = rate_in*seconds;
+    const size_t chunk = 1024; // a typical capture callback
+
+    std::vector<float> in(n_in);
+    for (size_t i = 0; i < n_in; ++i) {
+        in[i] = 0.5*sin(2.0*M_PI*freq*i/rate_in);
+    }
+
+    std::vector<float> out;
+    out.reserve(n_in*WHISPER_SAMPLE_RATE/rate_in + 4096);
+
+    const auto t_start = std::chrono::high_resolution_clock::now();
+
+    if (use_miniaudio) {
+        // the converter that ma_decoder uses in read_audio_data()
+        ma_resampler_config config = ma_resampler_config_init(ma_format_f32, 1, rate_in, WHISPER_SAMPLE_RATE, ma_resample_algorithm_linear);
+        ma_resampler resampler;
+
+        if (ma_resampler_init(&config, nullptr, &resampler) != MA_SUCCESS) {
+            return {};
+        }
+
+        std::vector<float> buf(2*chunk);
+
+        for (size_t i = 0; i < n_in; ) {
+            ma_uint64 n_frames_in  = std::min(chunk, n_in - i);
+            ma_uint64 n_frames_out = buf.size();
+
+            ma_resampler_process_pcm_frames(&resampler, in.data() + i, &n_frames_in, buf.data(), &n_frames_out);
+
+            out.insert(out.end(), buf.begin(), buf.begin() + n_frames_out);
+            i += n_frames_in;
+        }
+
+        ma_resampler_uninit(&resampler, nullptr);
+    } else {
+        audio_resampler resampler;
+
+        if (!resampler.init(rate_in, WHISPER_SAMPLE_RATE)) {
+            return {};
+        }
+
+        std::vector<float> buf(resampler.max_out(chunk));
+
+        for (size_t i = 0; i < n_in; i += chunk) {
+            const size_t n_out = resampler.process(in.data() + i, std::min(chunk, n_in - i), buf.data());
+            out.insert(out.end(), buf.begin(), buf.begin() + n_out);
+        }
+    }
+
+    const double t = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t_start).count();
+
+    // skip the filter warm-up at both ends
+    double sum = 0.0;
+    const size_t skip = WHISPER_SAMPLE_RATE/10;
+    for (size_t i = skip; i + skip < out.size(); ++i) {
+        sum += out[i]*out[i];
+    }
+
+    const double rms = sqrt(sum/std::max<size_t>(1, out.size() - 2*skip));
+
+    bench_resample_result res;
+    res.level_db = 20.0*log10(std::max(1e-10, rms/(0.5/sqrt(2.0))));
+    res.speed    = seconds/t;
+
+    return res;
+}
+
+static int whisper_bench_resample() {
+    const double seconds = 60.0;
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "resampling %.0f s of mono audio to %d Hz in chunks of 1024 samples\n", seconds, WHISPER_SAMPLE_RATE);
+    fprintf(stderr, "level of a tone after resampling: 0 dB expected up to 7.2 kHz, as low as possible from 8 kHz (aliasing)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "%-10s %-10s %12s %12s %12s %12s %14s\n", "rate", "resampler", "1 kHz", "7 kHz", "9 kHz", "12 kHz", "speed");
+
+    for (int rate_in : { 48000, 44100 }) {
+        for (bool use_miniaudio : { true, false }) {
+            double speed = 0.0;
+
+            std::string levels;
+            for (double freq : { 1000.0, 7000.0, 9000.0, 12000.0 }) {
+                const bench_resample_result res = bench_resample_tone(use_miniaudio, rate_in, freq, seconds);
+
+                char buf[32];
+                snprintf(buf, sizeof(buf), " %9.1f dB", res.level_db);
+                levels += buf;
+
+                speed += res.speed/4;
+            }
+
+            fprintf(stderr, "%-10d %-10s %s %10.0f x RT\n", rate_in, use_miniaudio ? "miniaudio" : "polyphase", levels.c_str(), speed);
+        }
+    }
+
+    fprintf(stderr, "\n");
+
+    return 0;
+}
+
 int main(int argc, char ** argv) {
     whisper_params params;
 
@@ -168,6 +377,8 @@ int main(int argc, char ** argv) {
         case 0: ret = whisper_bench_full(params);                break;
         case 1: ret = whisper_bench_memcpy(params.n_threads);       break;
         case 2: ret = whisper_bench_ggml_mul_mat(params.n_threads); break;
+        case 3: ret = whisper_bench_resample();                     break;
+        case 4: ret = whisper_bench_conv(params.n_threads);         break;
         default: fprintf(stderr, "error: unknown benchmark: %d\n", params.what); break;
     }
 
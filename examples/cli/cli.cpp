@@ -12,6 +12,7 @@
 #include <vector>
 #include <cstring>
 #include <cfloat>
+#include <future>
 
 #if defined(_WIN32)
 #ifndef NOMINMAX
@@ -43,6 +44,9 @@ struct whisper_params {
     int32_t best_of       = whisper_full_default_params(WHISPER_SAMPLING_GREEDY).greedy.best_of;
     int32_t beam_size     = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH).beam_search.beam_size;
     int32_t audio_ctx     = 0;
+    int32_t chunk_s       = 0;
+    int32_t enc_layers    = 0;
+    int32_t enc_step      = 1;
 
     float word_thold      =  0.01f;
     float entropy_thold   =  2.40f;
@@ -155,6 +159,9 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-bo"   || arg == "--best-of")         { params.best_of         = std::stoi(ARGV_NEXT); }
         else if (arg == "-bs"   || arg == "--beam-size")       { params.beam_size       = std::stoi(ARGV_NEXT); }
         else if (arg == "-ac"   || arg == "--audio-ctx")       { params.audio_ctx       = std::stoi(ARGV_NEXT); }
+        else if (arg == "-ck"   || arg == "--chunk")           { params.chunk_s         = std::stoi(ARGV_NEXT); }
+        else if (arg == "-el"   || arg == "--enc-layers")      { params.enc_layers      = std::stoi(ARGV_NEXT); }
+        else if (arg == "-es"   || arg == "--enc-step")        { params.enc_step        = std::stoi(ARGV_NEXT); }
         else if (arg == "-wt"   || arg == "--word-thold")      { params.word_thold      = std::stof(ARGV_NEXT); }
         else if (arg == "-et"   || arg == "--entropy-thold")   { params.entropy_thold   = std::stof(ARGV_NEXT); }
         else if (arg == "-lpt"  || arg == "--logprob-thold")   { params.logprob_thold   = std::stof(ARGV_NEXT); }
@@ -234,7 +241,10 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
     fprintf(stderr, "  -sow,      --split-on-word     [%-7s] split on word rather than on token\n",             params.split_on_word ? "true" : "false");
     fprintf(stderr, "  -bo N,     --best-of N         [%-7d] number of best candidates to keep\n",              params.best_of);
     fprintf(stderr, "  -bs N,     --beam-size N       [%-7d] beam size for beam search\n",                      params.beam_size);
-    fprintf(stderr, "  -ac N,     --audio-ctx N       [%-7d] audio context size (0 - all)\n",                   params.audio_ctx);
+    fprintf(stderr, "  -ac N,     --audio-ctx N       [%-7d] audio context size (0 - all, -1 - fit to the audio)\n", params.audio_ctx);
+    fprintf(stderr, "  -ck N,     --chunk N           [%-7d] decode and transcribe long audio in chunks of N seconds (0 - all at once)\n", params.chunk_s);
+    fprintf(stderr, "  -el N,     --enc-layers N      [%-7d] [EXPERIMENTAL] run only the first N encoder layers (0 - all)\n", params.enc_layers);
+    fprintf(stderr, "  -es N,     --enc-step N        [%-7d] [EXPERIMENTAL] run every N-th of those encoder layers\n", params.enc_step);
     fprintf(stderr, "  -wt N,     --word-thold N      [%-7.2f] word timestamp probability threshold\n",         params.word_thold);
     fprintf(stderr, "  -et N,     --entropy-thold N   [%-7.2f] entropy threshold for decoder fail\n",           params.entropy_thold);
     fprintf(stderr, "  -lpt N,    --logprob-thold N   [%-7.2f] log probability threshold for decoder fail\n",   params.logprob_thold);
@@ -297,8 +307,23 @@ struct whisper_print_user_data {
 
     const std::vector<std::vector<float>> * pcmf32s;
     int progress_prev;
+
+    int64_t t_offset; // start of the transcribed audio in the input, see --chunk
+};
+
+// the results of the last whisper_full() call to output, when the input is transcribed in chunks
+struct output_range {
+    int     i0       = 0;    // first segment
+    int     i1       = -1;   // end, -1 - all segments
+    int     n_prev   = 0;    // segments written for the previous chunks
+    int64_t t_offset = 0;    // start of the chunk in the input
+    bool    header   = true; // write the file header
 };
 
+static int output_range_end(struct whisper_context * ctx, const output_range & range) {
+    return range.i1 < 0 ? whisper_full_n_segments(ctx) : range.i1;
+}
+
 static std::string estimate_diarization_speaker(std::vector<std::vector<float>> pcmf32s, int64_t t0, int64_t t1, bool id_only = false) {
     std::string speaker = "";
     const int64_t n_samples = pcmf32s[0].size();
@@ -341,28 +366,24 @@ static void whisper_print_progress_callback(struct whisper_context * /*ctx*/, st
     }
 }
 
-static void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * /*state*/, int n_new, void * user_data) {
-    const auto & params  = *((whisper_print_user_data *) user_data)->params;
-    const auto & pcmf32s = *((whisper_print_user_data *) user_data)->pcmf32s;
-
-    const int n_segments = whisper_full_n_segments(ctx);
+// print segments [s0, s1)
+static void whisper_print_segments(struct whisper_context * ctx, int s0, int s1, const whisper_print_user_data & user_data) {
+    const auto & params  = *user_data.params;
+    const auto & pcmf32s = *user_data.pcmf32s;
 
     std::string speaker = "";
 
     int64_t t0 = 0;
     int64_t t1 = 0;
 
-    // print the last n_new segments
-    const int s0 = n_segments - n_new;
-
-    if (s0 == 0) {
+    if (s0 == 0 && user_data.t_offset == 0) {
         printf("\n");
     }
 
-    for (int i = s0; i < n_segments; i++) {
+    for (int i = s0; i < s1; i++) {
         if (!params.no_timestamps || params.diarize) {
-            t0 = whisper_full_get_segment_t0(ctx, i);
-            t1 = whisper_full_get_segment_t1(ctx, i);
+            t0 = whisper_full_get_segment_t0(ctx, i) + user_data.t_offset;
+            t1 = whisper_full_get_segment_t1(ctx, i) + user_data.t_offset;
         }
 
         if (!params.no_timestamps) {
@@ -430,9 +451,16 @@ static void whisper_print_segment_callback(struct whisper_context * ctx, struct
     }
 }
 
-static void output_txt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
+static void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * /*state*/, int n_new, void * user_data) {
     const int n_segments = whisper_full_n_segments(ctx);
-    for (int i = 0; i < n_segments; ++i) {
+
+    // print the last n_new segments
+    whisper_print_segments(ctx, n_segments - n_new, n_segments, *((whisper_print_user_data *) user_data));
+}
+
+static void output_txt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s, const output_range & range = {}) {
+    const int n_segments = output_range_end(ctx, range);
+    for (int i = range.i0; i < n_segments; ++i) {
         const char * text = whisper_full_get_segment_text(ctx, i);
         std::string speaker = "";
 
@@ -447,14 +475,16 @@ static void output_txt(struct whisper_context * ctx, std::ofstream & fout, const
     }
 }
 
-static void output_vtt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
-    fout << "WEBVTT\n\n";
+static void output_vtt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s, const output_range & range = {}) {
+    if (range.header) {
+        fout << "WEBVTT\n\n";
+    }
 
-    const int n_segments = whisper_full_n_segments(ctx);
-    for (int i = 0; i < n_segments; ++i) {
+    const int n_segments = output_range_end(ctx, range);
+    for (int i = range.i0; i < n_segments; ++i) {
         const char * text = whisper_full_get_segment_text(ctx, i);
-        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-        const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+        const int64_t t0 = whisper_full_get_segment_t0(ctx, i) + range.t_offset;
+        const int64_t t1 = whisper_full_get_segment_t1(ctx, i) + range.t_offset;
         std::string speaker = "";
 
         if (params.diarize && pcmf32s.size() == 2)
@@ -469,12 +499,12 @@ static void output_vtt(struct whisper_context * ctx, std::ofstream & fout, const
     }
 }
 
-static void output_srt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
-    const int n_segments = whisper_full_n_segments(ctx);
-    for (int i = 0; i < n_segments; ++i) {
+static void output_srt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s, const output_range & range = {}) {
+    const int n_segments = output_range_end(ctx, range);
+    for (int i = range.i0; i < n_segments; ++i) {
         const char * text = whisper_full_get_segment_text(ctx, i);
-        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-        const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+        const int64_t t0 = whisper_full_get_segment_t0(ctx, i) + range.t_offset;
+        const int64_t t1 = whisper_full_get_segment_t1(ctx, i) + range.t_offset;
         std::string speaker = "";
 
         if (params.diarize && pcmf32s.size() == 2)
@@ -482,7 +512,7 @@ static void output_srt(struct whisper_context * ctx, std::ofstream & fout, const
             speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
         }
 
-        fout << i + 1 + params.offset_n << "\n";
+        fout << range.n_prev + i - range.i0 + 1 + params.offset_n << "\n";
         fout << to_timestamp(t0, true) << " --> " << to_timestamp(t1, true) << "\n";
         fout << speaker << text << "\n\n";
     }
@@ -551,19 +581,21 @@ static char * escape_double_quotes_in_csv(const char * str) {
     return escaped;
 }
 
-static void output_csv(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
-    const int n_segments = whisper_full_n_segments(ctx);
-    fout << "start,end,";
-    if (params.diarize && pcmf32s.size() == 2)
-    {
-        fout << "speaker,";
+static void output_csv(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s, const output_range & range = {}) {
+    const int n_segments = output_range_end(ctx, range);
+    if (range.header) {
+        fout << "start,end,";
+        if (params.diarize && pcmf32s.size() == 2)
+        {
+            fout << "speaker,";
+        }
+        fout << "text\n";
     }
-    fout << "text\n";
 
-    for (int i = 0; i < n_segments; ++i) {
+    for (int i = range.i0; i < n_segments; ++i) {
         const char * text = whisper_full_get_segment_text(ctx, i);
-        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-        const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+        const int64_t t0 = whisper_full_get_segment_t0(ctx, i) + range.t_offset;
+        const int64_t t1 = whisper_full_get_segment_t1(ctx, i) + range.t_offset;
         char * text_escaped = escape_double_quotes_in_csv(text);
 
         //need to multiply times returned from whisper_full_get_segment_t{0,1}() by 10 to get milliseconds.
@@ -875,13 +907,15 @@ static bool output_wts(struct whisper_context * ctx, std::ofstream & fout, const
     return true;
 }
 
-static void output_lrc(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
-    fout << "[by:whisper.cpp]\n";
+static void output_lrc(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s, const output_range & range = {}) {
+    if (range.header) {
+        fout << "[by:whisper.cpp]\n";
+    }
 
-    const int n_segments = whisper_full_n_segments(ctx);
-    for (int i = 0; i < n_segments; ++i) {
+    const int n_segments = output_range_end(ctx, range);
+    for (int i = range.i0; i < n_segments; ++i) {
         const char * text = whisper_full_get_segment_text(ctx, i);
-        const int64_t t = whisper_full_get_segment_t0(ctx, i);
+        const int64_t t = whisper_full_get_segment_t0(ctx, i) + range.t_offset;
 
         int64_t msec = t * 10;
         int64_t min = msec / (1000 * 60);
@@ -905,6 +939,116 @@ static void output_lrc(struct whisper_context * ctx, std::ofstream & fout, const
     }
 }
 
+// an output file that is written chunk by chunk, see --chunk
+struct chunk_output {
+    void (*func)(struct whisper_context *, std::ofstream &, const whisper_params &, std::vector<std::vector<float>>, const output_range &);
+
+    std::ofstream fout;
+};
+
+// transcribe the input in chunks of params.chunk_s seconds, decoding the next chunk while the current one
+// is transcribed, so that only about two chunks of PCM are in memory at any time
+static bool transcribe_chunked(
+        struct whisper_context * ctx,
+        const whisper_params & params,
+        whisper_full_params wparams,
+        audio_reader & reader,
+        whisper_print_user_data & user_data,
+        bool print_segments,
+        std::vector<chunk_output> & outputs) {
+    const size_t n_chunk = (size_t) params.chunk_s*WHISPER_SAMPLE_RATE;
+
+    // segments are printed when their chunk is done, since the last one may move to the next chunk
+    wparams.new_segment_callback           = nullptr;
+    wparams.new_segment_callback_user_data = nullptr;
+
+    std::vector<float> window; // the carried end of the previous chunk followed by the new chunk
+    std::vector<float> next;
+
+    // the text context of the next chunk is passed as its prompt: the tokens of the kept segments only,
+    // since the audio of a dropped segment is transcribed again
+    const bool use_context = !wparams.no_context;
+
+    std::vector<whisper_token> prompt_tokens;
+
+    reader.read(n_chunk, next);
+
+    int64_t t_window  = 0; // position of window[0] in the input, in samples
+    int     n_written = 0;
+
+    while (!next.empty()) {
+        window.insert(window.end(), next.begin(), next.end());
+
+        std::future<size_t> decoded = std::async(std::launch::async, [&]() {
+            return reader.read(n_chunk, next);
+        });
+
+        const int ret = whisper_full_parallel(ctx, wparams, window.data(), window.size(), params.n_processors);
+
+        decoded.wait();
+
+        if (ret != 0) {
+            return false;
+        }
+
+        const bool is_last    = next.empty();
+        const int  n_segments = whisper_full_n_segments(ctx);
+
+        // the last segment may be cut off by the end of the chunk - unless that would carry more than
+        // half of the window, drop it and transcribe its audio again at the start of the next chunk
+        int    n_keep  = n_segments;
+        size_t n_carry = 0;
+
+        if (!is_last && n_segments > 1) {
+            const size_t s0 = timestamp_to_sample(whisper_full_get_segment_t0(ctx, n_segments - 1), window.size(), WHISPER_SAMPLE_RATE);
+
+            if (s0 >= window.size()/2) {
+                n_keep  = n_segments - 1;
+                n_carry = window.size() - s0;
+            }
+        }
+
+        if (use_context) {
+            prompt_tokens.clear();
+            for (int i = 0; i < n_keep; ++i) {
+                const int n_tokens = whisper_full_n_tokens(ctx, i);
+                for (int j = 0; j < n_tokens; ++j) {
+                    prompt_tokens.push_back(whisper_full_get_token_id(ctx, i, j));
+                }
+            }
+
+            wparams.no_context      = true;
+            wparams.initial_prompt  = nullptr;
+            wparams.prompt_tokens   = prompt_tokens.data();
+            wparams.prompt_n_tokens = prompt_tokens.size();
+        }
+
+        const int64_t t_offset = (t_window*100)/WHISPER_SAMPLE_RATE;
+
+        if (print_segments) {
+            user_data.t_offset = t_offset;
+            whisper_print_segments(ctx, 0, n_keep, user_data);
+        }
+
+        output_range range;
+        range.i1       = n_keep;
+        range.n_prev   = n_written;
+        range.t_offset = t_offset;
+        range.header   = t_window == 0;
+
+        for (auto & output : outputs) {
+            output.func(ctx, output.fout, params, {}, range);
+            output.fout.flush();
+        }
+
+        n_written += n_keep;
+        t_window  += window.size() - n_carry;
+
+        window.erase(window.begin(), window.end() - n_carry);
+    }
+
+    return true;
+}
 
 static void cb_log_disable(enum ggml_log_level , const char * , void * ) { }
 
@@ -994,6 +1138,9 @@ int main(int argc, char ** argv) {
     cparams.use_gpu    = params.use_gpu;
     cparams.flash_attn = params.flash_attn;
 
+    cparams.encoder_n_layer    = params.enc_layers;
+    cparams.encoder_layer_step = params.enc_step;
+
     if (!params.dtw.empty()) {
         cparams.dtw_token_timestamps = true;
         cparams.dtw_aheads_preset = WHISPER_AHEADS_NONE;
@@ -1104,9 +1251,28 @@ int main(int argc, char ** argv) {
         std::vector<float> pcmf32;               // mono-channel F32 PCM
         std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
 
-        if (!::read_audio_data(fname_inp, pcmf32, pcmf32s, params.diarize)) {
-            fprintf(stderr, "error: failed to read audio file '%s'\n", fname_inp.c_str());
-            continue;
+        // outputs that need the whole transcription or audio at once cannot be written chunk by chunk
+        bool use_chunks = params.chunk_s > 0;
+        if (use_chunks && (params.diarize || params.output_jsn || params.output_wts || params.log_score || params.offset_t_ms > 0 || params.duration_ms > 0)) {
+            fprintf(stderr, "%s: WARNING: --chunk does not support --diarize, JSON, karaoke and score output, --offset-t and --duration, transcribing at once\n", __func__);
+            use_chunks = false;
+        }
+
+        audio_reader reader;
+        uint64_t n_samples_inp = 0;
+
+        if (use_chunks) {
+            if (!reader.open(fname_inp)) {
+                fprintf(stderr, "error: failed to read audio file '%s'\n", fname_inp.c_str());
+                continue;
+            }
+            n_samples_inp = reader.n_samples();
+        } else {
+            if (!::read_audio_data(fname_inp, pcmf32, pcmf32s, params.diarize)) {
+                fprintf(stderr, "error: failed to read audio file '%s'\n", fname_inp.c_str());
+                continue;
+            }
+            n_samples_inp = pcmf32.size();
         }
 
         if (!whisper_is_multilingual(ctx)) {
@@ -1129,7 +1295,7 @@ int main(int argc, char ** argv) {
             // print some info about the processing
             fprintf(stderr, "\n");
             fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), %d threads, %d processors, %d beams + best of %d, lang = %s, task = %s, %stimestamps = %d ...\n",
-                    __func__, fname_inp.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE,
+                    __func__, fname_inp.c_str(), int(n_samples_inp), float(n_samples_inp)/WHISPER_SAMPLE_RATE,
                     params.n_threads, params.n_processors, params.beam_size, params.best_of,
                     params.language.c_str(),
                     params.translate ? "translate" : "transcribe",
@@ -1201,7 +1367,7 @@ int main(int argc, char ** argv) {
             wparams.vad_params.speech_pad_ms           = params.vad_speech_pad_ms;
             wparams.vad_params.samples_overlap         = params.vad_samples_overlap;
 
-            whisper_print_user_data user_data = { &params, &pcmf32s, 0 };
+            whisper_print_user_data user_data = { &params, &pcmf32s, 0, 0 };
 
             const auto & grammar_parsed = params.grammar_parsed;
             auto grammar_rules = grammar_parsed.c_rules();
@@ -1253,14 +1419,33 @@ int main(int argc, char ** argv) {
                 wparams.abort_callback_user_data = &is_aborted;
             }
 
-            if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
+            if (use_chunks) {
+                std::vector<chunk_output> outputs;
+
+                auto add_output = [&](bool enabled, const char * ext, const char * func_name, decltype(chunk_output::func) func) {
+                    if (enabled && fout_factory.open(ext, func_name)) {
+                        outputs.push_back({ func, std::move(fout_factory.fout) });
+                    }
+                };
+
+                add_output(params.output_txt, ".txt", "output_txt", output_txt);
+                add_output(params.output_vtt, ".vtt", "output_vtt", output_vtt);
+                add_output(params.output_srt, ".srt", "output_srt", output_srt);
+                add_output(params.output_csv, ".csv", "output_csv", output_csv);
+                add_output(params.output_lrc, ".lrc", "output_lrc", output_lrc);
+
+                if (!transcribe_chunked(ctx, params, wparams, reader, user_data, fout_factory.print_segment_callback != nullptr, outputs)) {
+                    fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+                    return 10;
+                }
+            } else if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
                 fprintf(stderr, "%s: failed to process audio\n", argv[0]);
                 return 10;
             }
         }
 
         // output stuff
-        {
+        if (!use_chunks) {
             // macros to stringify function name
 #define output_func(func, ext, param, ...) if (param && fout_factory.open(ext, #func)) {\
     func(ctx, fout_factory.fout, params, __VA_ARGS__); \
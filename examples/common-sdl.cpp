@@ -1,6 +1,39 @@
 #include "common-sdl.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
+
+// copy n frames of interleaved audio into one plane per channel
+// with the channel count known at compile time the strided loads vectorize into shuffles
+template <int N>
+static void deinterleave_n(const float * src, float * const * dst, size_t n) {
+    for (int c = 0; c < N; ++c) {
+        float * d = dst[c];
+        for (size_t i = 0; i < n; ++i) {
+            d[i] = src[i*N + c];
+        }
+    }
+}
+
+static void deinterleave(const float * src, int n_channels, float * const * dst, size_t n) {
+    switch (n_channels) {
+        case 1: memcpy(dst[0], src, n*sizeof(float)); break;
+        case 2: deinterleave_n<2>(src, dst, n); break;
+        case 4: deinterleave_n<4>(src, dst, n); break;
+        case 6: deinterleave_n<6>(src, dst, n); break;
+        case 8: deinterleave_n<8>(src, dst, n); break;
+        default:
+            {
+                for (int c = 0; c < n_channels; ++c) {
+                    for (size_t i = 0; i < n; ++i) {
+                        dst[c][i] = src[i*n_channels + c];
+                    }
+                }
+            } break;
+    }
+}
 
 audio_async::audio_async(int len_ms) {
     m_len_ms = len_ms;
@@ -14,7 +47,12 @@ audio_async::~audio_async() {
     }
 }
 
-bool audio_async::init(int capture_id, int sample_rate) {
+bool audio_async::init(int capture_id, int sample_rate, int n_channels) {
+    if (n_channels < 1 || n_channels > 8) {
+        fprintf(stderr, "%s: unsupported number of channels: %d\n", __func__, n_channels);
+        return false;
+    }
+
     SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO);
 
     if (SDL_Init(SDL_INIT_AUDIO) < 0) {
@@ -40,7 +78,7 @@ bool audio_async::init(int capture_id, int sample_rate) {
 
     capture_spec_requested.freq     = sample_rate;
     capture_spec_requested.format   = AUDIO_F32;
-    capture_spec_requested.channels = 1;
+    capture_spec_requested.channels = n_channels;
     capture_spec_requested.samples  = 1024;
     capture_spec_requested.callback = [](void * userdata, uint8_t * stream, int len) {
         audio_async * audio = (audio_async *) userdata;
@@ -50,10 +88,10 @@ bool audio_async::init(int capture_id, int sample_rate) {
 
     if (capture_id >= 0) {
         fprintf(stderr, "%s: attempt to open capture device %d : '%s' ...\n", __func__, capture_id, SDL_GetAudioDeviceName(capture_id, SDL_TRUE));
-        m_dev_id_in = SDL_OpenAudioDevice(SDL_GetAudioDeviceName(capture_id, SDL_TRUE), SDL_TRUE, &capture_spec_requested, &capture_spec_obtained, 0);
+        m_dev_id_in = SDL_OpenAudioDevice(SDL_GetAudioDeviceName(capture_id, SDL_TRUE), SDL_TRUE, &capture_spec_requested, &capture_spec_obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
     } else {
         fprintf(stderr, "%s: attempt to open default capture device ...\n", __func__);
-        m_dev_id_in = SDL_OpenAudioDevice(nullptr, SDL_TRUE, &capture_spec_requested, &capture_spec_obtained, 0);
+        m_dev_id_in = SDL_OpenAudioDevice(nullptr, SDL_TRUE, &capture_spec_requested, &capture_spec_obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
     }
 
     if (!m_dev_id_in) {
@@ -71,9 +109,36 @@ bool audio_async::init(int capture_id, int sample_rate) {
         fprintf(stderr, "%s:     - samples per frame: %d\n",                   __func__, capture_spec_obtained.samples);
     }
 
-    m_sample_rate = capture_spec_obtained.freq;
+    m_sample_rate = sample_rate;
+    m_n_channels  = capture_spec_obtained.channels;
+
+    m_resamplers.clear();
+
+    if (capture_spec_obtained.freq != sample_rate) {
+        m_resamplers.resize(m_n_channels);
+
+        for (auto & resampler : m_resamplers) {
+            if (!resampler.init(capture_spec_obtained.freq, sample_rate)) {
+                fprintf(stderr, "%s: cannot resample %d Hz to %d Hz!\n", __func__, capture_spec_obtained.freq, sample_rate);
 
-    m_audio.resize((m_sample_rate*m_len_ms)/1000);
+                SDL_CloseAudioDevice(m_dev_id_in);
+                m_dev_id_in = 0;
+
+                return false;
+            }
+        }
+
+        m_resample_chunk = capture_spec_obtained.samples;
+        m_resample_in .resize(m_n_channels*m_resample_chunk);
+        m_resample_out.resize(m_n_channels*m_resamplers[0].max_out(m_resample_chunk));
+
+        fprintf(stderr, "%s: resampling %d Hz to %d Hz\n", __func__, capture_spec_obtained.freq, sample_rate);
+    }
+
+    // one extra second, so that the producer rarely reaches samples that get() is still copying
+    m_audio_len = (m_sample_rate*m_len_ms)/1000;
+    m_n_ring    = m_audio_len + m_sample_rate;
+    m_audio.resize(m_n_ring*m_n_channels);
 
     return true;
 }
@@ -110,6 +175,7 @@ bool audio_async::pause() {
     SDL_PauseAudioDevice(m_dev_id_in, 1);
 
     m_running = false;
+    m_cv.notify_all();
 
     return true;
 }
@@ -125,12 +191,8 @@ bool audio_async::clear() {
         return false;
     }
 
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-
-        m_audio_pos = 0;
-        m_audio_len = 0;
-    }
+    m_clear = m_write.load(std::memory_order_acquire);
+    m_read.store(m_clear, std::memory_order_relaxed);
 
     return true;
 }
@@ -141,33 +203,99 @@ void audio_async::callback(uint8_t * stream, int len) {
         return;
     }
 
-    size_t n_samples = len / sizeof(float);
+    const float * data = (const float *) stream;
 
-    if (n_samples > m_audio.size()) {
-        n_samples = m_audio.size();
+    size_t n_frames = len / (m_n_channels*sizeof(float));
 
-        stream += (len - (n_samples * sizeof(float)));
+    if (m_resamplers.empty()) {
+        push(data, n_frames, 0);
+        return;
     }
 
-    //fprintf(stderr, "%s: %zu samples, pos %zu, len %zu\n", __func__, n_samples, m_audio_pos, m_audio_len);
+    const size_t plane_out = m_resample_out.size()/m_n_channels;
 
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
+    float * in[8];
+
+    for (int c = 0; c < m_n_channels; ++c) {
+        in[c] = m_resample_in.data() + c*m_resample_chunk;
+    }
 
-        if (m_audio_pos + n_samples > m_audio.size()) {
-            const size_t n0 = m_audio.size() - m_audio_pos;
+    while (n_frames > 0) {
+        const size_t n = std::min(n_frames, m_resample_chunk);
 
-            memcpy(&m_audio[m_audio_pos], stream, n0 * sizeof(float));
-            memcpy(&m_audio[0], stream + n0 * sizeof(float), (n_samples - n0) * sizeof(float));
+        deinterleave(data, m_n_channels, in, n);
+
+        // the channels are resampled in lockstep, so they produce the same number of frames
+        size_t n_out = 0;
+        for (int c = 0; c < m_n_channels; ++c) {
+            n_out = m_resamplers[c].process(in[c], n, m_resample_out.data() + c*plane_out);
+        }
+
+        push(m_resample_out.data(), n_out, plane_out);
+
+        data     += n*m_n_channels;
+        n_frames -= n;
+    }
+}
+
+void audio_async::push(const float * data, size_t n_samples, size_t plane_stride) {
+    const size_t n_ring = m_n_ring;
+
+    if (n_samples > n_ring) {
+        m_n_overrun += n_samples - n_ring;
+
+        data += (n_samples - n_ring) * (plane_stride ? 1 : m_n_channels);
+
+        n_samples = n_ring;
+    }
+
+    const uint64_t w = m_write.load(std::memory_order_relaxed);
+
+    // samples this write overwrites before the consumer has seen them
+    if (w + n_samples > n_ring) {
+        const uint64_t end   = w + n_samples - n_ring;
+        const uint64_t begin = std::max(m_read.load(std::memory_order_relaxed), w > n_ring ? w - n_ring : 0);
+
+        if (end > begin) {
+            m_n_overrun += end - begin;
+        }
+    }
+
+    // announce the write first: get() drops the samples it may have copied while they were overwritten
+    m_write_begin.store(w + n_samples, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const size_t pos = w % n_ring;
+    const size_t n0  = std::min(n_samples, n_ring - pos);
+
+    auto write = [&](size_t dst_pos, size_t i0, size_t n) {
+        float * dst[8];
+
+        for (int c = 0; c < m_n_channels; ++c) {
+            dst[c] = m_audio.data() + c*n_ring + dst_pos;
+        }
+
+        if (plane_stride == 0) {
+            deinterleave(data + i0*m_n_channels, m_n_channels, dst, n);
         } else {
-            memcpy(&m_audio[m_audio_pos], stream, n_samples * sizeof(float));
+            for (int c = 0; c < m_n_channels; ++c) {
+                memcpy(dst[c], data + c*plane_stride + i0, n*sizeof(float));
+            }
         }
-        m_audio_pos = (m_audio_pos + n_samples) % m_audio.size();
-        m_audio_len = std::min(m_audio_len + n_samples, m_audio.size());
+    };
+
+    write(pos, 0, n0);
+
+    if (n0 < n_samples) {
+        write(0, n0, n_samples - n0);
     }
+
+    m_write.store(w + n_samples, std::memory_order_release);
+
+    m_cv.notify_all();
 }
 
-void audio_async::get(int ms, std::vector<float> & result) {
+void audio_async::get(int ms, std::vector<float> & result, int channel) {
     if (!m_dev_id_in) {
         fprintf(stderr, "%s: no audio device to get audio from!\n", __func__);
         return;
@@ -178,36 +306,125 @@ void audio_async::get(int ms, std::vector<float> & result) {
         return;
     }
 
+    if (channel < 0 || channel >= m_n_channels) {
+        fprintf(stderr, "%s: invalid channel %d\n", __func__, channel);
+        return;
+    }
+
     result.clear();
 
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
+    if (ms <= 0) {
+        ms = m_len_ms;
+    }
 
-        if (ms <= 0) {
-            ms = m_len_ms;
-        }
+    const size_t n_ring = m_n_ring;
+    const float * audio = m_audio.data() + channel*n_ring;
 
-        size_t n_samples = (m_sample_rate * ms) / 1000;
-        if (n_samples > m_audio_len) {
-            n_samples = m_audio_len;
-        }
+    const uint64_t w  = m_write.load(std::memory_order_acquire);
+    const uint64_t w0 = std::max(m_clear, w > m_audio_len ? w - m_audio_len : 0);
 
-        result.resize(n_samples);
+    const size_t n_samples = std::min<uint64_t>((m_sample_rate * ms) / 1000, w - w0);
+    const uint64_t s0 = w - n_samples;
 
-        int s0 = m_audio_pos - n_samples;
-        if (s0 < 0) {
-            s0 += m_audio.size();
-        }
+    result.resize(n_samples);
 
-        if (s0 + n_samples > m_audio.size()) {
-            const size_t n0 = m_audio.size() - s0;
+    const size_t pos = s0 % n_ring;
 
-            memcpy(result.data(), &m_audio[s0], n0 * sizeof(float));
-            memcpy(&result[n0], &m_audio[0], (n_samples - n0) * sizeof(float));
-        } else {
-            memcpy(result.data(), &m_audio[s0], n_samples * sizeof(float));
-        }
+    if (pos + n_samples > n_ring) {
+        const size_t n0 = n_ring - pos;
+
+        memcpy(result.data(), audio + pos, n0 * sizeof(float));
+        memcpy(&result[n0], audio, (n_samples - n0) * sizeof(float));
+    } else {
+        memcpy(result.data(), audio + pos, n_samples * sizeof(float));
+    }
+
+    // the callback may have overwritten the oldest samples during the copy
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t wb = m_write_begin.load(std::memory_order_relaxed);
+
+    if (wb > n_ring && wb - n_ring > s0) {
+        const size_t n_torn = std::min<uint64_t>(wb - n_ring - s0, n_samples);
+        result.erase(result.begin(), result.begin() + n_torn);
     }
+
+    m_read.store(std::max(m_read.load(std::memory_order_relaxed), w), std::memory_order_relaxed);
+}
+
+uint64_t audio_async::cursor() const {
+    return m_write.load(std::memory_order_acquire);
+}
+
+audio_span audio_async::read_since(uint64_t cursor, int channel) {
+    audio_span span;
+
+    const size_t n_ring = m_n_ring;
+    if (n_ring == 0 || channel < 0 || channel >= m_n_channels) {
+        return span;
+    }
+
+    const float * audio = m_audio.data() + channel*n_ring;
+
+    const uint64_t w = m_write.load(std::memory_order_acquire);
+
+    // leave out the part of the ring the next write may reuse
+    const uint64_t w0 = w > m_audio_len ? w - m_audio_len : 0;
+
+    span.begin = std::min(std::max(cursor, w0), w);
+    span.end   = w;
+
+    const size_t pos = span.begin % n_ring;
+    const size_t n   = span.end - span.begin;
+
+    span.data[0] = audio + pos;
+    span.size[0] = std::min(n, n_ring - pos);
+    span.data[1] = audio;
+    span.size[1] = n - span.size[0];
+
+    m_read.store(std::max(m_read.load(std::memory_order_relaxed), w), std::memory_order_relaxed);
+
+    return span;
+}
+
+size_t audio_async::n_overwritten(const audio_span & span) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t wb = m_write_begin.load(std::memory_order_relaxed);
+
+    const size_t n_ring = m_n_ring;
+    if (wb <= n_ring || wb - n_ring <= span.begin) {
+        return 0;
+    }
+
+    return std::min<uint64_t>(wb - n_ring - span.begin, span.n_samples());
+}
+
+void audio_span::copy_to(float * dst) const {
+    if (size[0] > 0) {
+        memcpy(dst, data[0], size[0]*sizeof(float));
+    }
+    if (size[1] > 0) {
+        memcpy(dst + size[0], data[1], size[1]*sizeof(float));
+    }
+}
+
+bool audio_async::wait_for(size_t n_samples, int timeout_ms) {
+    if (!m_dev_id_in || !m_running) {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    return m_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&]() {
+        return !m_running || available() >= n_samples;
+    }) && m_running;
+}
+
+size_t audio_async::available() const {
+    return m_write.load(std::memory_order_acquire) - m_read.load(std::memory_order_relaxed);
+}
+
+uint64_t audio_async::n_overrun() const {
+    return m_n_overrun.load(std::memory_order_relaxed);
 }
 
 bool sdl_poll_events() {
@@ -1,23 +1,53 @@
 #pragma once
 
+#include "common.h"
+
 #include <SDL.h>
 #include <SDL_audio.h>
 
 #include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <vector>
 #include <mutex>
 
+// view of captured audio inside the audio_async ring, oldest first
+// the ring wraps, so the view is up to two contiguous pieces
+struct audio_span {
+    const float * data[2] = { nullptr, nullptr };
+    size_t        size[2] = { 0, 0 };
+
+    uint64_t begin = 0; // cursor of the first sample
+    uint64_t end   = 0; // cursor after the last sample
+
+    size_t n_samples() const { return size[0] + size[1]; }
+
+    // copy the samples to dst, which must hold n_samples() values
+    void copy_to(float * dst) const;
+};
+
 //
 // SDL Audio capture
 //
+// The SDL callback is the only writer and never blocks: it copies into a ring and advances a
+// monotonic write cursor. One consumer thread reads with get() and waits with wait_for().
+//
+// A device opened with several channels gets one ring per channel: the callback deinterleaves
+// into them and all channels share the cursors, so a cursor names the same instant in each.
+// To capture from several devices, use one audio_async per device.
+//
+// The device is opened at its native rate; if that is not the requested rate, the callback
+// converts with audio_resampler instead of leaving it to the SDL backend.
+//
 
 class audio_async {
 public:
     audio_async(int len_ms);
     ~audio_async();
 
-    bool init(int capture_id, int sample_rate);
+    bool init(int capture_id, int sample_rate, int n_channels = 1);
+
+    int n_channels() const { return m_n_channels; }
 
     // start capturing audio via the provided SDL callback
     // keep last len_ms seconds of audio in a circular buffer
@@ -28,21 +58,65 @@ public:
     // callback to be called by SDL
     void callback(uint8_t * stream, int len);
 
-    // get audio data from the circular buffer
-    void get(int ms, std::vector<float> & audio);
+    // get audio data of one channel from the circular buffer
+    void get(int ms, std::vector<float> & audio, int channel = 0);
+
+    // block until n_samples new samples have been captured since the last get(), read_since() or clear()
+    // returns false on timeout or if capture is not running
+    bool wait_for(size_t n_samples, int timeout_ms);
+
+    // number of samples captured since the last get(), read_since() or clear()
+    size_t available() const;
+
+    // cursor of the next sample to be captured
+    uint64_t cursor() const;
+
+    // all audio captured since cursor, without copying - pass span.end as the next cursor
+    // if the cursor has already left the ring, the span starts at the oldest sample still stored
+    // the span stays valid until the callback wraps around to it, about 1 s after len_ms;
+    // check n_overwritten() after using it if the consumer can stall that long
+    audio_span read_since(uint64_t cursor, int channel = 0);
+
+    // number of leading samples of the span overwritten since read_since() returned it
+    size_t n_overwritten(const audio_span & span) const;
+
+    // number of samples overwritten before the consumer got them
+    uint64_t n_overrun() const;
 
 private:
+    // write n frames to the rings: interleaved if plane_stride is 0, otherwise one plane per channel
+    void push(const float * data, size_t n, size_t plane_stride);
+
     SDL_AudioDeviceID m_dev_id_in = 0;
 
     int m_len_ms = 0;
     int m_sample_rate = 0;
+    int m_n_channels = 1;
 
     std::atomic_bool m_running;
-    std::mutex       m_mutex;
 
-    std::vector<float> m_audio;
-    size_t             m_audio_pos = 0;
-    size_t             m_audio_len = 0;
+    // wakes wait_for(); the callback notifies without taking the mutex, so a wakeup that races
+    // with the predicate check is delayed until the next callback at most
+    std::mutex              m_mutex;
+    std::condition_variable m_cv;
+
+    std::vector<float> m_audio;         // m_n_channels rings of m_n_ring samples, one after another
+    size_t             m_n_ring    = 0;
+    size_t             m_audio_len = 0; // samples exposed by get(), the ring is larger by a margin
+
+    // monotonic sample cursors
+    std::atomic<uint64_t> m_write_begin{0}; // end of the write in progress
+    std::atomic<uint64_t> m_write{0};       // end of the last completed write
+    std::atomic<uint64_t> m_read{0};        // end of what the consumer has seen
+    uint64_t              m_clear = 0;      // start of the audio returned by get()
+
+    std::atomic<uint64_t> m_n_overrun{0};
+
+    // device rate to m_sample_rate, one per channel; empty if the device runs at m_sample_rate
+    std::vector<audio_resampler> m_resamplers;
+    std::vector<float>           m_resample_in;  // one plane of m_resample_chunk frames per channel
+    std::vector<float>           m_resample_out; // one plane of max_out(m_resample_chunk) frames per channel
+    size_t                       m_resample_chunk = 0;
 };
 
 // Return false if need to quit
@@ -29,8 +29,15 @@
 #ifdef _WIN32
 #include <fcntl.h>
 #include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
+#include <algorithm>
 #include <cstring>
 #include <fstream>
 
@@ -39,14 +46,171 @@
 extern bool ffmpeg_decode_audio(const std::string & ifname, std::vector<uint8_t> & wav_data);
 #endif
 
-bool read_audio_data(const std::string & fname, std::vector<float>& pcmf32, std::vector<std::vector<float>>& pcmf32s, bool stereo) {
-    std::vector<uint8_t> audio_data; // used for pipe input from stdin or ffmpeg decoding output
+void pcm16_to_f32(const int16_t * src, float * dst, size_t n) {
+    // plain loop, vectorized by the compiler into widen + convert + multiply
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = (float) src[i] * (1.0f/32768.0f);
+    }
+}
 
-    ma_result result;
-    ma_decoder_config decoder_config;
-    ma_decoder decoder;
+static uint16_t wav_u16(const uint8_t * p) { return (uint16_t) (p[0] | (p[1] << 8)); }
+static uint32_t wav_u32(const uint8_t * p) { return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24); }
 
-    decoder_config = ma_decoder_config_init(ma_format_f32, stereo ? 2 : 1, WHISPER_SAMPLE_RATE);
+static bool wav_host_is_little_endian() {
+    const uint16_t one = 1;
+    uint8_t first;
+    memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+// find the payload of an uncompressed 16-bit PCM WAV file in data
+// the little-endian samples are used in place, so big-endian hosts are left to the decoders
+static bool wav_parse_pcm16(const uint8_t * data, size_t n_data, const int16_t * & samples, size_t & n_frames, int & n_channels, int & sample_rate) {
+    if (!wav_host_is_little_endian()) {
+        return false;
+    }
+
+    // RIFF header, then chunks: "fmt " must come before "data"
+    if (n_data < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+
+    bool has_fmt = false;
+
+    for (size_t pos = 12; pos + 8 <= n_data; ) {
+        const uint8_t * chunk = data + pos;
+        const size_t    size  = wav_u32(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16 && pos + 8 + size <= n_data) {
+            uint16_t format = wav_u16(chunk + 8);
+
+            // WAVE_FORMAT_EXTENSIBLE: the format is the first two bytes of the sub-format GUID
+            if (format == 0xFFFE && size >= 40) {
+                format = wav_u16(chunk + 8 + 24);
+            }
+
+            if (format != 1 || wav_u16(chunk + 8 + 14) != 16) {
+                return false;
+            }
+
+            n_channels  = wav_u16(chunk + 8 + 2);
+            sample_rate = wav_u32(chunk + 8 + 4);
+
+            has_fmt = n_channels > 0;
+        } else if (memcmp(chunk, "data", 4) == 0 && has_fmt) {
+            // streamed files may leave the size at 0 or 0xFFFFFFFF: take the rest of the file
+            size_t n_bytes = n_data - (pos + 8);
+            if (size > 0 && size < n_bytes) {
+                n_bytes = size;
+            }
+
+            // chunks start at even offsets; a buffer that is not 2-byte aligned is left to the decoders
+            if (((uintptr_t) (chunk + 8)) % alignof(int16_t) != 0) {
+                return false;
+            }
+
+            samples  = (const int16_t *) (chunk + 8);
+            n_frames = n_bytes / (2*n_channels);
+
+            return true;
+        }
+
+        pos += 8 + size + (size & 1);
+    }
+
+    return false;
+}
+
+wav_mmap::~wav_mmap() {
+    close();
+}
+
+bool wav_mmap::open(const std::string & fname) {
+    close();
+
+    if (fname == "-") {
+        return false;
+    }
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr) {
+        return false;
+    }
+
+    m_addr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (m_addr == nullptr) {
+        return false;
+    }
+
+    m_size = (size_t) size.QuadPart;
+#else
+    const int fd = ::open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void * addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    // the payload is read once from start to end
+    posix_madvise(addr, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    m_addr = addr;
+    m_size = st.st_size;
+#endif
+
+    if (!wav_parse_pcm16((const uint8_t *) m_addr, m_size, m_samples, m_n_frames, m_n_channels, m_sample_rate)) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void wav_mmap::close() {
+    if (m_addr) {
+#ifdef _WIN32
+        UnmapViewOfFile(m_addr);
+#else
+        munmap(m_addr, m_size);
+#endif
+    }
+
+    m_addr        = nullptr;
+    m_size        = 0;
+    m_samples     = nullptr;
+    m_n_frames    = 0;
+    m_n_channels  = 0;
+    m_sample_rate = 0;
+}
+
+// open fname, "-" for stdin, or a buffer of WAV data, for decoding
+// audio_data receives the encoded input if it has to be kept in memory, and must outlive the decoder
+static bool open_audio_decoder(const std::string & fname, const ma_decoder_config & decoder_config, ma_decoder & decoder, std::vector<uint8_t> & audio_data) {
+    ma_result result;
 
     if (fname == "-") {
 		#ifdef _WIN32
@@ -94,12 +258,19 @@ bool read_audio_data(const std::string & fname, std::vector<float>& pcmf32, std:
 #endif
     }
 
+    return true;
+}
+
+// decode everything left in the decoder, then release it
+static bool read_decoder_frames(ma_decoder & decoder, std::vector<float> & pcmf32, std::vector<std::vector<float>> & pcmf32s, bool stereo) {
+    ma_result result;
     ma_uint64 frame_count;
     ma_uint64 frames_read;
 
     if ((result = ma_decoder_get_length_in_pcm_frames(&decoder, &frame_count)) != MA_SUCCESS) {
 		fprintf(stderr, "error: failed to retrieve the length of the audio data (%s)\n", ma_result_description(result));
 
+		ma_decoder_uninit(&decoder);
 		return false;
     }
 
@@ -108,6 +279,7 @@ bool read_audio_data(const std::string & fname, std::vector<float>& pcmf32, std:
     if ((result = ma_decoder_read_pcm_frames(&decoder, pcmf32.data(), frame_count, &frames_read)) != MA_SUCCESS) {
 		fprintf(stderr, "error: failed to read the frames of the audio data (%s)\n", ma_result_description(result));
 
+		ma_decoder_uninit(&decoder);
 		return false;
     }
 
@@ -126,6 +298,150 @@ bool read_audio_data(const std::string & fname, std::vector<float>& pcmf32, std:
     return true;
 }
 
+bool read_audio_data(const std::string & fname, std::vector<float>& pcmf32, std::vector<std::vector<float>>& pcmf32s, bool stereo) {
+    // fast path: mono 16-bit WAV at the model rate needs no decoding or resampling
+    if (!stereo) {
+        wav_mmap wav;
+
+        if (wav.open(fname) && wav.n_channels() == 1 && wav.sample_rate() == WHISPER_SAMPLE_RATE) {
+            pcmf32.resize(wav.n_frames());
+            pcm16_to_f32(wav.samples(), pcmf32.data(), wav.n_frames());
+
+            return true;
+        }
+    }
+
+    std::vector<uint8_t> audio_data; // used for pipe input from stdin or ffmpeg decoding output
+
+    ma_decoder_config decoder_config;
+    ma_decoder decoder;
+
+    decoder_config = ma_decoder_config_init(ma_format_f32, stereo ? 2 : 1, WHISPER_SAMPLE_RATE);
+
+    if (!open_audio_decoder(fname, decoder_config, decoder, audio_data)) {
+        return false;
+    }
+
+    return read_decoder_frames(decoder, pcmf32, pcmf32s, stereo);
+}
+
+bool read_audio_data_from_memory(const void * data, size_t size, std::vector<float> & pcmf32, std::vector<std::vector<float>> & pcmf32s, bool stereo) {
+    // fast path: mono 16-bit WAV at the model rate is converted in place
+    if (!stereo) {
+        const int16_t * samples = nullptr;
+        size_t n_frames = 0;
+        int n_channels  = 0;
+        int sample_rate = 0;
+
+        if (wav_parse_pcm16((const uint8_t *) data, size, samples, n_frames, n_channels, sample_rate) &&
+            n_channels == 1 && sample_rate == WHISPER_SAMPLE_RATE) {
+            pcmf32.resize(n_frames);
+            pcm16_to_f32(samples, pcmf32.data(), n_frames);
+
+            return true;
+        }
+    }
+
+    ma_result result;
+    ma_decoder_config decoder_config;
+    ma_decoder decoder;
+
+    decoder_config = ma_decoder_config_init(ma_format_f32, stereo ? 2 : 1, WHISPER_SAMPLE_RATE);
+
+    if ((result = ma_decoder_init_memory(data, size, &decoder_config, &decoder)) != MA_SUCCESS) {
+        fprintf(stderr, "error: failed to decode audio data (%s)\n", ma_result_description(result));
+
+        return false;
+    }
+
+    return read_decoder_frames(decoder, pcmf32, pcmf32s, stereo);
+}
+
+audio_reader::~audio_reader() {
+    close();
+}
+
+bool audio_reader::open(const std::string & fname) {
+    close();
+
+    if (m_wav.open(fname)) {
+        if (m_wav.n_channels() == 1 && m_wav.sample_rate() == WHISPER_SAMPLE_RATE) {
+            m_n_samples = m_wav.n_frames();
+            return true;
+        }
+
+        m_wav.close();
+    }
+
+    const ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_f32, 1, WHISPER_SAMPLE_RATE);
+
+    m_decoder = new ma_decoder;
+
+    if (!open_audio_decoder(fname, decoder_config, *m_decoder, m_audio_data)) {
+        delete m_decoder;
+        m_decoder = nullptr;
+
+        m_audio_data.clear();
+
+        return false;
+    }
+
+    ma_uint64 frame_count = 0;
+    if (ma_decoder_get_length_in_pcm_frames(m_decoder, &frame_count) == MA_SUCCESS) {
+        m_n_samples = frame_count;
+    }
+
+    return true;
+}
+
+void audio_reader::close() {
+    m_wav.close();
+    m_wav_pos = 0;
+
+    if (m_decoder) {
+        ma_decoder_uninit(m_decoder);
+        delete m_decoder;
+        m_decoder = nullptr;
+    }
+
+    m_audio_data.clear();
+    m_audio_data.shrink_to_fit();
+
+    m_n_samples = 0;
+}
+
+size_t audio_reader::read(size_t n_samples, std::vector<float> & pcmf32) {
+    if (m_wav.samples()) {
+        const size_t n = std::min(n_samples, m_wav.n_frames() - m_wav_pos);
+
+        pcmf32.resize(n);
+        pcm16_to_f32(m_wav.samples() + m_wav_pos, pcmf32.data(), n);
+
+        m_wav_pos += n;
+
+        return n;
+    }
+
+    pcmf32.resize(n_samples);
+
+    if (!m_decoder) {
+        pcmf32.clear();
+        return 0;
+    }
+
+    ma_uint64 frames_read = 0;
+
+    const ma_result result = ma_decoder_read_pcm_frames(m_decoder, pcmf32.data(), n_samples, &frames_read);
+    if (result != MA_SUCCESS && result != MA_AT_END) {
+        fprintf(stderr, "%s: failed to read the frames of the audio data (%s)\n", __func__, ma_result_description(result));
+        frames_read = 0;
+    }
+
+    pcmf32.resize(frames_read);
+
+    return frames_read;
+}
+
 //  500 -> 00:05.000
 // 6000 -> 01:00.000
 std::string to_timestamp(int64_t t, bool comma) {
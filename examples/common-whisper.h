@@ -14,6 +14,86 @@ bool read_audio_data(
         std::vector<std::vector<float>> & pcmf32s,
         bool stereo);
 
+// Decode an encoded file held in memory, e.g. an upload: WAV, MP3, FLAC or Ogg Vorbis
+// Mono 16-bit WAV at WHISPER_SAMPLE_RATE is converted directly, without going through the decoders
+bool read_audio_data_from_memory(
+        const void * data,
+        size_t size,
+        std::vector<float> & pcmf32,
+        std::vector<std::vector<float>> & pcmf32s,
+        bool stereo);
+
+// convert 16-bit PCM to float in [-1, 1), the same scaling as the decoders
+void pcm16_to_f32(const int16_t * src, float * dst, size_t n);
+
+// Memory-mapped 16-bit PCM WAV file: the samples are read straight from the page cache,
+// without a decoder or an intermediate copy of the whole file
+class wav_mmap {
+public:
+    wav_mmap() = default;
+    ~wav_mmap();
+
+    wav_mmap(const wav_mmap &) = delete;
+    wav_mmap & operator=(const wav_mmap &) = delete;
+
+    // fails for anything that is not an uncompressed 16-bit PCM WAV file
+    bool open(const std::string & fname);
+    void close();
+
+    // interleaved samples of the data chunk
+    const int16_t * samples() const { return m_samples; }
+
+    size_t n_frames()    const { return m_n_frames; }
+    int    n_channels()  const { return m_n_channels; }
+    int    sample_rate() const { return m_sample_rate; }
+
+private:
+    void * m_addr = nullptr;
+    size_t m_size = 0;
+
+    const int16_t * m_samples = nullptr;
+
+    size_t m_n_frames    = 0;
+    int    m_n_channels  = 0;
+    int    m_sample_rate = 0;
+};
+
+struct ma_decoder;
+
+// Pull-based decoder for audio files of any length: decodes mono PCM at WHISPER_SAMPLE_RATE in chunks
+// on request, so memory does not grow with the length of the file
+// Mono 16-bit WAV files at WHISPER_SAMPLE_RATE are memory-mapped and only converted to float
+// Input from stdin ("-") is kept in memory in its encoded form, since the decoders need to seek
+class audio_reader {
+public:
+    audio_reader() = default;
+    ~audio_reader();
+
+    audio_reader(const audio_reader &) = delete;
+    audio_reader & operator=(const audio_reader &) = delete;
+
+    // fname can be a buffer of WAV data instead of a filename
+    bool open(const std::string & fname);
+    void close();
+
+    // replace pcmf32 with the next n_samples samples, fewer at the end of the stream
+    // returns the number of samples read, 0 at the end or on error
+    size_t read(size_t n_samples, std::vector<float> & pcmf32);
+
+    // length of the stream in samples, 0 if the format does not tell
+    uint64_t n_samples() const { return m_n_samples; }
+
+private:
+    ma_decoder * m_decoder = nullptr;
+
+    wav_mmap m_wav;
+    size_t   m_wav_pos = 0;
+
+    std::vector<uint8_t> m_audio_data; // encoded input for the memory decoders
+
+    uint64_t m_n_samples = 0;
+};
+
 // convert timestamp to string, 6000 -> 01:00.000
 std::string to_timestamp(int64_t t, bool comma = false);
 
@@ -2,8 +2,10 @@
 
 #include "common.h"
 
+#include <algorithm>
 #include <cmath>
 #include <codecvt>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <locale>
@@ -594,6 +596,191 @@ gpt_vocab::id gpt_sample_top_k_top_p_repeat(
 
 }
 
+// input samples copied into the resampler per filter pass
+#define AUDIO_RESAMPLER_CHUNK 1024
+
+// modified Bessel function of the first kind, order 0
+static double bessel_i0(double x) {
+    double sum  = 1.0;
+    double term = 1.0;
+
+    for (int k = 1; k < 64; ++k) {
+        term *= (x / (2.0*k)) * (x / (2.0*k));
+        sum  += term;
+        if (term < 1e-12*sum) {
+            break;
+        }
+    }
+
+    return sum;
+}
+
+// n is a multiple of 8; eight partial sums let the loop vectorize without reassociating
+static float resampler_dot(const float * a, const float * b, int n) {
+    float acc[8] = { 0.0f };
+
+    for (int i = 0; i < n; i += 8) {
+        for (int j = 0; j < 8; ++j) {
+            acc[j] += a[i + j]*b[i + j];
+        }
+    }
+
+    return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+}
+
+bool audio_resampler::init(int rate_in, int rate_out) {
+    if (rate_in <= 0 || rate_out <= 0) {
+        return false;
+    }
+
+    int a = rate_in;
+    int b = rate_out;
+    while (b != 0) {
+        const int t = a % b;
+        a = b;
+        b = t;
+    }
+
+    m_rate_in  = rate_in;
+    m_rate_out = rate_out;
+    m_up       = rate_out / a;
+    m_down     = rate_in  / a;
+
+    // e.g. 44100 -> 16000 has 160 phases, unrelated rates would need too many
+    if (m_up > 4096) {
+        fprintf(stderr, "%s: unsupported ratio %d/%d\n", __func__, rate_in, rate_out);
+        return false;
+    }
+
+    // pass band up to 0.9 of the lower Nyquist frequency, stop band from the lower Nyquist frequency
+    const double f_stop  = 0.5*std::min(rate_in, rate_out);
+    const double f_trans = 0.1*f_stop;
+    const double f_cut   = f_stop - 0.5*f_trans;
+
+    // Kaiser window design for 80 dB of attenuation
+    const double atten = 80.0;
+    const double beta  = 0.1102*(atten - 8.7);
+
+    const int n_taps = (int) ceil((atten - 8.0)/(2.285*2.0*M_PI*f_trans/rate_in)) + 1;
+
+    m_taps = (n_taps + 7) & ~7;
+
+    // prototype filter at rate_in * L, phase p of output sample n is tap p + k*L
+    // centered on a whole tap, so that rates with L = 1 keep the samples in place
+    const int n_coefs = m_taps*m_up;
+    const int center  = n_coefs/2;
+    const double fc     = 2.0*f_cut/rate_in; // relative to rate_in
+
+    std::vector<double> h(n_coefs);
+    double sum = 0.0;
+
+    for (int j = 0; j < n_coefs; ++j) {
+        const double t = double(j - center)/m_up; // in input samples
+        const double x = M_PI*fc*t;
+        const double r = double(j - center)/center;
+
+        const double sinc = fabs(x) < 1e-9 ? 1.0 : sin(x)/x;
+        const double win  = bessel_i0(beta*sqrt(std::max(0.0, 1.0 - r*r)))/bessel_i0(beta);
+
+        h[j] = fc*sinc*win;
+        sum += h[j];
+    }
+
+    // unity gain at DC for each output sample
+    m_coefs.resize(n_coefs);
+    for (int p = 0; p < m_up; ++p) {
+        for (int k = 0; k < m_taps; ++k) {
+            m_coefs[p*m_taps + (m_taps - 1 - k)] = (float) (h[p + k*m_up]*m_up/sum);
+        }
+    }
+
+    m_buf.resize(m_taps - 1 + AUDIO_RESAMPLER_CHUNK);
+
+    reset();
+
+    return true;
+}
+
+void audio_resampler::reset() {
+    std::fill(m_buf.begin(), m_buf.end(), 0.0f);
+
+    // zero history before the first sample, first output delayed to the filter center
+    m_n     = m_taps - 1;
+    m_t     = (uint64_t) (m_taps - 1)*m_up + (m_taps*m_up)/2;
+    m_n_in  = 0;
+    m_n_out = 0;
+}
+
+size_t audio_resampler::max_out(size_t n_in) const {
+    return ((n_in + m_taps)*m_up)/m_down + 1;
+}
+
+size_t audio_resampler::run(float * out, size_t n_max) {
+    size_t n_out = 0;
+
+    while (n_out < n_max) {
+        const uint64_t i = m_t / m_up;
+        if (i >= m_n) {
+            break;
+        }
+
+        const size_t p = m_t % m_up;
+
+        out[n_out++] = resampler_dot(m_coefs.data() + p*m_taps, m_buf.data() + i - (m_taps - 1), m_taps);
+
+        m_t += m_down;
+    }
+
+    // keep only what the next output still needs
+    const uint64_t i = std::min<uint64_t>(m_t / m_up, m_n);
+    if (i > (uint64_t) m_taps - 1) {
+        const size_t n_drop = i - (m_taps - 1);
+
+        memmove(m_buf.data(), m_buf.data() + n_drop, (m_n - n_drop)*sizeof(float));
+
+        m_n -= n_drop;
+        m_t -= (uint64_t) n_drop*m_up;
+    }
+
+    m_n_out += n_out;
+
+    return n_out;
+}
+
+size_t audio_resampler::process(const float * in, size_t n_in, float * out) {
+    size_t n_out = 0;
+
+    while (n_in > 0) {
+        const size_t n = std::min(n_in, m_buf.size() - m_n);
+
+        memcpy(m_buf.data() + m_n, in, n*sizeof(float));
+
+        m_n    += n;
+        m_n_in += n;
+        in     += n;
+        n_in   -= n;
+
+        n_out += run(out + n_out, SIZE_MAX);
+    }
+
+    return n_out;
+}
+
+size_t audio_resampler::flush(float * out) {
+    const uint64_t n_total = (m_n_in*m_up + m_down - 1)/m_down;
+
+    size_t n_out = 0;
+
+    while (m_n_out < n_total) {
+        std::fill(m_buf.begin() + m_n, m_buf.end(), 0.0f);
+        m_n = m_buf.size();
+
+        n_out += run(out + n_out, n_total - m_n_out);
+    }
+
+    return n_out;
+}
+
 void high_pass_filter(std::vector<float> & data, float cutoff, float sample_rate) {
     const float rc = 1.0f / (2.0f * M_PI * cutoff);
     const float dt = 1.0f / sample_rate;
@@ -231,6 +231,50 @@ public:
     }
 };
 
+// Streaming polyphase resampler for mono PCM, e.g. 48 kHz or 44.1 kHz device audio to WHISPER_SAMPLE_RATE
+//
+// Kaiser-windowed sinc, flat to 90% of the lower Nyquist frequency and -80 dB from the lower Nyquist
+// frequency up, so nothing aliases into the band the mel spectrogram looks at.
+// Output is aligned with the input: it lags by half the filter, about 3 ms, until flush().
+class audio_resampler {
+public:
+    bool init(int rate_in, int rate_out);
+
+    // forget the stream, keep the filter
+    void reset();
+
+    // resample the next n_in samples of the stream into out, returns the number of samples written
+    // out must hold max_out(n_in) samples; no allocations
+    size_t process(const float * in, size_t n_in, float * out);
+
+    // write the delayed tail, so that the stream gets ceil(n_in_total * rate_out / rate_in) samples
+    // out must hold max_out(0) samples
+    size_t flush(float * out);
+
+    size_t max_out(size_t n_in) const;
+
+    int rate_in()  const { return m_rate_in;  }
+    int rate_out() const { return m_rate_out; }
+
+private:
+    size_t run(float * out, size_t n_max);
+
+    int m_rate_in  = 0;
+    int m_rate_out = 0;
+
+    int m_up   = 1; // L: rate_out = rate_in * L / M
+    int m_down = 1; // M
+    int m_taps = 0; // filter taps per phase, a multiple of 8
+
+    std::vector<float> m_coefs; // m_up phases of m_taps taps, reversed
+
+    std::vector<float> m_buf;   // the last m_taps - 1 samples and the new input
+    size_t             m_n = 0; // valid samples in m_buf
+
+    uint64_t m_t      = 0; // position of the next output in m_buf, in units of 1/L input samples
+    uint64_t m_n_in   = 0;
+    uint64_t m_n_out  = 0;
+};
 
 // Apply a high-pass frequency filter to PCM audio
 // Suppresses frequencies below cutoff Hz
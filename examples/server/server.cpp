@@ -7,9 +7,11 @@
 
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdio>
 #include <fstream>
 #include <sstream>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -36,6 +38,7 @@ struct server_params
     int32_t port          = 8080;
     int32_t read_timeout  = 600;
     int32_t write_timeout = 600;
+    int32_t n_parallel    = 1;
 
     bool ffmpeg_converter = false;
 };
@@ -134,7 +137,8 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  --public PATH,                 [%-7s] Path to the public folder\n", sparams.public_path.c_str());
     fprintf(stderr, "  --request-path PATH,           [%-7s] Request path for all requests\n", sparams.request_path.c_str());
     fprintf(stderr, "  --inference-path PATH,         [%-7s] Inference path for all requests\n", sparams.inference_path.c_str());
-    fprintf(stderr, "  --convert,                     [%-7s] Convert audio to WAV, requires ffmpeg on the server\n", sparams.ffmpeg_converter ? "true" : "false");
+    fprintf(stderr, "  -np N,     --parallel N        [%-7d] number of requests to transcribe at the same time\n", sparams.n_parallel);
+    fprintf(stderr, "  --convert,                     [%-7s] Convert formats that cannot be decoded in process to WAV, requires ffmpeg on the server\n", sparams.ffmpeg_converter ? "true" : "false");
     fprintf(stderr, "  -sns,      --suppress-nst      [%-7s] suppress non-speech tokens\n", params.suppress_nst ? "true" : "false");
     fprintf(stderr, "  -nth N,    --no-speech-thold N [%-7.2f] no speech threshold\n",   params.no_speech_thold);
     fprintf(stderr, "  -nc,       --no-context        [%-7s] do not use previous audio context\n", params.no_context ? "true" : "false");
@@ -195,6 +199,7 @@ bool whisper_params_parse(int argc, char ** argv, whisper_params & params, serve
         else if (                  arg == "--request-path")    { sparams.request_path = argv[++i]; }
         else if (                  arg == "--inference-path")  { sparams.inference_path = argv[++i]; }
         else if (                  arg == "--convert")         { sparams.ffmpeg_converter     = true; }
+        else if (arg == "-np"   || arg == "--parallel")        { sparams.n_parallel  = std::max(1, std::stoi(argv[++i])); }
         else {
             fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
             whisper_print_usage(argc, argv, params, sparams);
@@ -311,11 +316,11 @@ void whisper_print_progress_callback(struct whisper_context * /*ctx*/, struct wh
     }
 }
 
-void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * /*state*/, int n_new, void * user_data) {
+void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * state, int n_new, void * user_data) {
     const auto & params  = *((whisper_print_user_data *) user_data)->params;
     const auto & pcmf32s = *((whisper_print_user_data *) user_data)->pcmf32s;
 
-    const int n_segments = whisper_full_n_segments(ctx);
+    const int n_segments = whisper_full_n_segments_from_state(state);
 
     std::string speaker = "";
 
@@ -331,8 +336,8 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
 
     for (int i = s0; i < n_segments; i++) {
         if (!params.no_timestamps || params.diarize) {
-            t0 = whisper_full_get_segment_t0(ctx, i);
-            t1 = whisper_full_get_segment_t1(ctx, i);
+            t0 = whisper_full_get_segment_t0_from_state(state, i);
+            t1 = whisper_full_get_segment_t1_from_state(state, i);
         }
 
         if (!params.no_timestamps) {
@@ -344,29 +349,29 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
         }
 
         if (params.print_colors) {
-            for (int j = 0; j < whisper_full_n_tokens(ctx, i); ++j) {
+            for (int j = 0; j < whisper_full_n_tokens_from_state(state, i); ++j) {
                 if (params.print_special == false) {
-                    const whisper_token id = whisper_full_get_token_id(ctx, i, j);
+                    const whisper_token id = whisper_full_get_token_id_from_state(state, i, j);
                     if (id >= whisper_token_eot(ctx)) {
                         continue;
                     }
                 }
 
-                const char * text = whisper_full_get_token_text(ctx, i, j);
-                const float  p    = whisper_full_get_token_p   (ctx, i, j);
+                const char * text = whisper_full_get_token_text_from_state(ctx, state, i, j);
+                const float  p    = whisper_full_get_token_p_from_state(state, i, j);
 
                 const int col = std::max(0, std::min((int) k_colors.size() - 1, (int) (std::pow(p, 3)*float(k_colors.size()))));
 
                 printf("%s%s%s%s", speaker.c_str(), k_colors[col].c_str(), text, "\033[0m");
             }
         } else {
-            const char * text = whisper_full_get_segment_text(ctx, i);
+            const char * text = whisper_full_get_segment_text_from_state(state, i);
 
             printf("%s%s", speaker.c_str(), text);
         }
 
         if (params.tinydiarize) {
-            if (whisper_full_get_segment_speaker_turn_next(ctx, i)) {
+            if (whisper_full_get_segment_speaker_turn_next_from_state(state, i)) {
                 printf("%s", params.tdrz_speaker_turn.c_str());
             }
         }
@@ -379,17 +384,17 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
     }
 }
 
-std::string output_str(struct whisper_context * ctx, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
+std::string output_str(struct whisper_state * state, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
     std::stringstream result;
-    const int n_segments = whisper_full_n_segments(ctx);
+    const int n_segments = whisper_full_n_segments_from_state(state);
     for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
         std::string speaker = "";
 
         if (params.diarize && pcmf32s.size() == 2)
         {
-            const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-            const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+            const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+            const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
             speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
         }
 
@@ -513,14 +518,148 @@ void get_req_parameters(const Request & req, whisper_params & params)
     }
 }
 
+// The states the request handlers transcribe with. A request borrows one state for its whole transcription,
+// so up to n requests run at the same time on a single copy of the model weights.
+class whisper_state_pool {
+public:
+    ~whisper_state_pool() {
+        free();
+    }
+
+    // takes ownership of ctx
+    bool init(struct whisper_context * ctx, int n_states, const std::string & openvino_device) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_ctx = ctx;
+
+        for (int i = 0; i < n_states; ++i) {
+            struct whisper_state * state = whisper_init_state(ctx);
+            if (state == nullptr) {
+                fprintf(stderr, "error: failed to initialize whisper state %d\n", i);
+                return false;
+            }
+
+            // this has no effect on whisper.cpp builds that don't have OpenVINO configured
+            whisper_ctx_init_openvino_encoder_with_state(ctx, state, nullptr, openvino_device.c_str(), nullptr);
+
+            m_states.push_back(state);
+        }
+
+        m_free = m_states;
+
+        return true;
+    }
+
+    void free() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto * state : m_states) {
+            whisper_free_state(state);
+        }
+        m_states.clear();
+        m_free.clear();
+
+        whisper_free(m_ctx);
+        m_ctx = nullptr;
+    }
+
+    // wait for a free state, the context stays valid until the state is released
+    struct whisper_state * acquire(struct whisper_context ** ctx) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [&]() { return !m_free.empty() && !m_reloading; });
+
+        struct whisper_state * state = m_free.back();
+        m_free.pop_back();
+
+        *ctx = m_ctx;
+
+        return state;
+    }
+
+    void release(struct whisper_state * state) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_free.push_back(state);
+        }
+        m_cv.notify_all();
+    }
+
+    // wait for the running requests to finish, then replace the model; new requests wait for the reload
+    bool reload(const std::string & model, const whisper_context_params & cparams, const std::string & openvino_device) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [&]() { return !m_reloading; });
+            m_reloading = true;
+            m_cv.wait(lock, [&]() { return m_free.size() == m_states.size(); });
+        }
+
+        const int n_states = m_states.size();
+
+        free();
+
+        struct whisper_context * ctx = whisper_init_from_file_with_params_no_state(model.c_str(), cparams);
+
+        const bool ok = ctx != nullptr && init(ctx, n_states, openvino_device);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_reloading = false;
+        }
+        m_cv.notify_all();
+
+        return ok;
+    }
+
+    struct whisper_context * ctx() const {
+        return m_ctx;
+    }
+
+    // the requests ran on the states of the pool - the context has no state of its own
+    void print_timings() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (size_t i = 0; i < m_states.size(); ++i) {
+            fprintf(stderr, "\nstate %d:\n", (int) i);
+            whisper_print_timings_from_state(m_states[i]);
+        }
+
+        whisper_print_timings(m_ctx);
+    }
+
+private:
+    struct whisper_context * m_ctx = nullptr;
+
+    std::vector<struct whisper_state *> m_states;
+    std::vector<struct whisper_state *> m_free;
+
+    bool m_reloading = false;
+
+    std::mutex              m_mutex;
+    std::condition_variable m_cv;
+};
+
+// returns the borrowed state to the pool when the request handler exits
+struct whisper_state_lease {
+    whisper_state_pool & pool;
+
+    struct whisper_context * ctx   = nullptr;
+    struct whisper_state   * state = nullptr;
+
+    explicit whisper_state_lease(whisper_state_pool & pool) : pool(pool) {
+        state = pool.acquire(&ctx);
+    }
+
+    ~whisper_state_lease() {
+        pool.release(state);
+    }
+};
+
 }  // namespace
 
 int main(int argc, char ** argv) {
     whisper_params params;
     server_params sparams;
 
-    std::mutex whisper_mutex;
-
     if (whisper_params_parse(argc, argv, params, sparams) == false) {
         whisper_print_usage(argc, argv, params, sparams);
         return 1;
@@ -591,15 +730,21 @@ int main(int argc, char ** argv) {
         }
     }
 
-    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+    // one state per request that can run at the same time, all sharing the model
+    whisper_state_pool pool;
 
-    if (ctx == nullptr) {
-        fprintf(stderr, "error: failed to initialize whisper context\n");
-        return 3;
-    }
+    {
+        struct whisper_context * ctx = whisper_init_from_file_with_params_no_state(params.model.c_str(), cparams);
 
-    // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
-    whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
+        if (ctx == nullptr) {
+            fprintf(stderr, "error: failed to initialize whisper context\n");
+            return 3;
+        }
+
+        if (!pool.init(ctx, sparams.n_parallel, params.openvino_encode_device)) {
+            return 3;
+        }
+    }
 
     Server svr;
     svr.set_default_headers({{"Server", "whisper.cpp"},
@@ -690,8 +835,8 @@ int main(int argc, char ** argv) {
     });
 
     svr.Post(sparams.request_path + sparams.inference_path, [&](const Request &req, Response &res){
-        // acquire whisper model mutex lock
-        std::lock_guard<std::mutex> lock(whisper_mutex);
+        // each request works on its own copy of the parameters, requests can run at the same time
+        whisper_params params = default_params;
 
         // first check user requested fields of the request
         if (!req.has_file("file"))
@@ -713,9 +858,11 @@ int main(int argc, char ** argv) {
         std::vector<float> pcmf32;               // mono-channel F32 PCM
         std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
 
-        if (sparams.ffmpeg_converter) {
-            // if file is not wav, convert to wav
-            // write to temporary file
+        // decode the upload in process: WAV, MP3, FLAC and Ogg Vorbis need neither ffmpeg nor a temp file
+        bool is_decoded = ::read_audio_data_from_memory(audio_file.content.data(), audio_file.content.size(), pcmf32, pcmf32s, params.diarize);
+
+        if (!is_decoded && sparams.ffmpeg_converter) {
+            // other formats are converted to WAV by ffmpeg through a temporary file
             const std::string temp_filename = generate_temp_filename("whisper-server", ".wav");
             std::ofstream temp_file{temp_filename, std::ios::binary};
             temp_file << audio_file.content;
@@ -739,18 +886,25 @@ int main(int argc, char ** argv) {
             }
             // remove temp file
             std::remove(temp_filename.c_str());
-        } else {
-            if (!::read_audio_data(audio_file.content, pcmf32, pcmf32s, params.diarize))
-            {
-                fprintf(stderr, "error: failed to read audio data\n");
-                const std::string error_resp = "{\"error\":\"failed to read audio data\"}";
-                res.set_content(error_resp, "application/json");
-                return;
-            }
+
+            is_decoded = true;
+        }
+
+        if (!is_decoded) {
+            fprintf(stderr, "error: failed to read audio data\n");
+            const std::string error_resp = "{\"error\":\"failed to read audio data\"}";
+            res.set_content(error_resp, "application/json");
+            return;
         }
 
         printf("Successfully loaded %s\n", filename.c_str());
 
+        // wait for a free state, the upload above has been decoded without holding one
+        whisper_state_lease lease(pool);
+
+        struct whisper_context * ctx   = lease.ctx;
+        struct whisper_state   * state = lease.state;
+
         // print system information
         {
             fprintf(stderr, "\n");
@@ -827,6 +981,9 @@ int main(int argc, char ** argv) {
 
             wparams.suppress_nst     = params.suppress_nst;
 
+            // merge the decoder passes of the requests running at the same time
+            wparams.batch_decode     = sparams.n_parallel > 1;
+
             whisper_print_user_data user_data = { &params, &pcmf32s, 0 };
 
             // this callback is called on each new segment
@@ -848,7 +1005,7 @@ int main(int argc, char ** argv) {
             };
             wparams.abort_callback_user_data = (void*)&req;
 
-            if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
+            if (whisper_full_parallel_with_state(ctx, state, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
                 // handle failure or early abort
                 if (req.is_connection_closed()) {
                     // log client disconnect
@@ -868,17 +1025,17 @@ int main(int argc, char ** argv) {
         // return results to user
         if (params.response_format == text_format)
         {
-            std::string results = output_str(ctx, params, pcmf32s);
+            std::string results = output_str(state, params, pcmf32s);
             res.set_content(results.c_str(), "text/html; charset=utf-8");
         }
         else if (params.response_format == srt_format)
         {
             std::stringstream ss;
-            const int n_segments = whisper_full_n_segments(ctx);
+            const int n_segments = whisper_full_n_segments_from_state(state);
             for (int i = 0; i < n_segments; ++i) {
-                const char * text = whisper_full_get_segment_text(ctx, i);
-                const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-                const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+                const char * text = whisper_full_get_segment_text_from_state(state, i);
+                const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+                const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
                 std::string speaker = "";
 
                 if (params.diarize && pcmf32s.size() == 2)
@@ -896,11 +1053,11 @@ int main(int argc, char ** argv) {
 
             ss << "WEBVTT\n\n";
 
-            const int n_segments = whisper_full_n_segments(ctx);
+            const int n_segments = whisper_full_n_segments_from_state(state);
             for (int i = 0; i < n_segments; ++i) {
-                const char * text = whisper_full_get_segment_text(ctx, i);
-                const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-                const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+                const char * text = whisper_full_get_segment_text_from_state(state, i);
+                const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+                const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
                 std::string speaker = "";
 
                 if (params.diarize && pcmf32s.size() == 2)
@@ -916,13 +1073,13 @@ int main(int argc, char ** argv) {
             res.set_content(ss.str(), "text/vtt");
         } else if (params.response_format == vjson_format) {
             /* try to match openai/whisper's Python format */
-            std::string results = output_str(ctx, params, pcmf32s); 
+            std::string results = output_str(state, params, pcmf32s); 
             // Get language probabilities
             std::vector<float> lang_probs(whisper_lang_max_id() + 1, 0.0f);
-            const auto detected_lang_id = whisper_lang_auto_detect(ctx, 0, params.n_threads, lang_probs.data());
+            const auto detected_lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, params.n_threads, lang_probs.data());
             json jres = json{
                 {"task", params.translate ? "translate" : "transcribe"},
-                {"language", whisper_lang_str_full(whisper_full_lang_id(ctx))},
+                {"language", whisper_lang_str_full(whisper_full_lang_id_from_state(state))},
                 {"duration", float(pcmf32.size())/WHISPER_SAMPLE_RATE},
                 {"text", results},
                 {"segments", json::array()},
@@ -936,29 +1093,29 @@ int main(int argc, char ** argv) {
                     jres["language_probabilities"][whisper_lang_str(i)] = lang_probs[i];
                 }
             }
-            const int n_segments = whisper_full_n_segments(ctx);
+            const int n_segments = whisper_full_n_segments_from_state(state);
             for (int i = 0; i < n_segments; ++i)
             {
                 json segment = json{
                     {"id", i},
-                    {"text", whisper_full_get_segment_text(ctx, i)},
+                    {"text", whisper_full_get_segment_text_from_state(state, i)},
                 };
 
                 if (!params.no_timestamps) {
-                    segment["start"] = whisper_full_get_segment_t0(ctx, i) * 0.01;
-                    segment["end"] = whisper_full_get_segment_t1(ctx, i) * 0.01;
+                    segment["start"] = whisper_full_get_segment_t0_from_state(state, i) * 0.01;
+                    segment["end"] = whisper_full_get_segment_t1_from_state(state, i) * 0.01;
                 }
 
                 float total_logprob = 0;
-                const int n_tokens = whisper_full_n_tokens(ctx, i);
+                const int n_tokens = whisper_full_n_tokens_from_state(state, i);
                 for (int j = 0; j < n_tokens; ++j) {
-                    whisper_token_data token = whisper_full_get_token_data(ctx, i, j);
+                    whisper_token_data token = whisper_full_get_token_data_from_state(state, i, j);
                     if (token.id >= whisper_token_eot(ctx)) {
                         continue;
                     }
 
                     segment["tokens"].push_back(token.id);
-                    json word = json{{"word", whisper_full_get_token_text(ctx, i, j)}};
+                    json word = json{{"word", whisper_full_get_token_text_from_state(ctx, state, i, j)}};
                     if (!params.no_timestamps) {
                         word["start"] = token.t0 * 0.01;
                         word["end"] = token.t1 * 0.01;
@@ -974,7 +1131,7 @@ int main(int argc, char ** argv) {
 
                 // TODO compression_ratio and no_speech_prob are not implemented yet
                 // segment["compression_ratio"] = 0;
-                segment["no_speech_prob"] = whisper_full_get_segment_no_speech_prob(ctx, i);
+                segment["no_speech_prob"] = whisper_full_get_segment_no_speech_prob_from_state(state, i);
 
                 jres["segments"].push_back(segment);
             }
@@ -984,7 +1141,7 @@ int main(int argc, char ** argv) {
         // TODO add more output formats
         else
         {
-            std::string results = output_str(ctx, params, pcmf32s);
+            std::string results = output_str(state, params, pcmf32s);
             json jres = json{
                 {"text", results}
             };
@@ -992,11 +1149,8 @@ int main(int argc, char ** argv) {
                             "application/json");
         }
 
-        // reset params to their defaults
-        params = default_params;
     });
     svr.Post(sparams.request_path + "/load", [&](const Request &req, Response &res){
-        std::lock_guard<std::mutex> lock(whisper_mutex);
         if (!req.has_file("model"))
         {
             fprintf(stderr, "error: no 'model' field in the request\n");
@@ -1013,21 +1167,13 @@ int main(int argc, char ** argv) {
             return;
         }
 
-        // clean up
-        whisper_free(ctx);
-
-        // whisper init
-        ctx = whisper_init_from_file_with_params(model.c_str(), cparams);
-
+        // waits for the running requests, then frees the old model and its states
         // TODO perhaps load prior model here instead of exit
-        if (ctx == nullptr) {
+        if (!pool.reload(model, cparams, params.openvino_encode_device)) {
             fprintf(stderr, "error: model init  failed, no model loaded must exit\n");
             exit(1);
         }
 
-        // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
-        whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
-
         const std::string success = "Load was successful!";
         res.set_content(success, "application/text");
 
@@ -1084,8 +1230,8 @@ int main(int argc, char ** argv) {
         return 1;
     }
 
-    whisper_print_timings(ctx);
-    whisper_free(ctx);
+    pool.print_timings();
+    pool.free();
 
     return 0;
 }
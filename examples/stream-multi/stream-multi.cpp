@@ -0,0 +1,403 @@
+// Real-time speech recognition of several microphones or microphone channels at once
+//
+// All sources share one whisper_context, so the model is loaded once. Each source gets its own
+// whisper_state and every step the sources are transcribed in parallel.
+//
+#include "common-sdl.h"
+#include "common.h"
+#include "common-whisper.h"
+#include "whisper.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// command-line parameters
+struct whisper_params {
+    int32_t n_threads  = std::min(4, (int32_t) std::thread::hardware_concurrency());
+    int32_t step_ms    = 5000;
+    int32_t keep_ms    = 200;
+    int32_t n_channels = 1;
+    int32_t audio_ctx  = 0;
+    int32_t beam_size  = -1;
+
+    bool translate     = false;
+    bool no_fallback   = false;
+    bool print_special = false;
+    bool no_context    = true;
+    bool use_gpu       = true;
+    bool flash_attn    = false;
+
+    std::vector<int32_t> capture_ids = { -1 };
+
+    std::string language  = "en";
+    std::string model     = "models/ggml-base.en.bin";
+    std::string fname_out;
+};
+
+void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
+
+static std::vector<int32_t> parse_capture_ids(const std::string & arg) {
+    std::vector<int32_t> ids;
+
+    std::stringstream ss(arg);
+    std::string id;
+    while (std::getline(ss, id, ',')) {
+        ids.push_back(std::stoi(id));
+    }
+
+    return ids;
+}
+
+static bool whisper_params_parse(int argc, char ** argv, whisper_params & params) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            whisper_print_usage(argc, argv, params);
+            exit(0);
+        }
+        else if (arg == "-t"    || arg == "--threads")       { params.n_threads     = std::stoi(argv[++i]); }
+        else if (                  arg == "--step")          { params.step_ms       = std::stoi(argv[++i]); }
+        else if (                  arg == "--keep")          { params.keep_ms       = std::stoi(argv[++i]); }
+        else if (arg == "-c"    || arg == "--capture")       { params.capture_ids   = parse_capture_ids(argv[++i]); }
+        else if (arg == "-ch"   || arg == "--channels")      { params.n_channels    = std::stoi(argv[++i]); }
+        else if (arg == "-ac"   || arg == "--audio-ctx")     { params.audio_ctx     = std::stoi(argv[++i]); }
+        else if (arg == "-bs"   || arg == "--beam-size")     { params.beam_size     = std::stoi(argv[++i]); }
+        else if (arg == "-tr"   || arg == "--translate")     { params.translate     = true; }
+        else if (arg == "-nf"   || arg == "--no-fallback")   { params.no_fallback   = true; }
+        else if (arg == "-ps"   || arg == "--print-special") { params.print_special = true; }
+        else if (arg == "-kc"   || arg == "--keep-context")  { params.no_context    = false; }
+        else if (arg == "-l"    || arg == "--language")      { params.language      = argv[++i]; }
+        else if (arg == "-m"    || arg == "--model")         { params.model         = argv[++i]; }
+        else if (arg == "-f"    || arg == "--file")          { params.fname_out     = argv[++i]; }
+        else if (arg == "-ng"   || arg == "--no-gpu")        { params.use_gpu       = false; }
+        else if (arg == "-fa"   || arg == "--flash-attn")    { params.flash_attn    = true; }
+
+        else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            whisper_print_usage(argc, argv, params);
+            exit(0);
+        }
+    }
+
+    return true;
+}
+
+void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,       --help          [default] show this help message and exit\n");
+    fprintf(stderr, "  -t N,     --threads N     [%-7d] number of threads shared by all sources\n",        params.n_threads);
+    fprintf(stderr, "            --step N        [%-7d] audio step size in milliseconds\n",                params.step_ms);
+    fprintf(stderr, "            --keep N        [%-7d] audio to keep from previous step in ms\n",         params.keep_ms);
+    fprintf(stderr, "  -c IDS,   --capture IDS   [%-7d] comma-separated capture device IDs\n",             params.capture_ids[0]);
+    fprintf(stderr, "  -ch N,    --channels N    [%-7d] channels to capture from each device\n",           params.n_channels);
+    fprintf(stderr, "  -ac N,    --audio-ctx N   [%-7d] audio context size (0 - all)\n",                   params.audio_ctx);
+    fprintf(stderr, "  -bs N,    --beam-size N   [%-7d] beam size for beam search\n",                      params.beam_size);
+    fprintf(stderr, "  -tr,      --translate     [%-7s] translate from source language to english\n",      params.translate ? "true" : "false");
+    fprintf(stderr, "  -nf,      --no-fallback   [%-7s] do not use temperature fallback while decoding\n", params.no_fallback ? "true" : "false");
+    fprintf(stderr, "  -ps,      --print-special [%-7s] print special tokens\n",                           params.print_special ? "true" : "false");
+    fprintf(stderr, "  -kc,      --keep-context  [%-7s] keep context between audio chunks\n",              params.no_context ? "false" : "true");
+    fprintf(stderr, "  -l LANG,  --language LANG [%-7s] spoken language\n",                                params.language.c_str());
+    fprintf(stderr, "  -m FNAME, --model FNAME   [%-7s] model path\n",                                     params.model.c_str());
+    fprintf(stderr, "  -f FNAME, --file FNAME    [%-7s] text output file name\n",                          params.fname_out.c_str());
+    fprintf(stderr, "  -ng,      --no-gpu        [%-7s] disable GPU inference\n",                          params.use_gpu ? "false" : "true");
+    fprintf(stderr, "  -fa,      --flash-attn    [%-7s] flash attention during inference\n",               params.flash_attn ? "true" : "false");
+    fprintf(stderr, "\n");
+}
+
+// one transcribed channel of one capture device
+struct stream_source {
+    int device  = 0;
+    int channel = 0;
+
+    std::string label;
+
+    whisper_state * state = nullptr;
+
+    // position of the next new sample in the device ring
+    uint64_t cursor = 0;
+
+    std::vector<float> pcmf32;
+
+    // device cursor at the start of the capture and of pcmf32[0]
+    uint64_t t_start    = 0;
+    uint64_t t0_samples = 0;
+
+    std::vector<whisper_token> prompt_tokens;
+
+    bool failed = false;
+};
+
+int main(int argc, char ** argv) {
+    whisper_params params;
+
+    if (whisper_params_parse(argc, argv, params) == false) {
+        return 1;
+    }
+
+    if (params.capture_ids.empty()) {
+        fprintf(stderr, "error: no capture devices given\n");
+        return 1;
+    }
+
+    params.keep_ms = std::min(params.keep_ms, params.step_ms);
+
+    const int n_samples_step = (1e-3*params.step_ms)*WHISPER_SAMPLE_RATE;
+    const int n_samples_keep = (1e-3*params.keep_ms)*WHISPER_SAMPLE_RATE;
+
+    if (n_samples_step <= 0) {
+        fprintf(stderr, "error: --step must be positive\n");
+        return 1;
+    }
+
+    // init audio, one ring per device with one plane per channel
+
+    std::vector<std::unique_ptr<audio_async>> devices;
+
+    for (int32_t capture_id : params.capture_ids) {
+        // two steps of history, enough to cover one slow inference round
+        devices.emplace_back(new audio_async(2*params.step_ms));
+
+        if (!devices.back()->init(capture_id, WHISPER_SAMPLE_RATE, params.n_channels)) {
+            fprintf(stderr, "%s: audio.init() failed for capture device %d!\n", __func__, capture_id);
+            return 1;
+        }
+    }
+
+    // whisper init
+    if (params.language != "auto" && whisper_lang_id(params.language.c_str()) == -1){
+        fprintf(stderr, "error: unknown language '%s'\n", params.language.c_str());
+        whisper_print_usage(argc, argv, params);
+        exit(0);
+    }
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+
+    cparams.use_gpu    = params.use_gpu;
+    cparams.flash_attn = params.flash_attn;
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params_no_state(params.model.c_str(), cparams);
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 2;
+    }
+
+    std::vector<stream_source> sources;
+
+    for (int d = 0; d < (int) devices.size(); ++d) {
+        for (int c = 0; c < devices[d]->n_channels(); ++c) {
+            stream_source src;
+
+            src.device  = d;
+            src.channel = c;
+            src.label   = std::to_string(params.capture_ids[d]) + ":" + std::to_string(c);
+            src.state   = whisper_init_state(ctx);
+
+            if (src.state == nullptr) {
+                fprintf(stderr, "error: failed to initialize whisper state for source %s\n", src.label.c_str());
+                return 2;
+            }
+
+            src.pcmf32.reserve(n_samples_keep + 2*n_samples_step);
+
+            sources.push_back(std::move(src));
+        }
+    }
+
+    const int n_sources = sources.size();
+
+    // split the threads between the sources that run at the same time
+    const int n_threads_per_source = std::max(1, params.n_threads / n_sources);
+
+    // print some info about the processing
+    {
+        fprintf(stderr, "\n");
+        if (!whisper_is_multilingual(ctx)) {
+            if (params.language != "en" || params.translate) {
+                params.language = "en";
+                params.translate = false;
+                fprintf(stderr, "%s: WARNING: model is not multilingual, ignoring language and translation options\n", __func__);
+            }
+        }
+        fprintf(stderr, "%s: processing %d sources from %d devices (step = %.1f sec / keep = %.1f sec), %d threads per source, lang = %s, task = %s ...\n",
+                __func__,
+                n_sources,
+                (int) devices.size(),
+                float(n_samples_step)/WHISPER_SAMPLE_RATE,
+                float(n_samples_keep)/WHISPER_SAMPLE_RATE,
+                n_threads_per_source,
+                params.language.c_str(),
+                params.translate ? "translate" : "transcribe");
+        fprintf(stderr, "\n");
+    }
+
+    std::ofstream fout;
+    if (params.fname_out.length() > 0) {
+        fout.open(params.fname_out);
+        if (!fout.is_open()) {
+            fprintf(stderr, "%s: failed to open output file '%s'!\n", __func__, params.fname_out.c_str());
+            return 1;
+        }
+    }
+
+    for (auto & device : devices) {
+        device->resume();
+    }
+
+    for (auto & src : sources) {
+        src.cursor     = devices[src.device]->cursor();
+        src.t_start    = src.cursor;
+        src.t0_samples = src.cursor;
+    }
+
+    printf("[Start speaking]\n");
+    fflush(stdout);
+
+    auto transcribe = [&](stream_source & src) {
+        whisper_full_params wparams = whisper_full_default_params(params.beam_size > 1 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
+
+        wparams.print_progress   = false;
+        wparams.print_special    = params.print_special;
+        wparams.print_realtime   = false;
+        wparams.print_timestamps = false;
+        wparams.translate        = params.translate;
+        wparams.language         = params.language.c_str();
+        wparams.n_threads        = n_threads_per_source;
+        wparams.beam_search.beam_size = params.beam_size;
+
+        wparams.audio_ctx        = params.audio_ctx;
+
+        wparams.temperature_inc  = params.no_fallback ? 0.0f : wparams.temperature_inc;
+
+        wparams.prompt_tokens    = params.no_context ? nullptr : src.prompt_tokens.data();
+        wparams.prompt_n_tokens  = params.no_context ? 0       : src.prompt_tokens.size();
+
+        src.failed = whisper_full_with_state(ctx, src.state, wparams, src.pcmf32.data(), src.pcmf32.size()) != 0;
+    };
+
+    bool is_running = true;
+
+    // main audio loop
+    while (is_running) {
+        // wait until every device has captured a full step
+        for (auto & device : devices) {
+            while (is_running && !device->wait_for(n_samples_step, 100)) {
+                // handle Ctrl + C
+                is_running = sdl_poll_events();
+            }
+        }
+
+        is_running = is_running && sdl_poll_events();
+        if (!is_running) {
+            break;
+        }
+
+        // move the new audio of each source into its window, after the tail of the previous one
+        for (auto & src : sources) {
+            audio_async & device = *devices[src.device];
+
+            const audio_span span = device.read_since(src.cursor, src.channel);
+
+            if (span.begin > src.cursor) {
+                fprintf(stderr, "%s: WARNING: source %s lost %d ms of audio\n", __func__, src.label.c_str(),
+                        (int) ((span.begin - src.cursor)*1000/WHISPER_SAMPLE_RATE));
+            }
+            src.cursor = span.end;
+
+            const int n_samples_new  = span.n_samples();
+            const int n_samples_take = std::min((int) src.pcmf32.size(), n_samples_keep);
+
+            memmove(src.pcmf32.data(), src.pcmf32.data() + src.pcmf32.size() - n_samples_take, n_samples_take*sizeof(float));
+            src.pcmf32.resize(n_samples_take + n_samples_new);
+
+            span.copy_to(src.pcmf32.data() + n_samples_take);
+
+            if (device.n_overwritten(span) > 0) {
+                fprintf(stderr, "%s: WARNING: audio of source %s was overwritten while reading it\n", __func__, src.label.c_str());
+            }
+
+            src.t0_samples = span.begin - n_samples_take;
+        }
+
+        // fan out: each source runs on its own state, the model weights are shared
+        {
+            std::vector<std::thread> workers;
+            workers.reserve(n_sources - 1);
+
+            for (int i = 1; i < n_sources; ++i) {
+                workers.emplace_back(transcribe, std::ref(sources[i]));
+            }
+
+            transcribe(sources[0]);
+
+            for (auto & worker : workers) {
+                worker.join();
+            }
+        }
+
+        // print result
+        for (auto & src : sources) {
+            if (src.failed) {
+                fprintf(stderr, "%s: failed to process audio of source %s\n", argv[0], src.label.c_str());
+                return 6;
+            }
+
+            // segment times are relative to the window, make them relative to the start of the capture
+            const int64_t t_offset = (int64_t) (src.t0_samples - src.t_start)*100/WHISPER_SAMPLE_RATE;
+
+            const int n_segments = whisper_full_n_segments_from_state(src.state);
+            for (int i = 0; i < n_segments; ++i) {
+                const char * text = whisper_full_get_segment_text_from_state(src.state, i);
+
+                const int64_t t0 = t_offset + whisper_full_get_segment_t0_from_state(src.state, i);
+                const int64_t t1 = t_offset + whisper_full_get_segment_t1_from_state(src.state, i);
+
+                std::string output = "[" + src.label + "] [" + to_timestamp(t0, false) + " --> " + to_timestamp(t1, false) + "]  " + text + "\n";
+
+                printf("%s", output.c_str());
+
+                if (params.fname_out.length() > 0) {
+                    fout << output;
+                }
+            }
+
+            // add the tokens of all the segments of the window just transcribed as the prompt of the next one
+            if (!params.no_context) {
+                src.prompt_tokens.clear();
+
+                for (int i = 0; i < n_segments; ++i) {
+                    const int token_count = whisper_full_n_tokens_from_state(src.state, i);
+                    for (int j = 0; j < token_count; ++j) {
+                        src.prompt_tokens.push_back(whisper_full_get_token_id_from_state(src.state, i, j));
+                    }
+                }
+            }
+        }
+
+        fflush(stdout);
+        if (params.fname_out.length() > 0) {
+            fout.flush();
+        }
+    }
+
+    for (auto & device : devices) {
+        device->pause();
+    }
+
+    for (auto & src : sources) {
+        whisper_free_state(src.state);
+    }
+
+    whisper_free(ctx);
+
+    return 0;
+}
@@ -22,7 +22,7 @@ struct whisper_params {
     int32_t keep_ms    = 200;
     int32_t capture_id = -1;
     int32_t max_tokens = 32;
-    int32_t audio_ctx  = 0;
+    int32_t audio_ctx  = -1;
     int32_t beam_size  = -1;
 
     float vad_thold    = 0.6f;
@@ -97,7 +97,7 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "            --keep N        [%-7d] audio to keep from previous step in ms\n",         params.keep_ms);
     fprintf(stderr, "  -c ID,    --capture ID    [%-7d] capture device ID\n",                              params.capture_id);
     fprintf(stderr, "  -mt N,    --max-tokens N  [%-7d] maximum number of tokens per audio chunk\n",       params.max_tokens);
-    fprintf(stderr, "  -ac N,    --audio-ctx N   [%-7d] audio context size (0 - all)\n",                   params.audio_ctx);
+    fprintf(stderr, "  -ac N,    --audio-ctx N   [%-7d] audio context size (0 - all, -1 - fit to the window)\n", params.audio_ctx);
     fprintf(stderr, "  -bs N,    --beam-size N   [%-7d] beam size for beam search\n",                      params.beam_size);
     fprintf(stderr, "  -vth N,   --vad-thold N   [%-7.2f] voice activity detection threshold\n",           params.vad_thold);
     fprintf(stderr, "  -fth N,   --freq-thold N  [%-7.2f] high-pass frequency cutoff\n",                   params.freq_thold);
@@ -162,10 +162,14 @@ int main(int argc, char ** argv) {
 
     struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
 
-    std::vector<float> pcmf32    (n_samples_30s, 0.0f);
-    std::vector<float> pcmf32_old;
+    std::vector<float> pcmf32;
     std::vector<float> pcmf32_new(n_samples_30s, 0.0f);
 
+    pcmf32.reserve(n_samples_30s);
+
+    // position of the next new sample in the capture ring
+    uint64_t audio_cursor = audio.cursor();
+
     std::vector<whisper_token> prompt_tokens;
 
     // print some info about the processing
@@ -230,7 +234,7 @@ int main(int argc, char ** argv) {
 
     // main audio loop
     while (is_running) {
-        if (params.save_audio) {
+        if (params.save_audio && use_vad) {
             wavWriter.write(pcmf32_new.data(), pcmf32_new.size());
         }
         // handle Ctrl + C
@@ -243,44 +247,56 @@ int main(int argc, char ** argv) {
         // process new audio
 
         if (!use_vad) {
+            audio_span span;
+
             while (true) {
                 // handle Ctrl + C
                 is_running = sdl_poll_events();
                 if (!is_running) {
                     break;
                 }
-                audio.get(params.step_ms, pcmf32_new);
 
-                if ((int) pcmf32_new.size() > 2*n_samples_step) {
-                    fprintf(stderr, "\n\n%s: WARNING: cannot process audio fast enough, dropping audio ...\n\n", __func__);
-                    audio.clear();
+                // sleep until a full step has been captured, waking up now and then for the SDL events
+                if (!audio.wait_for(n_samples_step, 100)) {
                     continue;
                 }
 
-                if ((int) pcmf32_new.size() >= n_samples_step) {
-                    audio.clear();
-                    break;
+                // everything captured since the last step, read in place
+                span = audio.read_since(audio_cursor);
+                audio_cursor = span.end;
+
+                if ((int) span.n_samples() > 2*n_samples_step) {
+                    fprintf(stderr, "\n\n%s: WARNING: cannot process audio fast enough, dropping audio ...\n\n", __func__);
+                    continue;
                 }
 
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                break;
+            }
+
+            if (!is_running) {
+                break;
             }
 
-            const int n_samples_new = pcmf32_new.size();
+            const int n_samples_new = span.n_samples();
 
             // take up to params.length_ms audio from previous iteration
-            const int n_samples_take = std::min((int) pcmf32_old.size(), std::max(0, n_samples_keep + n_samples_len - n_samples_new));
+            const int n_samples_take = std::min((int) pcmf32.size(), std::max(0, n_samples_keep + n_samples_len - n_samples_new));
 
-            //printf("processing: take = %d, new = %d, old = %d\n", n_samples_take, n_samples_new, (int) pcmf32_old.size());
+            //printf("processing: take = %d, new = %d, old = %d\n", n_samples_take, n_samples_new, (int) pcmf32.size());
 
-            pcmf32.resize(n_samples_new + n_samples_take);
+            // the tail of the previous window moves to the front, the new audio goes right after it
+            memmove(pcmf32.data(), pcmf32.data() + pcmf32.size() - n_samples_take, n_samples_take*sizeof(float));
+            pcmf32.resize(n_samples_take + n_samples_new);
 
-            for (int i = 0; i < n_samples_take; i++) {
-                pcmf32[i] = pcmf32_old[pcmf32_old.size() - n_samples_take + i];
-            }
+            span.copy_to(pcmf32.data() + n_samples_take);
 
-            memcpy(pcmf32.data() + n_samples_take, pcmf32_new.data(), n_samples_new*sizeof(float));
+            if (audio.n_overwritten(span) > 0) {
+                fprintf(stderr, "\n\n%s: WARNING: audio was overwritten while reading it ...\n\n", __func__);
+            }
 
-            pcmf32_old = pcmf32;
+            if (params.save_audio) {
+                wavWriter.write(pcmf32.data() + n_samples_take, n_samples_new);
+            }
         } else {
             const auto t_now  = std::chrono::high_resolution_clock::now();
             const auto t_diff = std::chrono::duration_cast<std::chrono::milliseconds>(t_now - t_last).count();
@@ -401,7 +417,7 @@ int main(int argc, char ** argv) {
                 printf("\n");
 
                 // keep part of the audio for next iteration to try to mitigate word boundary issues
-                pcmf32_old = std::vector<float>(pcmf32.end() - n_samples_keep, pcmf32.end());
+                pcmf32.erase(pcmf32.begin(), pcmf32.end() - n_samples_keep);
 
                 // Add tokens of the last full length segment as the prompt
                 if (!params.no_context) {
@@ -79,6 +79,7 @@ extern "C" {
 
     struct whisper_context;
     struct whisper_state;
+    struct whisper_mel_stream;
     struct whisper_full_params;
 
     typedef int32_t whisper_pos;
@@ -126,6 +127,13 @@ extern "C" {
         struct whisper_aheads dtw_aheads;
 
         size_t dtw_mem_size; // TODO: remove
+
+        // [EXPERIMENTAL] Encoder layer skipping for fast, lower quality draft transcription
+        // the encoder runs the first encoder_n_layer layers, of those only every encoder_layer_step-th one counting back
+        // from the last, and then continues into the final layer norm and the cross-attention as usual
+        // not applied when the encoder runs through Core ML or OpenVINO
+        int encoder_n_layer;    // 0 - all layers
+        int encoder_layer_step; // 1 - every layer
     };
 
     typedef struct whisper_token_data {
@@ -270,6 +278,7 @@ extern "C" {
 
     // Convert RAW PCM audio to log mel spectrogram.
     // The resulting spectrogram is stored inside the default state of the provided whisper context.
+    // The audio must be longer than WHISPER_N_FFT/2 samples (the reflective padding at the start)
     // Returns 0 on success
     WHISPER_API int whisper_pcm_to_mel(
             struct whisper_context * ctx,
@@ -284,6 +293,19 @@ extern "C" {
                                int   n_samples,
                                int   n_threads);
 
+    // Convert the audio of several states at once: samples[i] -> states[i]
+    // The frames of all the inputs are spread over a pool of worker threads owned by the context,
+    // so many short requests keep the cores busy and no threads are created per call.
+    // Every input must be longer than WHISPER_N_FFT/2 samples, as for whisper_pcm_to_mel()
+    // Returns 0 on success
+    WHISPER_API int whisper_pcm_to_mel_batch(
+            struct whisper_context * ctx,
+             struct whisper_state ** states,
+                      const float ** samples,
+                         const int * n_samples,
+                               int   n_batch,
+                               int   n_threads);
+
     // This can be used to set a custom log mel spectrogram inside the default state of the provided whisper context.
     // Use this instead of whisper_pcm_to_mel() if you want to provide your own log mel spectrogram.
     // n_mel must be 80
@@ -301,6 +323,36 @@ extern "C" {
                                int   n_len,
                                int   n_mel);
 
+    // Streaming log mel spectrogram
+    // Keeps the frames of the audio pushed so far and computes only the frames completed by new samples,
+    // so the cost of a step is proportional to the new audio rather than to the window length.
+    // whisper_mel_stream_to_state() stores the current window in the state, the same spectrogram that
+    // whisper_pcm_to_mel_with_state() computes for these samples. Then call whisper_full_with_state()
+    // with n_samples = 0 to process it.
+    // The stream must not outlive the context it was created for.
+    WHISPER_API struct whisper_mel_stream * whisper_mel_stream_init(struct whisper_context * ctx);
+    WHISPER_API void whisper_mel_stream_free (struct whisper_mel_stream * stream);
+    WHISPER_API void whisper_mel_stream_reset(struct whisper_mel_stream * stream);
+
+    // Append new samples to the stream
+    // Returns 0 on success
+    WHISPER_API int whisper_mel_stream_push(
+            struct whisper_mel_stream * stream,
+                          const float * samples,
+                                  int   n_samples);
+
+    // Slide the window: keep only the frames of the last n_samples (rounded to WHISPER_HOP_LENGTH)
+    WHISPER_API void whisper_mel_stream_keep(
+            struct whisper_mel_stream * stream,
+                                  int   n_samples);
+
+    // Store the normalized spectrogram of the current window in the state
+    // Returns 0 on success
+    WHISPER_API int whisper_mel_stream_to_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+         struct whisper_mel_stream * stream);
+
     // Run the Whisper encoder on the log mel spectrogram stored inside the default state in the provided whisper context.
     // Make sure to call whisper_pcm_to_mel() or whisper_set_mel() first.
     // offset can be used to specify the offset of the first frame in the spectrogram.
@@ -316,6 +368,18 @@ extern "C" {
                                int   offset,
                                int   n_threads);
 
+    // Run the Whisper encoder on the spectrograms of several states in a single pass.
+    // The windows are stacked into one graph, so the encoder weights are read once for the whole batch.
+    // offsets[i] is the offset of the first frame for states[i], as in whisper_encode_with_state().
+    // All states must come from ctx and use the same audio_ctx. Buffers for the batch are kept in states[0].
+    // Returns 0 on success
+    WHISPER_API int whisper_encode_batch(
+            struct whisper_context * ctx,
+             struct whisper_state ** states,
+                         const int * offsets,
+                               int   n_states,
+                               int   n_threads);
+
     // Run the Whisper decoder to obtain the logits and probabilities for the next token.
     // Make sure to call whisper_encode() first.
     // tokens + n_tokens is the provided context for the decoder.
@@ -337,6 +401,22 @@ extern "C" {
                                int   n_past,
                                int   n_threads);
 
+    // Run the decoder on the tokens of several states in a single pass, as whisper_decode_with_state() for each.
+    // The tokens of all the states go through one graph, so the decoder weights are read once for the whole batch;
+    // each state attends to its own past tokens and to the output of its own encoder pass.
+    // tokens[i], n_tokens[i] and n_past[i] are the arguments of whisper_decode_with_state() for states[i].
+    // The states must be distinct and come from ctx. The compute buffer of the batched pass belongs to ctx and is shared
+    // by all its states: it is allocated on first use, grows with the largest batch seen and is freed by whisper_free().
+    // Returns 0 on success
+    WHISPER_API int whisper_decode_batch(
+            struct whisper_context * ctx,
+             struct whisper_state ** states,
+              const whisper_token ** tokens,
+                         const int * n_tokens,
+                         const int * n_past,
+                               int   n_states,
+                               int   n_threads);
+
     // Convert the provided text into tokens.
     // The tokens pointer must be large enough to hold the resulting tokens.
     // Returns the number of tokens on success, no more than n_max_tokens
@@ -439,11 +519,20 @@ extern "C" {
         float decode_ms;
         float batchd_ms;
         float prompt_ms;
+
+        int n_encode;     // encoder passes computed since the last reset
+        int n_encode_hit; // encoder calls that reused the previous pass (same mel window and audio_ctx)
     };
     WHISPER_API struct whisper_timings * whisper_get_timings(struct whisper_context * ctx);
     WHISPER_API void whisper_print_timings(struct whisper_context * ctx);
     WHISPER_API void whisper_reset_timings(struct whisper_context * ctx);
 
+    // Same as above, but for a state created with whisper_init_state()
+    // The timings are averages per call since the last reset
+    WHISPER_API struct whisper_timings whisper_get_timings_from_state(struct whisper_state * state);
+    WHISPER_API void whisper_print_timings_from_state(struct whisper_state * state);
+    WHISPER_API void whisper_reset_timings_from_state(struct whisper_state * state);
+
     // Print system information
     WHISPER_API const char * whisper_print_system_info(void);
 
@@ -510,7 +599,7 @@ extern "C" {
         // [EXPERIMENTAL] speed-up techniques
         // note: these can significantly reduce the quality of the output
         bool debug_mode;        // enable debug_mode provides extra info (eg. Dump log_mel)
-        int  audio_ctx;         // overwrite the audio context size (0 = use default)
+        int  audio_ctx;         // overwrite the audio context size (0 = use default, < 0 = fit to the audio length)
 
         // [EXPERIMENTAL] [TDRZ] tinydiarize
         bool tdrz_enable;       // enable tinydiarize speaker turn detection
@@ -585,6 +674,10 @@ extern "C" {
         const char * vad_model_path;              // Path to VAD model
 
         whisper_vad_params vad_params;
+
+        // [EXPERIMENTAL] decode together with concurrent whisper_full calls on other states of the same context
+        // the decoder passes of all such calls that are ready at the same time run as one pass (whisper_decode_batch)
+        bool batch_decode;
     };
 
     // NOTE: this function allocates memory, and it is the responsibility of the caller to free the pointer - see whisper_free_context_params & whisper_free_params()
@@ -622,6 +715,15 @@ extern "C" {
                                    int   n_samples,
                                    int   n_processors);
 
+    // Same as whisper_full_parallel(), but the first chunk runs on the given state and the result is stored there
+    WHISPER_API int whisper_full_parallel_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+                           const float * samples,
+                                   int   n_samples,
+                                   int   n_processors);
+
     // Number of generated text segments
     // A segment can be a few words, a sentence, or even a paragraph.
     WHISPER_API int whisper_full_n_segments           (struct whisper_context * ctx);
@@ -723,6 +825,8 @@ extern "C" {
     WHISPER_API const char * whisper_bench_memcpy_str      (int n_threads);
     WHISPER_API int          whisper_bench_ggml_mul_mat    (int n_threads);
     WHISPER_API const char * whisper_bench_ggml_mul_mat_str(int n_threads);
+    WHISPER_API int          whisper_bench_conv            (int n_threads);
+    WHISPER_API const char * whisper_bench_conv_str        (int n_threads);
 
     // Control logging output; default behavior is to print to stderr
 
@@ -22,9 +22,11 @@
 #include <cmath>
 #include <climits>
 #include <codecvt>
+#include <condition_variable>
 #include <cstdarg>
 #include <cstdio>
 #include <cstring>
+#include <deque>
 #include <fstream>
 #include <functional>
 #include <map>
@@ -140,6 +142,10 @@ static void whisper_log_callback_default(ggml_log_level level, const char * text
 #define WHISPER_MAX_DECODERS 8
 #define WHISPER_MAX_NODES 4096
 
+// granularity of the automatic audio_ctx (params.audio_ctx < 0)
+// matches the padding of the cross-attention KV cache, so each bucket maps to a single graph shape
+#define WHISPER_AUDIO_CTX_BUCKET 256
+
 static std::string format(const char * fmt, ...) {
     va_list ap;
     va_list ap2;
@@ -461,13 +467,56 @@ struct whisper_mel {
     std::vector<float> data;
 };
 
+// identifies the encoder input: which spectrogram, at which offset and with which audio_ctx
+struct whisper_encode_key {
+    int32_t mel_gen = -1; // whisper_state::mel_gen of the spectrogram
+    int32_t offset  = -1;
+    int32_t n_ctx   = -1;
+
+    bool operator==(const whisper_encode_key & other) const {
+        return mel_gen == other.mel_gen && offset == other.offset && n_ctx == other.n_ctx;
+    }
+};
+
 struct whisper_filters {
     int32_t n_mel;
     int32_t n_fft;
 
     std::vector<float> data;
+
+    // nonzero span of each filter - the dense rows are mostly zeros
+    // filter j covers the bins [start[j], start[j] + len[j]), its weights start at weights[offset[j]]
+    std::vector<int32_t> start;
+    std::vector<int32_t> len;
+    std::vector<int32_t> offset;
+    std::vector<float>   weights;
 };
 
+static void whisper_filters_init_spans(whisper_filters & filters) {
+    filters.start.resize(filters.n_mel);
+    filters.len.resize(filters.n_mel);
+    filters.offset.resize(filters.n_mel);
+    filters.weights.clear();
+
+    for (int j = 0; j < filters.n_mel; j++) {
+        const float * row = filters.data.data() + j*filters.n_fft;
+
+        int k0 = 0;
+        int k1 = filters.n_fft;
+        while (k0 < k1 && row[k0] == 0.0f) {
+            k0++;
+        }
+        while (k1 > k0 && row[k1 - 1] == 0.0f) {
+            k1--;
+        }
+
+        filters.start[j]  = k0;
+        filters.len[j]    = k1 - k0;
+        filters.offset[j] = filters.weights.size();
+        filters.weights.insert(filters.weights.end(), row + k0, row + k1);
+    }
+}
+
 struct whisper_vocab {
     using id    = int32_t;
     using token = std::string;
@@ -593,13 +642,13 @@ static size_t whisper_sched_size(struct whisper_sched & allocr) {
 }
 
 // measure the memory usage of a graph and prepare the allocr's internal data buffer
-static bool whisper_sched_graph_init(struct whisper_sched & allocr, std::vector<ggml_backend_t> backends, std::function<struct ggml_cgraph *()> && get_graph) {
+static bool whisper_sched_graph_init(struct whisper_sched & allocr, std::vector<ggml_backend_t> backends, std::function<struct ggml_cgraph *()> && get_graph, int n_nodes = WHISPER_MAX_NODES) {
     auto & sched = allocr.sched;
     auto & meta  = allocr.meta;
 
-    sched = ggml_backend_sched_new(backends.data(), nullptr, backends.size(), WHISPER_MAX_NODES, false, true);
+    sched = ggml_backend_sched_new(backends.data(), nullptr, backends.size(), n_nodes, false, true);
 
-    meta.resize(ggml_tensor_overhead()*WHISPER_MAX_NODES + ggml_graph_overhead());
+    meta.resize(ggml_tensor_overhead()*n_nodes + ggml_graph_overhead_custom(n_nodes, false));
 
     // since there are dependencies between the different graphs,
     // we need to allocate them instead of only reserving to get the correct compute buffer size
@@ -883,6 +932,7 @@ struct whisper_state {
     int32_t n_prompt = 0; // number of decoder calls with n_tokens >  1  (prompt encoding)
     int32_t n_fail_p = 0; // number of logprob threshold failures
     int32_t n_fail_h = 0; // number of entropy threshold failures
+    int32_t n_encode_hit = 0; // number of encoder calls served from the encoder cache
 
     // number of decoders for which we have constructed the KV cache
     int32_t kv_self_n_dec = 0;
@@ -911,6 +961,11 @@ struct whisper_state {
     whisper_sched sched_cross;
     whisper_sched sched_decode;
 
+    // batched encoder passes led by this state (whisper_encode_batch), allocated on first use
+    whisper_sched    sched_batch;
+    whisper_kv_cache kv_pad_batch;
+    int32_t          n_batch_alloc = 0; // number of windows the buffers above are sized for
+
     // result of the encoder
     struct ggml_tensor * embd_conv = nullptr;
     struct ggml_tensor * embd_enc  = nullptr;
@@ -919,6 +974,18 @@ struct whisper_state {
     std::vector<float> inp_mel;
     std::vector<float> inp_mask;
 
+    // encoder input of the last completed encoder pass
+    // if the next pass gets exactly the same mel window, kv_cross already holds its result
+    // (e.g. language detection followed by transcription, or a repeated call on unchanged audio)
+    std::vector<float> inp_mel_prev;
+    bool inp_mel_prev_valid = false;
+
+    // where inp_mel and inp_mel_prev come from - the same key needs neither a copy nor a compare of the window
+    whisper_encode_key inp_key;
+    whisper_encode_key inp_key_prev;
+
+    int32_t mel_gen = 0; // incremented whenever mel is replaced
+
     // decode output (2-dimensional array: [n_tokens][n_vocab])
     std::vector<float> logits;
 
@@ -966,6 +1033,145 @@ struct whisper_state {
     bool has_vad_segments = false;
 };
 
+// per-thread buffers of the mel frontend
+struct whisper_mel_scratch {
+    std::vector<float> fft_in  = std::vector<float>(WHISPER_N_FFT, 0.0f);
+    std::vector<float> fft_out = std::vector<float>(WHISPER_N_FFT * 4);
+};
+
+// persistent workers for the mel frontend, shared by all states of a context
+// several threads may submit work at the same time (e.g. one per state); each submission is
+// spread over up to n_threads - 1 idle workers plus the submitting thread
+struct whisper_mel_pool {
+    using task_fn = std::function<void(int, whisper_mel_scratch &)>;
+
+    struct job {
+        const task_fn * fn = nullptr;
+        int n         = 0;
+        int n_helpers = 0; // workers that may still join
+        int n_active  = 0; // workers currently on the job
+
+        std::atomic<int> next{0};
+    };
+
+    std::mutex mutex;
+    std::condition_variable cv_work;
+    std::condition_variable cv_done;
+
+    std::deque<job *> jobs;
+    std::vector<std::thread> workers;
+    bool stop = false;
+
+    ~whisper_mel_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv_work.notify_all();
+
+        for (auto & w : workers) {
+            w.join();
+        }
+    }
+
+    // run fn(i) for i in [0, n), returns when all of them are done
+    void parallel_for(int n_threads, int n, const task_fn & fn) {
+        thread_local whisper_mel_scratch scratch;
+
+        if (n_threads <= 1 || n <= 1) {
+            for (int i = 0; i < n; i++) {
+                fn(i, scratch);
+            }
+            return;
+        }
+
+        job j;
+        j.fn        = &fn;
+        j.n         = n;
+        j.n_helpers = std::min(n_threads, n) - 1;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            while ((int) workers.size() < n_threads - 1) {
+                workers.emplace_back([this]() { worker(); });
+            }
+            jobs.push_back(&j);
+        }
+        cv_work.notify_all();
+
+        run(j, scratch);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_done.wait(lock, [&]() { return j.n_active == 0; });
+        jobs.erase(std::find(jobs.begin(), jobs.end(), &j));
+    }
+
+private:
+    static void run(job & j, whisper_mel_scratch & scratch) {
+        int i;
+        while ((i = j.next.fetch_add(1)) < j.n) {
+            (*j.fn)(i, scratch);
+        }
+    }
+
+    job * pending() const {
+        for (job * j : jobs) {
+            if (j->n_helpers > 0 && j->next.load() < j->n) {
+                return j;
+            }
+        }
+        return nullptr;
+    }
+
+    void worker() {
+        whisper_mel_scratch scratch;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv_work.wait(lock, [&]() { return stop || pending() != nullptr; });
+            if (stop) {
+                return;
+            }
+
+            job * j = pending();
+            j->n_helpers--;
+            j->n_active++;
+
+            lock.unlock();
+            run(*j, scratch);
+            lock.lock();
+
+            if (--j->n_active == 0) {
+                cv_done.notify_all();
+            }
+        }
+    }
+};
+
+// decoder passes of concurrent whisper_full calls with batch_decode, see whisper_full_decode()
+struct whisper_decode_queue {
+    struct request {
+        whisper_state * state = nullptr;
+
+        bool done = false;
+        bool ok   = false;
+    };
+
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    std::vector<request *> pending;
+    bool running = false; // a caller is running a pass for the requests it took
+
+    // compute buffer of the batched passes (whisper_decode_batch_internal), shared by all the states of the context
+    // the passes run one at a time, so a single buffer sized for the largest batch seen serves every state
+    // it has backends of its own, so it does not depend on the lifetime of any state
+    std::mutex                  mutex_pass;
+    std::vector<ggml_backend_t> backends;
+    whisper_sched               sched;
+    int32_t                     n_alloc = 0; // number of states the buffer is sized for
+};
+
 struct whisper_context {
     int64_t t_load_us  = 0;
     int64_t t_start_us = 0;
@@ -980,6 +1186,10 @@ struct whisper_context {
 
     whisper_state * state = nullptr;
 
+    whisper_mel_pool mel_pool;
+
+    whisper_decode_queue decode_queue;
+
     std::string path_model; // populated by whisper_init_from_file_with_params()
 };
 
@@ -1604,7 +1814,9 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
         filters.data.resize(filters.n_mel * filters.n_fft);
         loader->read(loader->context, filters.data.data(), filters.data.size() * sizeof(float));
+
         BYTESWAP_FILTERS(filters);
+        whisper_filters_init_spans(filters);
     }
 
     // load vocab
@@ -1995,98 +2207,347 @@ static bool whisper_encode_external(const whisper_state & wstate) {
     return use_coreml || use_openvino;
 }
 
-static struct ggml_cgraph * whisper_build_graph_conv(
-        whisper_context & wctx,
-          whisper_state & wstate) {
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+// direct (im2col-free) conv1d with kernel size 3 and padding 1, fused with bias + GELU, for the CPU backend
+//
+// the input is kept time-major with a zero frame on each side, [n_in, n_len + 2, n_batch], so the receptive field of
+// output frame t is the contiguous run of 3*n_in values starting at frame s*t - the im2col matrix is never built
+// the weights of WHISPER_CONV_OC_BLOCK output channels are packed once per block, and the tile kernel keeps
+// WHISPER_CONV_T_BLOCK x WHISPER_CONV_OC_BLOCK accumulators in registers for the whole reduction
+
+#define WHISPER_CONV_OC_BLOCK 16
+#define WHISPER_CONV_T_BLOCK  6
+#define WHISPER_CONV_T_CHUNK  96
+
+// whisper.cpp is built for the baseline ISA, so let GCC emit wider variants of the tile kernel and pick one at load time
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define WHISPER_CONV_TARGET_CLONES __attribute__((target_clones("avx512f", "fma", "default")))
+#else
+#define WHISPER_CONV_TARGET_CLONES
+#endif
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
-    const int n_state = hparams.n_audio_state; GGML_UNUSED(n_state);
+// acc[j][o] += sum_r wp[r][o]*x[j][r]
+#if defined(__GNUC__)
+typedef float whisper_conv_vec __attribute__((vector_size(WHISPER_CONV_OC_BLOCK*sizeof(float))));
+
+WHISPER_CONV_TARGET_CLONES
+static void whisper_conv_tile(
+        const float * wp,
+        const float * const * x,
+        int64_t n_r,
+        float * acc) {
+    static_assert(WHISPER_CONV_T_BLOCK == 6, "the tile kernel is unrolled for 6 frames");
+
+    whisper_conv_vec a0, a1, a2, a3, a4, a5;
+    memcpy(&a0, acc + 0*WHISPER_CONV_OC_BLOCK, sizeof(a0));
+    memcpy(&a1, acc + 1*WHISPER_CONV_OC_BLOCK, sizeof(a1));
+    memcpy(&a2, acc + 2*WHISPER_CONV_OC_BLOCK, sizeof(a2));
+    memcpy(&a3, acc + 3*WHISPER_CONV_OC_BLOCK, sizeof(a3));
+    memcpy(&a4, acc + 4*WHISPER_CONV_OC_BLOCK, sizeof(a4));
+    memcpy(&a5, acc + 5*WHISPER_CONV_OC_BLOCK, sizeof(a5));
+
+    const float * x0 = x[0];
+    const float * x1 = x[1];
+    const float * x2 = x[2];
+    const float * x3 = x[3];
+    const float * x4 = x[4];
+    const float * x5 = x[5];
+
+    for (int64_t r = 0; r < n_r; ++r) {
+        whisper_conv_vec w;
+        memcpy(&w, wp + r*WHISPER_CONV_OC_BLOCK, sizeof(w));
+
+        a0 += w*x0[r];
+        a1 += w*x1[r];
+        a2 += w*x2[r];
+        a3 += w*x3[r];
+        a4 += w*x4[r];
+        a5 += w*x5[r];
+    }
+
+    memcpy(acc + 0*WHISPER_CONV_OC_BLOCK, &a0, sizeof(a0));
+    memcpy(acc + 1*WHISPER_CONV_OC_BLOCK, &a1, sizeof(a1));
+    memcpy(acc + 2*WHISPER_CONV_OC_BLOCK, &a2, sizeof(a2));
+    memcpy(acc + 3*WHISPER_CONV_OC_BLOCK, &a3, sizeof(a3));
+    memcpy(acc + 4*WHISPER_CONV_OC_BLOCK, &a4, sizeof(a4));
+    memcpy(acc + 5*WHISPER_CONV_OC_BLOCK, &a5, sizeof(a5));
+}
+#else
+static void whisper_conv_tile(
+        const float * wp,
+        const float * const * x,
+        int64_t n_r,
+        float * acc) {
+    for (int64_t r = 0; r < n_r; ++r) {
+        const float * w = wp + r*WHISPER_CONV_OC_BLOCK;
+        for (int j = 0; j < WHISPER_CONV_T_BLOCK; ++j) {
+            const float xs = x[j][r];
+            for (int o = 0; o < WHISPER_CONV_OC_BLOCK; ++o) {
+                acc[j*WHISPER_CONV_OC_BLOCK + o] += w[o]*xs;
+            }
+        }
+    }
+}
+#endif
 
-    const int n_mels = hparams.n_mels;
+static inline float whisper_gelu(float x) {
+    return 0.5f*x*(1.0f + tanhf(0.79788456080286535587989211986876f*x*(1.0f + 0.044715f*x*x)));
+}
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_conv.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_conv.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
+// [n_len, n_in, n_batch] -> [n_in, n_len + 2, n_batch], zero frames at both ends
+static void whisper_conv_pad_f32(struct ggml_tensor * dst, int ith, int nth, void * /*userdata*/) {
+    const struct ggml_tensor * x = dst->src[0];
 
-    struct ggml_context * ctx0 = ggml_init(params);
+    const int64_t n_len = x->ne[0];
+    const int64_t n_in  = x->ne[1];
 
-    ggml_cgraph * gf = ggml_new_graph(ctx0);
+    for (int64_t row = ith; row < dst->ne[1]*dst->ne[2]; row += nth) {
+        const int64_t it = row % dst->ne[1];
+        const int64_t ib = row / dst->ne[1];
 
-    struct ggml_tensor * mel = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels);
-    ggml_set_name(mel, "mel");
-    ggml_set_input(mel);
+        float * y = (float *) ((char *) dst->data + it*dst->nb[1] + ib*dst->nb[2]);
 
-    struct ggml_tensor * cur = nullptr;
+        if (it == 0 || it == n_len + 1) {
+            memset(y, 0, n_in*sizeof(float));
+            continue;
+        }
 
-    if (!whisper_encode_external(wstate)) {
-        // convolution + gelu
-        {
-            cur = ggml_conv_1d_ph(ctx0, model.e_conv_1_w, mel, 1, 1);
-            cur = ggml_add(ctx0, cur, model.e_conv_1_b);
+        const char * xr = (const char *) x->data + (it - 1)*x->nb[0] + ib*x->nb[2];
+        for (int64_t ic = 0; ic < n_in; ++ic) {
+            y[ic] = *(const float *) (xr + ic*x->nb[1]);
+        }
+    }
+}
 
-            cur = ggml_gelu(ctx0, cur);
+// src[0] - kernel [3, n_in, n_out] (F16 or F32)
+// src[1] - padded input [n_in, n_len + 2, n_batch] (F32, contiguous)
+// src[2] - bias   [1, n_out] (F32)
+// dst    - [n_out, n_len/s + 2, n_batch] padded again for the next convolution, or [n_len/s, n_out, n_batch]
+static void whisper_conv_gelu_f32(struct ggml_tensor * dst, int ith, int nth, void * userdata) {
+    const struct ggml_tensor * w = dst->src[0];
+    const struct ggml_tensor * x = dst->src[1];
+    const struct ggml_tensor * b = dst->src[2];
 
-            cur = ggml_conv_1d_ph(ctx0, model.e_conv_2_w, cur, 2, 1);
-            cur = ggml_add(ctx0, cur, model.e_conv_2_b);
+    const int  s      = (int) ((intptr_t) userdata & 0xf); // stride: 1 or 2
+    const bool padded = (intptr_t) userdata & 0x10;
 
-            cur = ggml_gelu(ctx0, cur);
+    const int64_t n_in    = w->ne[1];
+    const int64_t n_out   = w->ne[2];
+    const int64_t n_batch = x->ne[2];
+    const int64_t n_t     = (x->ne[1] - 3)/s + 1;
+    const int64_t n_r     = 3*n_in;
+
+    GGML_ASSERT(x->ne[0] == n_in && x->nb[0] == sizeof(float) && x->nb[1] == n_in*sizeof(float));
+
+    const int64_t n_ob = (n_out + WHISPER_CONV_OC_BLOCK - 1)/WHISPER_CONV_OC_BLOCK;
+    const int64_t n_tc = (n_t   + WHISPER_CONV_T_CHUNK  - 1)/WHISPER_CONV_T_CHUNK;
+
+    // packed weights of the current output block: wp[k*n_in + ic][o]
+    thread_local std::vector<float> wp;
+    wp.resize(n_r*WHISPER_CONV_OC_BLOCK);
+
+    float acc[WHISPER_CONV_T_BLOCK][WHISPER_CONV_OC_BLOCK];
+
+    const float * xt[WHISPER_CONV_T_BLOCK];
+
+    // contiguous ranges of (batch, output block, time chunk), so a thread packs each output block once
+    const int64_t n_items = n_batch*n_ob*n_tc;
+
+    const int64_t i0 = (n_items*(ith + 0))/nth;
+    const int64_t i1 = (n_items*(ith + 1))/nth;
+
+    int64_t ob_packed = -1;
+
+    for (int64_t item = i0; item < i1; ++item) {
+        const int64_t ib =  item/(n_ob*n_tc);
+        const int64_t ob = (item/n_tc) % n_ob;
+        const int64_t tc =  item % n_tc;
+
+        const int64_t o0 = ob*WHISPER_CONV_OC_BLOCK;
+        const int     no = (int) std::min<int64_t>(WHISPER_CONV_OC_BLOCK, n_out - o0);
+
+        if (ob != ob_packed) {
+            for (int64_t ic = 0; ic < n_in; ++ic) {
+                for (int k = 0; k < 3; ++k) {
+                    float * dstw = wp.data() + (k*n_in + ic)*WHISPER_CONV_OC_BLOCK;
+                    for (int o = 0; o < WHISPER_CONV_OC_BLOCK; ++o) {
+                        if (o >= no) {
+                            dstw[o] = 0.0f;
+                            continue;
+                        }
+                        const char * src = (const char *) w->data + k*w->nb[0] + ic*w->nb[1] + (o0 + o)*w->nb[2];
+                        dstw[o] = w->type == GGML_TYPE_F16 ? ggml_fp16_to_fp32(*(const ggml_fp16_t *) src) : *(const float *) src;
+                    }
+                }
+            }
+            ob_packed = ob;
         }
 
-        ggml_set_name(cur, "embd_conv");
-        wstate.embd_conv = cur;
-    } else {
-        ggml_build_forward_expand(gf, mel);
+        const float * xb = (const float *) ((const char *) x->data + ib*x->nb[2]);
 
-        cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
-        ggml_set_input(cur); // the external encoder will write into this tensor
+        const int64_t tc0 = tc*WHISPER_CONV_T_CHUNK;
+        const int64_t tc1 = std::min(n_t, tc0 + WHISPER_CONV_T_CHUNK);
 
-        ggml_set_name(cur, "embd_enc");
-        wstate.embd_enc = cur;
+        for (int64_t t0 = tc0; t0 < tc1; t0 += WHISPER_CONV_T_BLOCK) {
+            const int nt = (int) std::min<int64_t>(WHISPER_CONV_T_BLOCK, tc1 - t0);
+
+            for (int j = 0; j < WHISPER_CONV_T_BLOCK; ++j) {
+                // the tail of a partial tile recomputes the last frame and is discarded
+                xt[j] = xb + s*(t0 + std::min(j, nt - 1))*n_in;
+                for (int o = 0; o < WHISPER_CONV_OC_BLOCK; ++o) {
+                    acc[j][o] = o < no ? *(const float *) ((const char *) b->data + (o0 + o)*b->nb[1]) : 0.0f;
+                }
+            }
+
+            whisper_conv_tile(wp.data(), xt, n_r, &acc[0][0]);
+
+            for (int j = 0; j < nt; ++j) {
+                if (padded) {
+                    float * y = (float *) ((char *) dst->data + (t0 + j + 1)*dst->nb[1] + ib*dst->nb[2]) + o0;
+                    for (int o = 0; o < no; ++o) {
+                        y[o] = whisper_gelu(acc[j][o]);
+                    }
+                } else {
+                    for (int o = 0; o < no; ++o) {
+                        float * y = (float *) ((char *) dst->data + (t0 + j)*dst->nb[0] + (o0 + o)*dst->nb[1] + ib*dst->nb[2]);
+                        *y = whisper_gelu(acc[j][o]);
+                    }
+                }
+            }
+        }
     }
 
-    ggml_set_output(cur);
+    if (padded && ith == 0) {
+        for (int64_t ib = 0; ib < n_batch; ++ib) {
+            memset((char *) dst->data + ib*dst->nb[2],                     0, n_out*sizeof(float));
+            memset((char *) dst->data + ib*dst->nb[2] + (n_t + 1)*dst->nb[1], 0, n_out*sizeof(float));
+        }
+    }
+}
 
-    ggml_build_forward_expand(gf, cur);
+// x: padded time-major input, see whisper_conv_gelu_f32
+static struct ggml_tensor * whisper_conv_gelu(
+        struct ggml_context * ctx0,
+         struct ggml_tensor * w,
+         struct ggml_tensor * b,
+         struct ggml_tensor * x,
+                        int   s,
+                       bool   padded) {
+    struct ggml_tensor * args[] = { w, x, b };
 
-    ggml_free(ctx0);
+    const int64_t n_t = (x->ne[1] - 3)/s + 1;
 
-    return gf;
+    void * userdata = (void *) (intptr_t) (s | (padded ? 0x10 : 0));
+
+    if (padded) {
+        return ggml_custom_4d(ctx0, GGML_TYPE_F32, w->ne[2], n_t + 2, x->ne[2], 1, args, 3, whisper_conv_gelu_f32, GGML_N_TASKS_MAX, userdata);
+    }
+
+    return ggml_custom_4d(ctx0, GGML_TYPE_F32, n_t, w->ne[2], x->ne[2], 1, args, 3, whisper_conv_gelu_f32, GGML_N_TASKS_MAX, userdata);
 }
 
-static struct ggml_cgraph * whisper_build_graph_encoder(
-        whisper_context & wctx,
-          whisper_state & wstate) {
+// the fused stem can only run where the CPU backend can read the conv weights directly
+static bool whisper_conv_fused_supported(const whisper_model & model, const std::vector<ggml_backend_t> & backends) {
+    for (const auto & backend : backends) {
+        ggml_backend_dev_t dev = ggml_backend_get_device(backend);
+        if (dev && ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_GPU) {
+            return false;
+        }
+    }
+
+    for (const auto * w : { model.e_conv_1_w, model.e_conv_2_w }) {
+        if (!w->buffer || !ggml_backend_buffer_is_host(w->buffer)) {
+            return false;
+        }
+        if (w->type != GGML_TYPE_F16 && w->type != GGML_TYPE_F32) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// ggml_conv_1d_ph over n_batch windows: [n_len, n_in, n_batch] -> [n_len/s, n_out, n_batch]
+// the mul_mat of ggml_conv_1d leaves the windows between the time and the channel dimensions, so they are moved back
+static struct ggml_tensor * whisper_conv_1d_ph(
+        struct ggml_context * ctx0,
+         struct ggml_tensor * w,
+         struct ggml_tensor * x,
+                        int   s) {
+    struct ggml_tensor * cur = ggml_conv_1d_ph(ctx0, w, x, s, 1);
+
+    const int64_t n_batch = x->ne[2];
+    if (n_batch > 1) {
+        cur = ggml_reshape_3d(ctx0, cur, cur->ne[0], n_batch, cur->ne[1]);
+        cur = ggml_cont(ctx0, ggml_permute(ctx0, cur, 0, 2, 1, 3));
+    }
+
+    return cur;
+}
+
+// conv1 + gelu + conv2 + gelu over n_batch mel windows: [2*n_ctx, n_mels, n_batch] -> [n_ctx, n_state, n_batch]
+// fused selects the direct CPU kernels above instead of im2col + mul_mat + add + gelu
+static struct ggml_tensor * whisper_build_conv(
+        struct ggml_context * ctx0,
+        const whisper_model & model,
+         struct ggml_tensor * mel,
+                       bool   fused) {
+    if (fused) {
+        struct ggml_tensor * args[] = { mel };
+
+        struct ggml_tensor * cur = ggml_custom_4d(ctx0, GGML_TYPE_F32, mel->ne[1], mel->ne[0] + 2, mel->ne[2], 1, args, 1,
+                whisper_conv_pad_f32, GGML_N_TASKS_MAX, nullptr);
+
+        cur = whisper_conv_gelu(ctx0, model.e_conv_1_w, model.e_conv_1_b, cur, 1, true);
+
+        return whisper_conv_gelu(ctx0, model.e_conv_2_w, model.e_conv_2_b, cur, 2, false);
+    }
+
+    struct ggml_tensor * cur = nullptr;
+
+    cur = whisper_conv_1d_ph(ctx0, model.e_conv_1_w, mel, 1);
+    cur = ggml_add(ctx0, cur, model.e_conv_1_b);
+
+    cur = ggml_gelu(ctx0, cur);
+
+    cur = whisper_conv_1d_ph(ctx0, model.e_conv_2_w, cur, 2);
+    cur = ggml_add(ctx0, cur, model.e_conv_2_b);
+
+    cur = ggml_gelu(ctx0, cur);
+
+    return cur;
+}
+
+// [EXPERIMENTAL] encoder layer skipping - a skipped layer passes its input through unchanged
+static bool whisper_encoder_layer_enabled(const whisper_context_params & params, int n_layer, int il) {
+    const int n_run  = params.encoder_n_layer > 0 ? std::min(params.encoder_n_layer, n_layer) : n_layer;
+    const int n_step = std::max(1, params.encoder_layer_step);
+
+    return il < n_run && (n_run - 1 - il) % n_step == 0;
+}
+
+// transformer layers of the encoder: [n_ctx, n_state, n_batch] -> [n_state, n_ctx*n_batch]
+// the windows are stacked along the token dimension, so every weight matrix is applied to all of them at once
+// kv_pad must hold n_batch padded windows when flash attention is used
+static struct ggml_tensor * whisper_build_encoder_layers(
+        struct ggml_context * ctx0,
+        struct ggml_cgraph  * gf,
+            whisper_context & wctx,
+         struct ggml_tensor * embd_conv,
+           whisper_kv_cache & kv_pad,
+                        int   n_ctx,
+                        int   n_batch) {
     const auto & model   = wctx.model;
     const auto & hparams = model.hparams;
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
     const int n_state = hparams.n_audio_state;
     const int n_head  = hparams.n_audio_head;
     const int n_layer = hparams.n_audio_layer;
 
     const int n_state_head = n_state/n_head;
 
-    auto & kv_pad = wstate.kv_pad;
-
-    WHISPER_ASSERT(!!kv_pad.buffer);
-
     const int n_ctx_pad = GGML_PAD(n_ctx, 256);
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_encode.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_encode.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
-
-    struct ggml_context * ctx0 = ggml_init(params);
-
-    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
-
-    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_conv);
+    struct ggml_tensor * cur = embd_conv;
 
     const float KQscale = 1.0f/sqrtf(float(n_state_head));
 
@@ -2108,16 +2569,21 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
     const size_t e_pe_offset = model.e_pe->ne[0]*ggml_element_size(model.e_pe)*n_ctx*iter;
 
     struct ggml_tensor * e_pe = ggml_view_2d(ctx0, model.e_pe, model.e_pe->ne[0], n_ctx, e_pe_stride, e_pe_offset);
-    cur = ggml_add(ctx0, e_pe, ggml_cont(ctx0, ggml_transpose(ctx0, cur)));
+    // e_pe is broadcast over the windows
+    cur = ggml_add(ctx0, ggml_cont(ctx0, ggml_transpose(ctx0, cur)), e_pe);
 
     // ===================================================================
 
     // original:
     //cur = ggml_add(ctx0, model.e_pe, ggml_transpose(ctx0, cur));
 
-    struct ggml_tensor * inpL = cur;
+    struct ggml_tensor * inpL = ggml_reshape_2d(ctx0, cur, n_state, n_ctx*n_batch);
 
     for (int il = 0; il < n_layer; ++il) {
+        if (!whisper_encoder_layer_enabled(wctx.params, n_layer, il)) {
+            continue;
+        }
+
         const auto & layer = model.layers_encoder[il];
 
         // norm
@@ -2155,37 +2621,53 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
 
             // ------
 
+            // attention does not cross window boundaries: one batch of heads per window
             struct ggml_tensor * Q =
                 ggml_permute(ctx0,
-                        ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_ctx),
+                        ggml_reshape_4d(ctx0, Qcur, n_state_head, n_head, n_ctx, n_batch),
                         0, 2, 1, 3);
 
             if (wctx.params.flash_attn) {
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcur, ggml_view_1d(ctx0, kv_pad.k, n_ctx*n_state, 0)));
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcur, ggml_view_1d(ctx0, kv_pad.v, n_ctx*n_state, 0)));
+                ggml_build_forward_expand(gf, ggml_cpy(ctx0,
+                            ggml_reshape_3d(ctx0, Kcur, n_state, n_ctx, n_batch),
+                            ggml_view_3d(ctx0, kv_pad.k,
+                                n_state, n_ctx, n_batch,
+                                ggml_element_size(kv_pad.k)*n_state,
+                                ggml_element_size(kv_pad.k)*n_state*n_ctx_pad,
+                                0)));
+
+                ggml_build_forward_expand(gf, ggml_cpy(ctx0,
+                            ggml_reshape_3d(ctx0, Vcur, n_state, n_ctx, n_batch),
+                            ggml_view_3d(ctx0, kv_pad.v,
+                                n_state, n_ctx, n_batch,
+                                ggml_element_size(kv_pad.v)*n_state,
+                                ggml_element_size(kv_pad.v)*n_state*n_ctx_pad,
+                                0)));
 
                 struct ggml_tensor * K =
-                    ggml_view_3d(ctx0, kv_pad.k,
-                            n_state_head, n_ctx_pad, n_head,
+                    ggml_view_4d(ctx0, kv_pad.k,
+                            n_state_head, n_ctx_pad, n_head, n_batch,
                             ggml_element_size(kv_pad.k)*n_state,
                             ggml_element_size(kv_pad.k)*n_state_head,
+                            ggml_element_size(kv_pad.k)*n_state*n_ctx_pad,
                             0);
 
                 struct ggml_tensor * V =
-                    ggml_view_3d(ctx0, kv_pad.v,
-                            n_state_head, n_ctx_pad, n_head,
+                    ggml_view_4d(ctx0, kv_pad.v,
+                            n_state_head, n_ctx_pad, n_head, n_batch,
                             ggml_element_size(kv_pad.v)*n_state,
                             ggml_element_size(kv_pad.v)*n_state_head,
+                            ggml_element_size(kv_pad.v)*n_state*n_ctx_pad,
                             0);
 
                 cur = ggml_flash_attn_ext(ctx0, Q, K, V, nullptr, KQscale, 0.0f, 0.0f);
 
-                cur = ggml_reshape_2d(ctx0, cur, n_state, n_ctx);
+                cur = ggml_reshape_2d(ctx0, cur, n_state, n_ctx*n_batch);
             } else {
                 struct ggml_tensor * K =
                     ggml_permute(ctx0,
                             ggml_cast(ctx0,
-                                ggml_reshape_3d(ctx0, Kcur, n_state_head, n_head, n_ctx),
+                                ggml_reshape_4d(ctx0, Kcur, n_state_head, n_head, n_ctx, n_batch),
                                 wctx.itype),
                             0, 2, 1, 3);
 
@@ -2197,9 +2679,9 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
                 struct ggml_tensor * V =
                     ggml_cast(ctx0,
                             ggml_permute(ctx0,
-                                ggml_reshape_3d(ctx0,
+                                ggml_reshape_4d(ctx0,
                                     Vcur,
-                                    n_state_head, n_head, n_ctx),
+                                    n_state_head, n_head, n_ctx, n_batch),
                                 1, 2, 0, 3),
                             wctx.itype);
 
@@ -2207,7 +2689,7 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
 
                 struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
 
-                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_ctx);
+                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_ctx*n_batch);
             }
         }
 
@@ -2270,34 +2752,21 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
                 model.e_ln_b);
     }
 
-    ggml_build_forward_expand(gf, cur);
-
-    wstate.embd_enc = cur;
-
-    //ggml_graph_print(gf);
-
-    ////////////////////////////////////////////////////////////////////////////
-
-    //printf("%s: used_mem = %f MB, %f MB, %f MB %f MB %f MB\n", __func__,
-    //        ggml_used_mem(ctx0)/1e6,
-    //        wstate.get_buf_max_mem(0)/1e6,
-    //        wstate.get_buf_max_mem(1)/1e6,
-    //        wstate.get_buf_max_mem(2)/1e6,
-    //        wstate.get_buf_max_mem(3)/1e6);
-
-    ggml_free(ctx0);
-
-    return gf;
+    return cur;
 }
 
-// pre-compute cross-attention memory
-static struct ggml_cgraph * whisper_build_graph_cross(
-        whisper_context & wctx,
-          whisper_state & wstate) {
+// cross-attention K and V of n_batch encoded windows, window i is stored in kv_cross[i]
+static void whisper_build_cross_kv(
+        struct ggml_context * ctx0,
+        struct ggml_cgraph  * gf,
+            whisper_context & wctx,
+         struct ggml_tensor * embd_enc,
+         whisper_kv_cache * const * kv_cross,
+                        int   n_ctx,
+                        int   n_batch) {
     const auto & model   = wctx.model;
     const auto & hparams = model.hparams;
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
     const int n_state = hparams.n_audio_state;
     const int n_head  = hparams.n_audio_head;
 
@@ -2305,17 +2774,7 @@ static struct ggml_cgraph * whisper_build_graph_cross(
 
     const int n_ctx_pad = GGML_PAD(n_ctx, 256);
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_cross.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_cross.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
-
-    struct ggml_context * ctx0 = ggml_init(params);
-
-    ggml_cgraph * gf = ggml_new_graph(ctx0);
-
-    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_enc);
+    struct ggml_tensor * cur = embd_enc;
 
     const float  Kscale = pow(float(n_state_head), -0.25);
 
@@ -2336,55 +2795,263 @@ static struct ggml_cgraph * whisper_build_graph_cross(
                     Vcross,
                     layer.cross_attn_v_b);
 
-        struct ggml_tensor * k;
-        struct ggml_tensor * v;
+        for (int ib = 0; ib < n_batch; ++ib) {
+            const whisper_kv_cache & kv = *kv_cross[ib];
 
-        if (wctx.params.flash_attn) {
-            k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx_pad));
+            struct ggml_tensor * Kb = ggml_view_2d(ctx0, Kcross, n_state, n_ctx, Kcross->nb[1], ib*n_ctx*Kcross->nb[1]);
+            struct ggml_tensor * Vb = ggml_view_2d(ctx0, Vcross, n_state, n_ctx, Vcross->nb[1], ib*n_ctx*Vcross->nb[1]);
 
-            v = ggml_view_1d(ctx0, wstate.kv_cross.v, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.v)*n_state)*(il*n_ctx_pad));
-        } else {
-            Vcross = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcross, n_state, n_ctx));
+            struct ggml_tensor * k;
+            struct ggml_tensor * v;
 
-            k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx));
+            if (wctx.params.flash_attn) {
+                k = ggml_view_1d(ctx0, kv.k, n_state*n_ctx,
+                        (ggml_element_size(kv.k)*n_state)*(il*n_ctx_pad));
 
-            v = ggml_view_2d(ctx0, wstate.kv_cross.v, n_ctx, n_state,
-                    (   n_ctx)*ggml_element_size(wstate.kv_cross.v),
-                    (il*n_ctx)*ggml_element_size(wstate.kv_cross.v)*n_state);
+                v = ggml_view_1d(ctx0, kv.v, n_state*n_ctx,
+                        (ggml_element_size(kv.v)*n_state)*(il*n_ctx_pad));
+            } else {
+                Vb = ggml_transpose(ctx0, Vb);
+
+                k = ggml_view_1d(ctx0, kv.k, n_state*n_ctx,
+                        (ggml_element_size(kv.k)*n_state)*(il*n_ctx));
+
+                v = ggml_view_2d(ctx0, kv.v, n_ctx, n_state,
+                        (   n_ctx)*ggml_element_size(kv.v),
+                        (il*n_ctx)*ggml_element_size(kv.v)*n_state);
+            }
+
+            ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kb, k));
+            ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vb, v));
         }
+    }
+}
+
+static struct ggml_cgraph * whisper_build_graph_conv(
+        whisper_context & wctx,
+          whisper_state & wstate) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_state = hparams.n_audio_state; GGML_UNUSED(n_state);
+
+    const int n_mels = hparams.n_mels;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.sched_conv.meta.size(),
+        /*.mem_buffer =*/ wstate.sched_conv.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
 
-        ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcross, k));
-        ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcross, v));
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+    struct ggml_tensor * mel = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels);
+    ggml_set_name(mel, "mel");
+    ggml_set_input(mel);
+
+    struct ggml_tensor * cur = nullptr;
+
+    if (!whisper_encode_external(wstate)) {
+        // convolution + gelu
+        cur = whisper_build_conv(ctx0, model, mel, whisper_conv_fused_supported(model, wstate.backends));
+
+        ggml_set_name(cur, "embd_conv");
+        wstate.embd_conv = cur;
+    } else {
+        ggml_build_forward_expand(gf, mel);
+
+        cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
+        ggml_set_input(cur); // the external encoder will write into this tensor
+
+        ggml_set_name(cur, "embd_enc");
+        wstate.embd_enc = cur;
     }
 
+    ggml_set_output(cur);
+
+    ggml_build_forward_expand(gf, cur);
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+static struct ggml_cgraph * whisper_build_graph_encoder(
+        whisper_context & wctx,
+          whisper_state & wstate) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+
+    WHISPER_ASSERT(!!wstate.kv_pad.buffer);
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.sched_encode.meta.size(),
+        /*.mem_buffer =*/ wstate.sched_encode.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    struct ggml_tensor * cur = whisper_build_encoder_layers(ctx0, gf, wctx, ggml_view_tensor(ctx0, wstate.embd_conv), wstate.kv_pad, n_ctx, 1);
+
+    ggml_build_forward_expand(gf, cur);
+
+    wstate.embd_enc = cur;
+
     //ggml_graph_print(gf);
 
+    ////////////////////////////////////////////////////////////////////////////
+
+    //printf("%s: used_mem = %f MB, %f MB, %f MB %f MB %f MB\n", __func__,
+    //        ggml_used_mem(ctx0)/1e6,
+    //        wstate.get_buf_max_mem(0)/1e6,
+    //        wstate.get_buf_max_mem(1)/1e6,
+    //        wstate.get_buf_max_mem(2)/1e6,
+    //        wstate.get_buf_max_mem(3)/1e6);
+
     ggml_free(ctx0);
 
     return gf;
 }
 
-// evaluate the encoder with the given state
-//
-// given audio recording (more specifically, its log mel spectrogram), runs forward pass of the encoder
-// part of the transformer model and returns the encoded features
-//
-//   - wctx:      the model
-//   - wstate:     the state of the encoder
-//   - n_threads:  number of threads to use
-//   - mel_offset: offset in the mel spectrogram (i.e. audio offset)
-//
-static bool whisper_encode_internal(
+// pre-compute cross-attention memory
+static struct ggml_cgraph * whisper_build_graph_cross(
+        whisper_context & wctx,
+          whisper_state & wstate) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.sched_cross.meta.size(),
+        /*.mem_buffer =*/ wstate.sched_cross.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+    whisper_kv_cache * kv_cross = &wstate.kv_cross;
+
+    whisper_build_cross_kv(ctx0, gf, wctx, ggml_view_tensor(ctx0, wstate.embd_enc), &kv_cross, n_ctx, 1);
+
+    //ggml_graph_print(gf);
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+// graph size of a batched encoder pass: the cross-attention KV is scattered to each state separately
+static int whisper_encode_batch_n_nodes(const whisper_hparams & hparams, int n_batch) {
+    return WHISPER_MAX_NODES + 8*hparams.n_text_layer*n_batch;
+}
+
+// conv + encoder + cross for the mel windows of several states in a single graph
+// the compute buffer and the padded flash-attention buffer belong to wstate
+static struct ggml_cgraph * whisper_build_graph_encode_batch(
+          whisper_context & wctx,
+            whisper_state & wstate,
+    whisper_state * const * states,
+                      int   n_batch) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_ctx  = states[0]->exp_n_audio_ctx > 0 ? states[0]->exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_mels = hparams.n_mels;
+
+    WHISPER_ASSERT(!!wstate.kv_pad_batch.buffer);
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.sched_batch.meta.size(),
+        /*.mem_buffer =*/ wstate.sched_batch.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, whisper_encode_batch_n_nodes(hparams, n_batch), false);
+
+    struct ggml_tensor * mel = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels, n_batch);
+    ggml_set_name(mel, "mel");
+    ggml_set_input(mel);
+
+    struct ggml_tensor * cur = whisper_build_conv(ctx0, model, mel, whisper_conv_fused_supported(model, wstate.backends));
+
+    cur = whisper_build_encoder_layers(ctx0, gf, wctx, cur, wstate.kv_pad_batch, n_ctx, n_batch);
+
+    std::vector<whisper_kv_cache *> kv_cross(n_batch);
+    for (int ib = 0; ib < n_batch; ++ib) {
+        kv_cross[ib] = &states[ib]->kv_cross;
+    }
+
+    whisper_build_cross_kv(ctx0, gf, wctx, cur, kv_cross.data(), n_ctx, n_batch);
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+// copy the mel window starting at mel_offset into wstate.inp_mel
+// returns true if it is the input of the last completed encoder pass
+static bool whisper_encode_set_input(
         whisper_context & wctx,
           whisper_state & wstate,
-              const int   mel_offset,
-              const int   n_threads,
-    ggml_abort_callback   abort_callback,
-                   void * abort_callback_data) {
-    const int64_t t_start_us = ggml_time_us();
+              const int   mel_offset) {
+    const auto & mel_inp = wstate.mel;
+    const int n_ctx      = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
+
+    assert(mel_inp.n_mel == wctx.model.hparams.n_mels);
+
+    whisper_encode_key key;
+    key.mel_gen = wstate.mel_gen;
+    key.offset  = mel_offset;
+    key.n_ctx   = n_ctx;
+
+    if (wstate.inp_mel_prev_valid && key == wstate.inp_key_prev) {
+        return true;
+    }
+
+    wstate.inp_key = key;
+
+    wstate.inp_mel.assign(2*n_ctx*mel_inp.n_mel, 0.0f);
+
+    float * dst = wstate.inp_mel.data();
+
+    const int i0 = std::min(mel_offset,           mel_inp.n_len);
+    const int i1 = std::min(mel_offset + 2*n_ctx, mel_inp.n_len);
+
+    for (int j = 0; j < mel_inp.n_mel; ++j) {
+        for (int i = i0; i < i1; ++i) {
+            dst[j*2*n_ctx + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
+        }
+    }
+
+    // same samples under a new key, e.g. the mel of unchanged audio computed again
+    if (wstate.inp_mel_prev_valid && wstate.inp_mel == wstate.inp_mel_prev) {
+        wstate.inp_key_prev = key;
+        return true;
+    }
+
+    return false;
+}
+
+// run the conv, encoder and cross passes on the window in wstate.inp_mel
+// on success the window becomes the input of the last completed pass
+static bool whisper_encode_compute(
+        whisper_context & wctx,
+          whisper_state & wstate,
+              const int   n_threads) {
+    wstate.inp_mel_prev_valid = false;
 
     // conv
     {
@@ -2401,25 +3068,8 @@ static bool whisper_encode_internal(
 
         // set the input
         {
-            const auto & mel_inp = wstate.mel;
-            const int n_ctx      = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
-
             assert(mel->type == GGML_TYPE_F32);
-            assert(mel_inp.n_mel == wctx.model.hparams.n_mels);
-
-            wstate.inp_mel.resize(ggml_nelements(mel));
-
-            float * dst = wstate.inp_mel.data();
-            memset(dst, 0, ggml_nbytes(mel));
-
-            const int i0 = std::min(mel_offset,           mel_inp.n_len);
-            const int i1 = std::min(mel_offset + 2*n_ctx, mel_inp.n_len);
-
-            for (int j = 0; j < mel_inp.n_mel; ++j) {
-                for (int i = i0; i < i1; ++i) {
-                    dst[j*2*n_ctx + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
-                }
-            }
+            assert(ggml_nelements(mel) == (int64_t) wstate.inp_mel.size());
 
             ggml_backend_tensor_set(mel, wstate.inp_mel.data(), 0, ggml_nelements(mel)*sizeof(float));
         }
@@ -2469,67 +3119,428 @@ static bool whisper_encode_internal(
         }
     }
 
-    wstate.t_encode_us += ggml_time_us() - t_start_us;
     wstate.n_encode++;
 
+    wstate.inp_mel_prev.swap(wstate.inp_mel);
+    wstate.inp_mel_prev_valid = true;
+    wstate.inp_key_prev = wstate.inp_key;
+
+    return true;
+}
+
+// evaluate the encoder with the given state
+//
+// given audio recording (more specifically, its log mel spectrogram), runs forward pass of the encoder
+// part of the transformer model and returns the encoded features
+//
+//   - wctx:      the model
+//   - wstate:     the state of the encoder
+//   - n_threads:  number of threads to use
+//   - mel_offset: offset in the mel spectrogram (i.e. audio offset)
+//
+static bool whisper_encode_internal(
+        whisper_context & wctx,
+          whisper_state & wstate,
+              const int   mel_offset,
+              const int   n_threads,
+    ggml_abort_callback   abort_callback,
+                   void * abort_callback_data) {
+    const int64_t t_start_us = ggml_time_us();
+
+    // same input as the last completed pass - the cross-attention KV cache is still valid
+    if (whisper_encode_set_input(wctx, wstate, mel_offset)) {
+        wstate.n_encode_hit++;
+
+        return !(abort_callback && abort_callback(abort_callback_data));
+    }
+
+    if (!whisper_encode_compute(wctx, wstate, n_threads)) {
+        return false;
+    }
+
+    wstate.t_encode_us += ggml_time_us() - t_start_us;
+
     return !(abort_callback && abort_callback(abort_callback_data));
 }
 
-static struct ggml_cgraph * whisper_build_graph_decoder(
-         whisper_context & wctx,
-         whisper_state   & wstate,
-     const whisper_batch & batch,
-                    bool   save_alignment_heads_QKs,
-                    bool   worst_case) {
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+// evaluate the encoder for several states at once
+//
+// the mel windows of all states that need a new pass are stacked into one graph, so the encoder weights
+// are read once per batch instead of once per window; the result of each window ends up in its own kv_cross
+// the compute buffers of the batched pass are kept in states[0] and grow with the largest batch seen
+//
+static bool whisper_encode_batch_internal(
+        whisper_context & wctx,
+  whisper_state * const * states,
+              const int * mel_offsets,
+              const int   n_states,
+              const int   n_threads) {
+    const int64_t t_start_us = ggml_time_us();
 
-    auto & kv_self = wstate.kv_self;
+    const auto & hparams = wctx.model.hparams;
 
-    WHISPER_ASSERT(!!kv_self.buffer);
+    const int n_ctx = states[0]->exp_n_audio_ctx > 0 ? states[0]->exp_n_audio_ctx : hparams.n_audio_ctx;
+
+    for (int i = 0; i < n_states; ++i) {
+        const int n_ctx_i = states[i]->exp_n_audio_ctx > 0 ? states[i]->exp_n_audio_ctx : hparams.n_audio_ctx;
+
+        if (n_ctx_i != n_ctx) {
+            WHISPER_LOG_ERROR("%s: all states must use the same audio_ctx (%d != %d)\n", __func__, n_ctx_i, n_ctx);
+            return false;
+        }
+    }
+
+    // external encoders take one window at a time
+    if (whisper_encode_external(*states[0])) {
+        for (int i = 0; i < n_states; ++i) {
+            if (!whisper_encode_internal(wctx, *states[i], mel_offsets[i], n_threads, nullptr, nullptr)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    std::vector<whisper_state *> batch;
+
+    for (int i = 0; i < n_states; ++i) {
+        if (whisper_encode_set_input(wctx, *states[i], mel_offsets[i])) {
+            states[i]->n_encode_hit++;
+            continue;
+        }
+
+        batch.push_back(states[i]);
+    }
+
+    const int n_batch = batch.size();
+
+    if (n_batch == 0) {
+        return true;
+    }
+
+    // a single window does not need the batched graph, its input is already in place
+    if (n_batch == 1) {
+        if (!whisper_encode_compute(wctx, *batch[0], n_threads)) {
+            return false;
+        }
+
+        batch[0]->t_encode_us += ggml_time_us() - t_start_us;
+
+        return true;
+    }
+
+    whisper_state & wstate = *states[0];
+
+    if (wstate.n_batch_alloc < n_batch) {
+        whisper_kv_cache_free(wstate.kv_pad_batch);
+        ggml_backend_sched_free(wstate.sched_batch.sched);
+
+        wstate.kv_pad_batch = {};
+        wstate.sched_batch  = {};
+        wstate.n_batch_alloc = 0;
+
+        // one padded window per batch entry, like kv_pad
+        if (!whisper_kv_cache_init(wstate.kv_pad_batch, wstate.backends[0], wctx.itype,
+                    hparams.n_audio_state,
+                    n_batch,
+                    GGML_PAD(hparams.n_audio_ctx, 256))) {
+            WHISPER_LOG_ERROR("%s: whisper_kv_cache_init() failed for the batched self-attention cache\n", __func__);
+            return false;
+        }
+
+        bool ok = whisper_sched_graph_init(wstate.sched_batch, wstate.backends,
+                [&]() {
+                    return whisper_build_graph_encode_batch(wctx, wstate, batch.data(), n_batch);
+                }, whisper_encode_batch_n_nodes(hparams, n_batch));
+
+        if (!ok) {
+            WHISPER_LOG_ERROR("%s: failed to init the batched encoder allocator\n", __func__);
+            return false;
+        }
+
+        WHISPER_LOG_INFO("%s: compute buffer (encode x %d) = %7.2f MB\n", __func__, n_batch, whisper_sched_size(wstate.sched_batch) / 1e6);
+
+        wstate.n_batch_alloc = n_batch;
+    }
+
+    for (auto * state : batch) {
+        state->inp_mel_prev_valid = false;
+    }
+
+    {
+        auto & sched = wstate.sched_batch.sched;
+
+        ggml_cgraph * gf = whisper_build_graph_encode_batch(wctx, wstate, batch.data(), n_batch);
+
+        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+            return false;
+        }
+
+        struct ggml_tensor * mel = ggml_graph_get_tensor(gf, "mel");
+
+        // set the input, one window after the other
+        {
+            assert(mel->type == GGML_TYPE_F32);
+
+            const size_t n_window = ggml_nelements(mel)/n_batch;
+
+            for (int ib = 0; ib < n_batch; ++ib) {
+                assert(batch[ib]->inp_mel.size() == n_window);
+
+                ggml_backend_tensor_set(mel, batch[ib]->inp_mel.data(), ib*n_window*sizeof(float), n_window*sizeof(float));
+            }
+        }
+
+        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+            return false;
+        }
+    }
+
+    // the time of the pass is shared between the windows
+    const int64_t t_encode_us = (ggml_time_us() - t_start_us)/n_batch;
+
+    for (auto * state : batch) {
+        state->t_encode_us += t_encode_us;
+        state->n_encode++;
+
+        state->inp_mel_prev.swap(state->inp_mel);
+        state->inp_mel_prev_valid = true;
+        state->inp_key_prev = state->inp_key;
+    }
+
+    return true;
+}
+
+// self-attention of the tokens of one state over its KV cache
+// Qcur and Kcur are scaled, all three are [n_state, n_tokens]
+// the new keys and values are stored at kv_head, the tokens attend to the first n_kv cells
+static struct ggml_tensor * whisper_build_decoder_self_attn(
+        struct ggml_context * ctx0,
+         struct ggml_cgraph * gf,
+      const whisper_context & wctx,
+     const whisper_kv_cache & kv_self,
+         struct ggml_tensor * Qcur,
+         struct ggml_tensor * Kcur,
+         struct ggml_tensor * Vcur,
+         struct ggml_tensor * KQ_mask,
+         struct ggml_tensor * KQ_mask_f16,
+                        int   il,
+                        int   n_tokens,
+                    int32_t   n_kv,
+                    int32_t   kv_head) {
+    const auto & hparams = wctx.model.hparams;
 
     const int n_ctx   = kv_self.size;
     const int n_state = hparams.n_text_state;
     const int n_head  = hparams.n_text_head;
-    const int n_layer = hparams.n_text_layer;
 
     const int n_state_head = n_state/n_head;
 
-    const int n_tokens    = batch.n_tokens;
+    struct ggml_tensor * cur;
+
+    // store key and value to memory
+    {
+        struct ggml_tensor * k;
+        struct ggml_tensor * v;
+
+        if (wctx.params.flash_attn) {
+            k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
+                    (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+
+            v = ggml_view_1d(ctx0, kv_self.v, n_tokens*n_state,
+                    (ggml_element_size(kv_self.v)*n_state)*(il*n_ctx + kv_head));
+        } else {
+            Vcur = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcur, n_state, n_tokens));
+
+            k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
+                    (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+
+            v = ggml_view_2d(ctx0, kv_self.v, n_tokens, n_state,
+                    (   n_ctx)*ggml_element_size(kv_self.v),
+                    (il*n_ctx)*ggml_element_size(kv_self.v)*n_state + kv_head*ggml_element_size(kv_self.v));
+        }
+
+        ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcur, k));
+        ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcur, v));
+    }
+
+    // ------
+
+    struct ggml_tensor * Q =
+        ggml_permute(ctx0,
+                ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_tokens),
+                0, 2, 1, 3);
+
+    struct ggml_tensor * K =
+        ggml_view_3d(ctx0, kv_self.k,
+                n_state_head, n_kv, n_head,
+                ggml_element_size(kv_self.k)*n_state,
+                ggml_element_size(kv_self.k)*n_state_head,
+                ggml_element_size(kv_self.k)*n_state*n_ctx*il);
+
+    if (wctx.params.flash_attn) {
+        struct ggml_tensor * V =
+            ggml_view_3d(ctx0, kv_self.v,
+                    n_state_head, n_kv, n_head,
+                    ggml_element_size(kv_self.v)*n_state,
+                    ggml_element_size(kv_self.v)*n_state_head,
+                    ggml_element_size(kv_self.v)*n_state*n_ctx*il);
+
+        cur = ggml_flash_attn_ext(ctx0, Q, K, V, KQ_mask_f16, 1.0f, 0.0f, 0.0f);
+
+        cur = ggml_reshape_2d(ctx0, cur, n_state, n_tokens);
+    } else {
+        // K * Q
+        struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
+
+        struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, KQ_mask, 1.0f, 0.0f);
+
+        struct ggml_tensor * V =
+            ggml_view_3d(ctx0, kv_self.v,
+                    n_kv, n_state_head, n_head,
+                    n_ctx*ggml_element_size(kv_self.v),
+                    n_ctx*ggml_element_size(kv_self.v)*n_state_head,
+                    n_ctx*ggml_element_size(kv_self.v)*n_state*il);
+
+        struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
+
+        struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+
+        cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_tokens);
+    }
+
+    return cur;
+}
+
+// cross-attention of the tokens of one state over the encoder output in its kv_cross
+// Qcur is [n_state, n_tokens]
+// without flash attention, the attention weights are returned in KQ_soft_max_out if it is not null
+static struct ggml_tensor * whisper_build_decoder_cross_attn(
+        struct ggml_context * ctx0,
+      const whisper_context & wctx,
+        const whisper_state & wstate,
+         struct ggml_tensor * Qcur,
+                        int   il,
+                        int   n_tokens,
+        struct ggml_tensor ** KQ_soft_max_out) {
+    const auto & hparams = wctx.model.hparams;
+
+    const int n_state = hparams.n_text_state;
+    const int n_head  = hparams.n_text_head;
+
+    const int n_state_head = n_state/n_head;
+
     const int n_audio_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
 
     const int n_audio_ctx_pad = GGML_PAD(n_audio_ctx, 256);
 
-    const int32_t n_kv    = worst_case ? n_ctx            : kv_self.n;
-    const int32_t kv_head = worst_case ? n_ctx - n_tokens : kv_self.head;
+    const float KQscale = pow(float(n_state_head), -0.25);
 
-    //WHISPER_LOG_DEBUG("%s: n_past = %d, n_tokens = %d, n_audio_ctx = %d, n_ctx = %d\n", __func__, n_past, n_tokens, n_audio_ctx, n_ctx);
+    struct ggml_tensor * cur;
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_decode.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_decode.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
+    struct ggml_tensor * Q =
+        ggml_permute(ctx0,
+                ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_tokens),
+                0, 2, 1, 3);
 
-    struct ggml_context * ctx0 = ggml_init(params);
+    if (wctx.params.flash_attn) {
+        struct ggml_tensor * Kcross =
+            ggml_view_3d(ctx0, wstate.kv_cross.k,
+                    n_state_head, n_audio_ctx_pad, n_head,
+                    ggml_element_size(wstate.kv_cross.k)*n_state,
+                    ggml_element_size(wstate.kv_cross.k)*n_state_head,
+                    ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx_pad*il);
 
-    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+        struct ggml_tensor * Vcross =
+            ggml_view_3d(ctx0, wstate.kv_cross.v,
+                    n_state_head, n_audio_ctx_pad, n_head,
+                    ggml_element_size(wstate.kv_cross.v)*n_state,
+                    ggml_element_size(wstate.kv_cross.v)*n_state_head,
+                    ggml_element_size(wstate.kv_cross.v)*n_state*n_audio_ctx_pad*il);
 
-    struct ggml_tensor * embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
-    ggml_set_name(embd, "embd");
-    ggml_set_input(embd);
+        cur = ggml_flash_attn_ext(ctx0, Q, Kcross, Vcross, nullptr, KQscale, 0.0f, 0.0f);
 
-    struct ggml_tensor * position = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
-    ggml_set_name(position, "position");
-    ggml_set_input(position);
+        cur = ggml_reshape_2d(ctx0, cur, n_state, n_tokens);
+    } else {
+        struct ggml_tensor * Kcross =
+            ggml_view_3d(ctx0, wstate.kv_cross.k,
+                    n_state_head, n_audio_ctx, n_head,
+                    ggml_element_size(wstate.kv_cross.k)*n_state,
+                    ggml_element_size(wstate.kv_cross.k)*n_state_head,
+                    ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx*il);
+
+        struct ggml_tensor * Vcross =
+            ggml_view_3d(ctx0, wstate.kv_cross.v,
+                    n_audio_ctx, n_state_head, n_head,
+                    n_audio_ctx*ggml_element_size(wstate.kv_cross.v),
+                    n_audio_ctx*ggml_element_size(wstate.kv_cross.v)*n_state_head,
+                    n_audio_ctx*ggml_element_size(wstate.kv_cross.v)*n_state*il);
+
+        // ------
+
+        // K * Q
+        struct ggml_tensor * KQ = ggml_mul_mat(ctx0, Kcross, Q);
+
+        struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, nullptr, KQscale, 0.0f);
+
+        if (KQ_soft_max_out) {
+            *KQ_soft_max_out = KQ_soft_max;
+        }
+
+        struct ggml_tensor * KQV = ggml_mul_mat(ctx0, Vcross, KQ_soft_max);
+
+        struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+
+        cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_tokens);
+    }
+
+    return cur;
+}
+
+// the layers of the decoder, from the token embeddings to the final norm
+// the tokens of all the states go through the token-wise layers together; the self- and cross-attention of
+// state b run on the tokens [t0[b], t0[b] + n_tokens[b]) against its own caches
+struct whisper_decoder_graph_part {
+    const whisper_state * state;
+
+    int t0;
+    int n_tokens;
+
+    int32_t n_kv;
+    int32_t kv_head;
+
+    struct ggml_tensor * KQ_mask;
+    struct ggml_tensor * KQ_mask_f16;
+};
+
+static struct ggml_tensor * whisper_build_decoder_layers(
+        struct ggml_context * ctx0,
+         struct ggml_cgraph * gf,
+      const whisper_context & wctx,
+         struct ggml_tensor * embd,
+         struct ggml_tensor * position,
+   const whisper_decoder_graph_part * parts,
+                        int   n_parts,
+       struct ggml_tensor ** aheads_cross_QKs) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_state = hparams.n_text_state;
+    const int n_head  = hparams.n_text_head;
+    const int n_layer = hparams.n_text_layer;
+
+    const int n_state_head = n_state/n_head;
 
     const float KQscale = pow(float(n_state_head), -0.25);
 
-    struct ggml_tensor * KQ_mask = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_kv, GGML_PAD(n_tokens, GGML_KQ_MASK_PAD), 1);
-    ggml_set_name(KQ_mask, "KQ_mask");
-    ggml_set_input(KQ_mask);
+    // rows [t0, t0 + n) of a [n_state, n_tokens] tensor
+    auto rows = [&](struct ggml_tensor * t, const whisper_decoder_graph_part & part) {
+        if (n_parts == 1) {
+            return t;
+        }
 
-    struct ggml_tensor * KQ_mask_f16 = ggml_cast(ctx0, KQ_mask, GGML_TYPE_F16);
+        return ggml_view_2d(ctx0, t, t->ne[0], part.n_tokens, t->nb[1], part.t0*t->nb[1]);
+    };
 
     // token encoding + position encoding
     struct ggml_tensor * cur =
@@ -2539,9 +3550,6 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
     struct ggml_tensor * inpL = cur;
 
-    // [EXPERIMENTAL] Token-level timestamps with DTW
-    struct ggml_tensor * aheads_cross_QKs = nullptr;
-
     for (int il = 0; il < n_layer; ++il) {
         const auto & layer = model.layers_decoder[il];
 
@@ -2576,83 +3584,23 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
             Kcur = ggml_scale(ctx0, Kcur, KQscale);
 
-            // store key and value to memory
-            {
-                struct ggml_tensor * Vcur = ggml_mul_mat(ctx0,
-                        layer.attn_v_w,
-                        cur);
-
-                Vcur = ggml_add(ctx0,
-                            Vcur,
-                            layer.attn_v_b);
-
-                struct ggml_tensor * k;
-                struct ggml_tensor * v;
-
-                if (wctx.params.flash_attn) {
-                    k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
-                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
-
-                    v = ggml_view_1d(ctx0, kv_self.v, n_tokens*n_state,
-                            (ggml_element_size(kv_self.v)*n_state)*(il*n_ctx + kv_head));
-                } else {
-                    Vcur = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcur, n_state, n_tokens));
-
-                    k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
-                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
-
-                    v = ggml_view_2d(ctx0, kv_self.v, n_tokens, n_state,
-                            (   n_ctx)*ggml_element_size(kv_self.v),
-                            (il*n_ctx)*ggml_element_size(kv_self.v)*n_state + kv_head*ggml_element_size(kv_self.v));
-                }
-
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcur, k));
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcur, v));
-            }
-
-            // ------
-
-            struct ggml_tensor * Q =
-                ggml_permute(ctx0,
-                        ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_tokens),
-                        0, 2, 1, 3);
-
-            struct ggml_tensor * K =
-                ggml_view_3d(ctx0, kv_self.k,
-                        n_state_head, n_kv, n_head,
-                        ggml_element_size(kv_self.k)*n_state,
-                        ggml_element_size(kv_self.k)*n_state_head,
-                        ggml_element_size(kv_self.k)*n_state*n_ctx*il);
-
-            if (wctx.params.flash_attn) {
-                struct ggml_tensor * V =
-                    ggml_view_3d(ctx0, kv_self.v,
-                            n_state_head, n_kv, n_head,
-                            ggml_element_size(kv_self.v)*n_state,
-                            ggml_element_size(kv_self.v)*n_state_head,
-                            ggml_element_size(kv_self.v)*n_state*n_ctx*il);
-
-                cur = ggml_flash_attn_ext(ctx0, Q, K, V, KQ_mask_f16, 1.0f, 0.0f, 0.0f);
-
-                cur = ggml_reshape_2d(ctx0, cur, n_state, n_tokens);
-            } else {
-                // K * Q
-                struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
-
-                struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, KQ_mask, 1.0f, 0.0f);
+            struct ggml_tensor * Vcur = ggml_mul_mat(ctx0,
+                    layer.attn_v_w,
+                    cur);
 
-                struct ggml_tensor * V =
-                    ggml_view_3d(ctx0, kv_self.v,
-                            n_kv, n_state_head, n_head,
-                            n_ctx*ggml_element_size(kv_self.v),
-                            n_ctx*ggml_element_size(kv_self.v)*n_state_head,
-                            n_ctx*ggml_element_size(kv_self.v)*n_state*il);
+            Vcur = ggml_add(ctx0,
+                        Vcur,
+                        layer.attn_v_b);
 
-                struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
+            cur = nullptr;
+            for (int ib = 0; ib < n_parts; ++ib) {
+                const auto & part = parts[ib];
 
-                struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+                struct ggml_tensor * KQV = whisper_build_decoder_self_attn(ctx0, gf, wctx, part.state->kv_self,
+                        rows(Qcur, part), rows(Kcur, part), rows(Vcur, part), part.KQ_mask, part.KQ_mask_f16,
+                        il, part.n_tokens, part.n_kv, part.kv_head);
 
-                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_tokens);
+                cur = cur ? ggml_concat(ctx0, cur, KQV, 1) : KQV;
             }
         }
 
@@ -2692,74 +3640,34 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                         Qcur,
                         layer.cross_attn_q_b);
 
-            struct ggml_tensor * Q =
-                ggml_permute(ctx0,
-                        ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_tokens),
-                        0, 2, 1, 3);
+            cur = nullptr;
+            for (int ib = 0; ib < n_parts; ++ib) {
+                const auto & part = parts[ib];
 
-            if (wctx.params.flash_attn) {
-                struct ggml_tensor * Kcross =
-                    ggml_view_3d(ctx0, wstate.kv_cross.k,
-                            n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state,
-                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx_pad*il);
-
-                struct ggml_tensor * Vcross =
-                    ggml_view_3d(ctx0, wstate.kv_cross.v,
-                            n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state,
-                            ggml_element_size(wstate.kv_cross.v)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state*n_audio_ctx_pad*il);
-
-                cur = ggml_flash_attn_ext(ctx0, Q, Kcross, Vcross, nullptr, KQscale, 0.0f, 0.0f);
-
-                cur = ggml_reshape_2d(ctx0, cur, n_state, n_tokens);
-            } else {
-                struct ggml_tensor * Kcross =
-                    ggml_view_3d(ctx0, wstate.kv_cross.k,
-                            n_state_head, n_audio_ctx, n_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state,
-                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx*il);
-
-                struct ggml_tensor * Vcross =
-                    ggml_view_3d(ctx0, wstate.kv_cross.v,
-                            n_audio_ctx, n_state_head, n_head,
-                            n_audio_ctx*ggml_element_size(wstate.kv_cross.v),
-                            n_audio_ctx*ggml_element_size(wstate.kv_cross.v)*n_state_head,
-                            n_audio_ctx*ggml_element_size(wstate.kv_cross.v)*n_state*il);
-
-                // ------
+                struct ggml_tensor * KQ_soft_max = nullptr;
 
-                // K * Q
-                struct ggml_tensor * KQ = ggml_mul_mat(ctx0, Kcross, Q);
+                struct ggml_tensor * KQV = whisper_build_decoder_cross_attn(ctx0, wctx, *part.state,
+                        rows(Qcur, part), il, part.n_tokens, &KQ_soft_max);
 
-                struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, nullptr, KQscale, 0.0f);
+                cur = cur ? ggml_concat(ctx0, cur, KQV, 1) : KQV;
 
                 // [EXPERIMENTAL] Token-level timestamps with DTW
-                if (wctx.params.dtw_token_timestamps) {
-                    if (wstate.aheads_masks.m[il] != nullptr) {
-                        struct ggml_tensor * aheads_KQs = ggml_reshape_2d(ctx0, KQ_soft_max, KQ_soft_max->ne[0] * KQ_soft_max->ne[1], KQ_soft_max->ne[2]);
-                        aheads_KQs = ggml_transpose(ctx0, aheads_KQs);
-                        aheads_KQs = ggml_cont(ctx0, aheads_KQs);
-                        aheads_KQs = ggml_mul_mat(ctx0, wstate.aheads_masks.m[il], aheads_KQs);
-                        aheads_KQs = ggml_transpose(ctx0, aheads_KQs);
-                        aheads_KQs = ggml_cont(ctx0, aheads_KQs);
-                        aheads_KQs = ggml_reshape_3d(ctx0, aheads_KQs, KQ_soft_max->ne[0], KQ_soft_max->ne[1], wstate.aheads_masks.m[il]->ne[1]);
-                        if (aheads_cross_QKs == NULL) {
-                            aheads_cross_QKs = aheads_KQs;
-                        } else {
-                            aheads_cross_QKs = ggml_concat(ctx0, aheads_cross_QKs, aheads_KQs, 2);
-                        }
+                const auto & aheads_masks = part.state->aheads_masks;
+
+                if (aheads_cross_QKs && KQ_soft_max && aheads_masks.m[il] != nullptr) {
+                    struct ggml_tensor * aheads_KQs = ggml_reshape_2d(ctx0, KQ_soft_max, KQ_soft_max->ne[0] * KQ_soft_max->ne[1], KQ_soft_max->ne[2]);
+                    aheads_KQs = ggml_transpose(ctx0, aheads_KQs);
+                    aheads_KQs = ggml_cont(ctx0, aheads_KQs);
+                    aheads_KQs = ggml_mul_mat(ctx0, aheads_masks.m[il], aheads_KQs);
+                    aheads_KQs = ggml_transpose(ctx0, aheads_KQs);
+                    aheads_KQs = ggml_cont(ctx0, aheads_KQs);
+                    aheads_KQs = ggml_reshape_3d(ctx0, aheads_KQs, KQ_soft_max->ne[0], KQ_soft_max->ne[1], aheads_masks.m[il]->ne[1]);
+                    if (*aheads_cross_QKs == NULL) {
+                        *aheads_cross_QKs = aheads_KQs;
+                    } else {
+                        *aheads_cross_QKs = ggml_concat(ctx0, *aheads_cross_QKs, aheads_KQs, 2);
                     }
                 }
-
-                struct ggml_tensor * KQV = ggml_mul_mat(ctx0, Vcross, KQ_soft_max);
-
-                struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
-
-                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_tokens);
             }
         }
 
@@ -2831,6 +3739,71 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                 model.d_ln_b);
     }
 
+    return cur;
+}
+
+// self-attention mask of one state, [n_kv, GGML_PAD(n_tokens, GGML_KQ_MASK_PAD)]
+static struct ggml_tensor * whisper_build_decoder_mask(struct ggml_context * ctx0, int32_t n_kv, int n_tokens, const char * name) {
+    struct ggml_tensor * KQ_mask = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_kv, GGML_PAD(n_tokens, GGML_KQ_MASK_PAD), 1);
+    ggml_set_name(KQ_mask, name);
+    ggml_set_input(KQ_mask);
+
+    return KQ_mask;
+}
+
+static struct ggml_cgraph * whisper_build_graph_decoder(
+         whisper_context & wctx,
+         whisper_state   & wstate,
+     const whisper_batch & batch,
+                    bool   save_alignment_heads_QKs,
+                    bool   worst_case) {
+    const auto & model   = wctx.model;
+
+    auto & kv_self = wstate.kv_self;
+
+    WHISPER_ASSERT(!!kv_self.buffer);
+
+    const int n_ctx    = kv_self.size;
+    const int n_tokens = batch.n_tokens;
+
+    const int32_t n_kv    = worst_case ? n_ctx            : kv_self.n;
+    const int32_t kv_head = worst_case ? n_ctx - n_tokens : kv_self.head;
+
+    //WHISPER_LOG_DEBUG("%s: n_past = %d, n_tokens = %d, n_audio_ctx = %d, n_ctx = %d\n", __func__, n_past, n_tokens, n_audio_ctx, n_ctx);
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.sched_decode.meta.size(),
+        /*.mem_buffer =*/ wstate.sched_decode.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    struct ggml_tensor * embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+    ggml_set_name(embd, "embd");
+    ggml_set_input(embd);
+
+    struct ggml_tensor * position = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+    ggml_set_name(position, "position");
+    ggml_set_input(position);
+
+    whisper_decoder_graph_part part;
+    part.state       = &wstate;
+    part.t0          = 0;
+    part.n_tokens    = n_tokens;
+    part.n_kv        = n_kv;
+    part.kv_head     = kv_head;
+    part.KQ_mask     = whisper_build_decoder_mask(ctx0, n_kv, n_tokens, "KQ_mask");
+    part.KQ_mask_f16 = ggml_cast(ctx0, part.KQ_mask, GGML_TYPE_F16);
+
+    // [EXPERIMENTAL] Token-level timestamps with DTW
+    struct ggml_tensor * aheads_cross_QKs = nullptr;
+
+    struct ggml_tensor * cur = whisper_build_decoder_layers(ctx0, gf, wctx, embd, position, &part, 1,
+            wctx.params.dtw_token_timestamps ? &aheads_cross_QKs : nullptr);
+
     // compute logits only for the last token
     // comment this line to compute logits for all n_tokens
     // might be useful in the future
@@ -2855,108 +3828,317 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
     return gf;
 }
 
+// graph size of a batched decoder pass: the attention runs on each state separately
+static int whisper_decode_batch_n_nodes(const whisper_hparams & hparams, int n_batch) {
+    return WHISPER_MAX_NODES + 48*hparams.n_text_layer*n_batch;
+}
+
+// decoder pass over the batches of several states in a single graph
+// the compute buffer is the one of the context, see whisper_decode_queue
+static struct ggml_cgraph * whisper_build_graph_decoder_batch(
+          whisper_context & wctx,
+    whisper_state * const * states,
+const whisper_batch * const * batches,
+                      int   n_batch,
+                     bool   worst_case) {
+    const auto & model = wctx.model;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wctx.decode_queue.sched.meta.size(),
+        /*.mem_buffer =*/ wctx.decode_queue.sched.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, whisper_decode_batch_n_nodes(model.hparams, n_batch), false);
+
+    std::vector<whisper_decoder_graph_part> parts(n_batch);
+
+    int n_tokens = 0;
+    for (int ib = 0; ib < n_batch; ++ib) {
+        const auto & kv_self = states[ib]->kv_self;
+
+        WHISPER_ASSERT(!!kv_self.buffer);
+
+        auto & part = parts[ib];
+
+        part.state    = states[ib];
+        part.t0       = n_tokens;
+        part.n_tokens = batches[ib]->n_tokens;
+        part.n_kv     = worst_case ? kv_self.size                 : kv_self.n;
+        part.kv_head  = worst_case ? kv_self.size - part.n_tokens : kv_self.head;
+
+        char name[32];
+        snprintf(name, sizeof(name), "KQ_mask_%d", ib);
+
+        part.KQ_mask     = whisper_build_decoder_mask(ctx0, part.n_kv, part.n_tokens, name);
+        part.KQ_mask_f16 = ggml_cast(ctx0, part.KQ_mask, GGML_TYPE_F16);
+
+        n_tokens += part.n_tokens;
+    }
+
+    struct ggml_tensor * embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+    ggml_set_name(embd, "embd");
+    ggml_set_input(embd);
+
+    struct ggml_tensor * position = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+    ggml_set_name(position, "position");
+    ggml_set_input(position);
+
+    struct ggml_tensor * cur = whisper_build_decoder_layers(ctx0, gf, wctx, embd, position, parts.data(), n_batch, nullptr);
+
+    struct ggml_tensor * logits = ggml_mul_mat(ctx0, model.d_te, cur);
+
+    ggml_build_forward_expand(gf, logits);
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+// find the KV slot for the batch and the number of cells the graph attends to
+static bool whisper_decode_find_slot(const whisper_context & wctx, whisper_state & wstate, const whisper_batch & batch) {
+    auto & kv_self = wstate.kv_self;
+
+    if (!whisper_kv_cache_find_slot(kv_self, batch)) {
+        return false;
+    }
+
+    const uint32_t pad = whisper_kv_cache_get_padding(wctx);
+    kv_self.n = std::min(kv_self.size, std::max(pad, GGML_PAD(whisper_kv_cache_cell_max(kv_self), pad)));
+
+    //kv_self.n = std::min((int32_t) hparams.n_text_ctx, std::max(32, whisper_kv_cache_cell_max(kv_self)));
+    //printf("n_tokens = %5d, kv_self.head = %5d, kv_self.n = %5d, seq_id = %5d\n", batch.n_tokens, kv_self.head, kv_self.n, batch.seq_id[0][0]);
+
+    return true;
+}
+
+// a token attends to the cells of its own sequence up to its position
+static void whisper_decode_set_mask(whisper_state & wstate, const whisper_batch & batch, struct ggml_tensor * KQ_mask) {
+    auto & kv_self = wstate.kv_self;
+
+    const int32_t n_kv     = kv_self.n;
+    const int     n_tokens = batch.n_tokens;
+
+    wstate.inp_mask.resize(ggml_nelements(KQ_mask));
+
+    float * data = wstate.inp_mask.data();
+    memset(data, 0, ggml_nbytes(KQ_mask));
+
+    for (int h = 0; h < 1; ++h) {
+        for (int j = 0; j < n_tokens; ++j) {
+            const whisper_pos    pos    = batch.pos[j];
+            const whisper_seq_id seq_id = batch.seq_id[j][0];
+
+            for (int i = 0; i < n_kv; ++i) {
+                if (!kv_self.cells[i].has_seq_id(seq_id) || kv_self.cells[i].pos > pos) {
+                    data[h*(n_kv*n_tokens) + j*n_kv + i] = -INFINITY;
+                }
+            }
+        }
+
+        for (int i = n_tokens; i < GGML_PAD(n_tokens, GGML_KQ_MASK_PAD); ++i) {
+            for (int j = 0; j < n_kv; ++j) {
+                data[h*(n_kv*n_tokens) + i*n_kv + j] = -INFINITY;
+            }
+        }
+    }
+
+    ggml_backend_tensor_set(KQ_mask, wstate.inp_mask.data(), 0, ggml_nelements(KQ_mask)*sizeof(float));
+}
+
+// copy the logits of the tokens that asked for them, rows [t0, t0 + batch.n_tokens) of the graph output
+static void whisper_decode_get_logits(const whisper_context & wctx, whisper_state & wstate, const whisper_batch & batch, struct ggml_tensor * logits, int t0) {
+    const int n_vocab = wctx.model.hparams.n_vocab;
+
+    auto & logits_out = wstate.logits;
+
+    logits_out.resize(batch.n_tokens*n_vocab);
+    for (int i = 0; i < batch.n_tokens; i++) {
+        if (batch.logits[i] == 0) {
+            continue;
+        }
+        ggml_backend_tensor_get(logits, logits_out.data() + (n_vocab*i), sizeof(float)*(n_vocab*(t0 + i)), sizeof(float)*n_vocab);
+    }
+}
+
+static void whisper_decode_add_time(whisper_state & wstate, int n_tokens, int64_t t_us) {
+    if (n_tokens == 1) {
+        wstate.t_decode_us += t_us;
+        wstate.n_decode++;
+    } else if (n_tokens < 16) {
+        wstate.t_batchd_us += t_us;
+        wstate.n_batchd += n_tokens;
+    } else {
+        wstate.t_prompt_us += t_us;
+        wstate.n_prompt += n_tokens;
+    }
+}
+
 // evaluate the decoder
 //
 // given text prompt + audio features -> computes the logits for the next token
 //
-//   - model:      the model
-//   - n_threads:  number of threads to use
-//   - tokens:     text prompt
-//   - n_tokens:   number of tokens in the prompt
-//   - n_past:     number of past tokens to prefix the prompt with
+//   - model:      the model
+//   - n_threads:  number of threads to use
+//   - tokens:     text prompt
+//   - n_tokens:   number of tokens in the prompt
+//   - n_past:     number of past tokens to prefix the prompt with
+//
+static bool whisper_decode_internal(
+        whisper_context & wctx,
+          whisper_state & wstate,
+    const whisper_batch & batch,
+              const int   n_threads,
+                   bool   save_alignment_heads_QKs,
+    ggml_abort_callback   abort_callback,
+                   void * abort_callback_data) {
+    const int64_t t_start_us = ggml_time_us();
+
+    const int n_tokens = batch.n_tokens;
+
+    struct ggml_tensor * logits;
+
+    // find KV slot for the batch
+    if (!whisper_decode_find_slot(wctx, wstate, batch)) {
+        return false;
+    }
+
+    // decoder
+    {
+        auto & sched = wstate.sched_decode.sched;
+
+        ggml_cgraph * gf = whisper_build_graph_decoder(wctx, wstate, batch, save_alignment_heads_QKs, false);
+
+        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+            // should never happen as we pre-allocate the memory
+            return false;
+        }
+
+        // set the inputs
+        {
+            struct ggml_tensor * embd = ggml_graph_get_tensor(gf, "embd");
+            ggml_backend_tensor_set(embd, batch.token, 0, n_tokens*ggml_element_size(embd));
+        }
+
+        {
+            struct ggml_tensor * position = ggml_graph_get_tensor(gf, "position");
+            for (int i = 0; i < n_tokens; ++i) {
+                const int32_t val = batch.pos[i];
+                ggml_backend_tensor_set(position, &val, i*sizeof(int32_t), sizeof(int32_t));
+            }
+        }
+
+        whisper_decode_set_mask(wstate, batch, ggml_graph_get_tensor(gf, "KQ_mask"));
+
+        logits = ggml_graph_node(gf, -1);
+
+        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+            return false;
+        }
+    }
+
+    whisper_decode_get_logits(wctx, wstate, batch, logits, 0);
+
+    if (batch.n_tokens > 1) {
+        //printf("%s: used_mem = %f MB, %f MB, %f MB %f MB %f MB\n", __func__,
+        //        ggml_used_mem(ctx0)/1e6,
+        //        wstate.get_buf_max_mem(0)/1e6,
+        //        wstate.get_buf_max_mem(1)/1e6,
+        //        wstate.get_buf_max_mem(2)/1e6,
+        //        wstate.get_buf_max_mem(3)/1e6);
+    }
+
+    whisper_decode_add_time(wstate, n_tokens, ggml_time_us() - t_start_us);
+
+    return !(abort_callback && abort_callback(abort_callback_data));
+}
+
+// evaluate the decoder for several states at once
+//
+// the tokens of all the batches go through one graph, so the decoder weights are read once per pass instead of
+// once per state; each state attends to its own self-attention cache and to its own encoder output in kv_cross
+// the compute buffer of the batched pass is the one of the context (whisper_decode_queue), it grows with the largest
+// batch seen
 //
-static bool whisper_decode_internal(
+static bool whisper_decode_batch_internal(
         whisper_context & wctx,
-          whisper_state & wstate,
-    const whisper_batch & batch,
-              const int   n_threads,
-                   bool   save_alignment_heads_QKs,
-    ggml_abort_callback   abort_callback,
-                   void * abort_callback_data) {
+  whisper_state * const * states,
+const whisper_batch * const * batches,
+              const int   n_states,
+              const int   n_threads) {
     const int64_t t_start_us = ggml_time_us();
 
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+    if (n_states == 1) {
+        return whisper_decode_internal(wctx, *states[0], *batches[0], n_threads, false, nullptr, nullptr);
+    }
 
-    const int n_vocab  = hparams.n_vocab;
-    const int n_tokens = batch.n_tokens;
+    for (int i = 0; i < n_states; ++i) {
+        if (!whisper_decode_find_slot(wctx, *states[i], *batches[i])) {
+            return false;
+        }
+    }
 
-    auto & logits_out = wstate.logits;
+    auto & queue = wctx.decode_queue;
 
-    struct ggml_tensor * logits;
+    std::lock_guard<std::mutex> lock(queue.mutex_pass);
 
-    // find KV slot for the batch
-    {
-        auto & kv_self = wstate.kv_self;
+    if (queue.n_alloc < n_states) {
+        if (queue.backends.empty()) {
+            queue.backends = whisper_backend_init(wctx.params);
+        }
+
+        ggml_backend_sched_free(queue.sched.sched);
+
+        queue.sched   = {};
+        queue.n_alloc = 0;
+
+        bool ok = whisper_sched_graph_init(queue.sched, queue.backends,
+                [&]() {
+                    return whisper_build_graph_decoder_batch(wctx, states, batches, n_states, true);
+                }, whisper_decode_batch_n_nodes(wctx.model.hparams, n_states));
 
-        if (!whisper_kv_cache_find_slot(kv_self, batch)) {
+        if (!ok) {
+            WHISPER_LOG_ERROR("%s: failed to init the batched decoder allocator\n", __func__);
             return false;
         }
 
-        const uint32_t pad = whisper_kv_cache_get_padding(wctx);
-        kv_self.n = std::min(kv_self.size, std::max(pad, GGML_PAD(whisper_kv_cache_cell_max(kv_self), pad)));
+        WHISPER_LOG_INFO("%s: compute buffer (decode x %d) = %7.2f MB\n", __func__, n_states, whisper_sched_size(queue.sched) / 1e6);
 
-        //kv_self.n = std::min((int32_t) hparams.n_text_ctx, std::max(32, whisper_kv_cache_cell_max(kv_self)));
-        //printf("n_tokens = %5d, kv_self.head = %5d, kv_self.n = %5d, seq_id = %5d\n", batch.n_tokens, kv_self.head, kv_self.n, batch.seq_id[0][0]);
+        queue.n_alloc = n_states;
     }
 
-    // decoder
+    struct ggml_tensor * logits;
+
     {
-        auto & sched = wstate.sched_decode.sched;
+        auto & sched = queue.sched.sched;
 
-        ggml_cgraph * gf = whisper_build_graph_decoder(wctx, wstate, batch, save_alignment_heads_QKs, false);
+        ggml_cgraph * gf = whisper_build_graph_decoder_batch(wctx, states, batches, n_states, false);
 
         if (!ggml_backend_sched_alloc_graph(sched, gf)) {
-            // should never happen as we pre-allocate the memory
             return false;
         }
 
-        // set the inputs
-        {
-            struct ggml_tensor * embd = ggml_graph_get_tensor(gf, "embd");
-            ggml_backend_tensor_set(embd, batch.token, 0, n_tokens*ggml_element_size(embd));
-        }
-
+        // set the inputs, one batch after the other
         {
+            struct ggml_tensor * embd     = ggml_graph_get_tensor(gf, "embd");
             struct ggml_tensor * position = ggml_graph_get_tensor(gf, "position");
-            for (int i = 0; i < n_tokens; ++i) {
-                const int32_t val = batch.pos[i];
-                ggml_backend_tensor_set(position, &val, i*sizeof(int32_t), sizeof(int32_t));
-            }
-        }
-
-        {
-            struct ggml_tensor * KQ_mask = ggml_graph_get_tensor(gf, "KQ_mask");
-
-            auto & kv_self = wstate.kv_self;
 
-            const int32_t n_kv = kv_self.n;
+            int t0 = 0;
+            for (int i = 0; i < n_states; ++i) {
+                const whisper_batch & batch = *batches[i];
 
-            wstate.inp_mask.resize(ggml_nelements(KQ_mask));
+                ggml_backend_tensor_set(embd,     batch.token, t0*sizeof(int32_t), batch.n_tokens*sizeof(int32_t));
+                ggml_backend_tensor_set(position, batch.pos,   t0*sizeof(int32_t), batch.n_tokens*sizeof(int32_t));
 
-            float * data = wstate.inp_mask.data();
-            memset(data, 0, ggml_nbytes(KQ_mask));
+                char name[32];
+                snprintf(name, sizeof(name), "KQ_mask_%d", i);
 
-            for (int h = 0; h < 1; ++h) {
-                for (int j = 0; j < n_tokens; ++j) {
-                    const whisper_pos    pos    = batch.pos[j];
-                    const whisper_seq_id seq_id = batch.seq_id[j][0];
-
-                    for (int i = 0; i < n_kv; ++i) {
-                        if (!kv_self.cells[i].has_seq_id(seq_id) || kv_self.cells[i].pos > pos) {
-                            data[h*(n_kv*n_tokens) + j*n_kv + i] = -INFINITY;
-                        }
-                    }
-                }
+                whisper_decode_set_mask(*states[i], batch, ggml_graph_get_tensor(gf, name));
 
-                for (int i = n_tokens; i < GGML_PAD(n_tokens, GGML_KQ_MASK_PAD); ++i) {
-                    for (int j = 0; j < n_kv; ++j) {
-                        data[h*(n_kv*n_tokens) + i*n_kv + j] = -INFINITY;
-                    }
-                }
+                t0 += batch.n_tokens;
             }
-
-            ggml_backend_tensor_set(KQ_mask, wstate.inp_mask.data(), 0, ggml_nelements(KQ_mask)*sizeof(float));
         }
 
         logits = ggml_graph_node(gf, -1);
@@ -2966,35 +4148,18 @@ static bool whisper_decode_internal(
         }
     }
 
-    logits_out.resize(n_tokens*n_vocab);
-    for (int i = 0; i < n_tokens; i++) {
-        if (batch.logits[i] == 0) {
-            continue;
-        }
-        ggml_backend_tensor_get(logits, logits_out.data() + (n_vocab*i), sizeof(float)*(n_vocab*i), sizeof(float)*n_vocab);
-    }
+    // the time of the pass is shared between the states
+    const int64_t t_decode_us = (ggml_time_us() - t_start_us)/n_states;
 
-    if (batch.n_tokens > 1) {
-        //printf("%s: used_mem = %f MB, %f MB, %f MB %f MB %f MB\n", __func__,
-        //        ggml_used_mem(ctx0)/1e6,
-        //        wstate.get_buf_max_mem(0)/1e6,
-        //        wstate.get_buf_max_mem(1)/1e6,
-        //        wstate.get_buf_max_mem(2)/1e6,
-        //        wstate.get_buf_max_mem(3)/1e6);
-    }
+    int t0 = 0;
+    for (int i = 0; i < n_states; ++i) {
+        whisper_decode_get_logits(wctx, *states[i], *batches[i], logits, t0);
+        whisper_decode_add_time(*states[i], batches[i]->n_tokens, t_decode_us);
 
-    if (batch.n_tokens == 1) {
-        wstate.t_decode_us += ggml_time_us() - t_start_us;
-        wstate.n_decode++;
-    } else if (batch.n_tokens < 16) {
-        wstate.t_batchd_us += ggml_time_us() - t_start_us;
-        wstate.n_batchd += n_tokens;
-    } else {
-        wstate.t_prompt_us += ggml_time_us() - t_start_us;
-        wstate.n_prompt += n_tokens;
+        t0 += batches[i]->n_tokens;
     }
 
-    return !(abort_callback && abort_callback(abort_callback_data));
+    return true;
 }
 
 //  500 -> 00:05.000
@@ -3014,13 +4179,107 @@ static std::string to_timestamp(int64_t t, bool comma = false) {
     return std::string(buf);
 }
 
-#define SIN_COS_N_COUNT WHISPER_N_FFT
 namespace {
+// FFT plan for real input of even size n
+// the n real samples are packed into n/2 complex values (even samples as the real part, odd as the
+// imaginary part), transformed with a complex FFT of n/2 points and separated by a split step
+// the complex FFT is an iterative Stockham transform: no recursion, no bit reversal and no scratch
+// space in the input - each stage reads one buffer and writes the other in natural order
+// n/2 is factored into radix 4, 2, 5 and 3 stages (400 -> 200 = 4*2*5*5); any other prime factor
+// uses a naive DFT butterfly
+struct whisper_fft_plan {
+    struct stage {
+        int radix = 0;
+        int m     = 0; // length of the sub-transforms after this stage
+        int s     = 0; // stride between the elements of a sub-transform
+
+        // twiddles exp(-2*pi*i*p*j/(m*radix)), [p][j]
+        std::vector<float> w_re;
+        std::vector<float> w_im;
+
+        // exp(-2*pi*i*j*k/radix) for the naive butterfly
+        std::vector<float> dft_re;
+        std::vector<float> dft_im;
+    };
+
+    int n = 0;
+    std::vector<stage> stages;
+
+    // exp(-2*pi*i*k/n), k <= n/2, for the split step
+    std::vector<float> split_re;
+    std::vector<float> split_im;
+
+    void init(int n_fft) {
+        n = n_fft;
+        stages.clear();
+
+        const int n_half = n/2;
+
+        int m = n_half;
+        int s = 1;
+        while (m > 1) {
+            int radix = m;
+            for (int r : { 4, 2, 5, 3 }) {
+                if (m % r == 0) {
+                    radix = r;
+                    break;
+                }
+            }
+            if (radix == m) {
+                for (int r = 7; r*r <= m; r += 2) {
+                    if (m % r == 0) {
+                        radix = r;
+                        break;
+                    }
+                }
+            }
+
+            stage st;
+            st.radix = radix;
+            st.m     = m/radix;
+            st.s     = s;
+
+            st.w_re.resize(st.m*radix);
+            st.w_im.resize(st.m*radix);
+            for (int p = 0; p < st.m; p++) {
+                for (int j = 0; j < radix; j++) {
+                    const double theta = (2*M_PI*p*j)/m;
+                    st.w_re[p*radix + j] =  cos(theta);
+                    st.w_im[p*radix + j] = -sin(theta);
+                }
+            }
+
+            if (radix > 5) {
+                st.dft_re.resize(radix*radix);
+                st.dft_im.resize(radix*radix);
+                for (int j = 0; j < radix; j++) {
+                    for (int k = 0; k < radix; k++) {
+                        const double theta = (2*M_PI*((j*k) % radix))/radix;
+                        st.dft_re[j*radix + k] =  cos(theta);
+                        st.dft_im[j*radix + k] = -sin(theta);
+                    }
+                }
+            }
+
+            stages.push_back(std::move(st));
+
+            m /= radix;
+            s *= radix;
+        }
+
+        split_re.resize(n_half + 1);
+        split_im.resize(n_half + 1);
+        for (int k = 0; k <= n_half; k++) {
+            const double theta = (2*M_PI*k)/n;
+            split_re[k] =  cos(theta);
+            split_im[k] = -sin(theta);
+        }
+    }
+};
+
 struct whisper_global_cache {
-    // In FFT, we frequently use sine and cosine operations with the same values.
-    // We can use precalculated values to speed up the process.
-    float sin_vals[SIN_COS_N_COUNT];
-    float cos_vals[SIN_COS_N_COUNT];
+    // FFT plan for the mel frames, computed once
+    whisper_fft_plan fft_plan;
 
     // Hann window (Use cosf to eliminate difference)
     // ref: https://pytorch.org/docs/stable/generated/torch.hann_window.html
@@ -3028,18 +4287,10 @@ struct whisper_global_cache {
     float hann_window[WHISPER_N_FFT];
 
     whisper_global_cache() {
-        fill_sin_cos_table();
+        fft_plan.init(WHISPER_N_FFT);
         fill_hann_window(sizeof(hann_window)/sizeof(hann_window[0]), true, hann_window);
     }
 
-    void fill_sin_cos_table() {
-        for (int i = 0; i < SIN_COS_N_COUNT; i++) {
-            double theta = (2 * M_PI * i) / SIN_COS_N_COUNT;
-            sin_vals[i] = sinf(theta);
-            cos_vals[i] = cosf(theta);
-        }
-    }
-
     void fill_hann_window(int length, bool periodic, float * output) {
         int offset = -1;
         if (periodic) {
@@ -3052,89 +4303,292 @@ struct whisper_global_cache {
 } global_cache;
 }
 
-// naive Discrete Fourier Transform
-// input is real-valued
-// output is complex-valued
-static void dft(const float* in, int N, float* out) {
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
+// one Stockham stage: every sub-transform p of the stage combines radix elements of x with a
+// butterfly, multiplies output j by the twiddle of (p, j) and stores it at radix*p + j
+// the q loop is contiguous in both buffers, so it vectorizes once the stride grows
+static void fft_stage(const whisper_fft_plan::stage & st,
+                      const float * x_re, const float * x_im, float * y_re, float * y_im) {
+    const int r = st.radix;
+    const int m = st.m;
+    const int s = st.s;
 
-    for (int k = 0; k < N; k++) {
-        float re = 0;
-        float im = 0;
+    const float * w_re = st.w_re.data();
+    const float * w_im = st.w_im.data();
 
-        for (int n = 0; n < N; n++) {
-            int idx = (k * n * sin_cos_step) % (SIN_COS_N_COUNT); // t = 2*M_PI*k*n/N
-            re += in[n]*global_cache.cos_vals[idx]; // cos(t)
-            im -= in[n]*global_cache.sin_vals[idx]; // sin(t)
-        }
+    // y = (a*w)
+    #define FFT_STORE(j, a_re, a_im) { \
+        const float wr = w_re[p*r + (j)]; \
+        const float wi = w_im[p*r + (j)]; \
+        y_re[q + s*(r*p + (j))] = (a_re)*wr - (a_im)*wi; \
+        y_im[q + s*(r*p + (j))] = (a_re)*wi + (a_im)*wr; \
+    }
+
+    switch (r) {
+        case 2:
+            for (int p = 0; p < m; p++) {
+                for (int q = 0; q < s; q++) {
+                    const float a0_re = x_re[q + s*(p + 0*m)], a0_im = x_im[q + s*(p + 0*m)];
+                    const float a1_re = x_re[q + s*(p + 1*m)], a1_im = x_im[q + s*(p + 1*m)];
+
+                    FFT_STORE(0, a0_re + a1_re, a0_im + a1_im);
+                    FFT_STORE(1, a0_re - a1_re, a0_im - a1_im);
+                }
+            }
+            break;
+        case 3:
+            {
+                const float c = -0.5f;
+                const float d = sin(2*M_PI/3);
+
+                for (int p = 0; p < m; p++) {
+                    for (int q = 0; q < s; q++) {
+                        const float a0_re = x_re[q + s*(p + 0*m)], a0_im = x_im[q + s*(p + 0*m)];
+                        const float a1_re = x_re[q + s*(p + 1*m)], a1_im = x_im[q + s*(p + 1*m)];
+                        const float a2_re = x_re[q + s*(p + 2*m)], a2_im = x_im[q + s*(p + 2*m)];
+
+                        const float t1_re = a1_re + a2_re, t1_im = a1_im + a2_im;
+                        const float t2_re = a1_re - a2_re, t2_im = a1_im - a2_im;
 
-        out[k*2 + 0] = re;
-        out[k*2 + 1] = im;
+                        const float b_re = a0_re + c*t1_re;
+                        const float b_im = a0_im + c*t1_im;
+
+                        // -i*d*t2 and +i*d*t2
+                        FFT_STORE(0, a0_re + t1_re, a0_im + t1_im);
+                        FFT_STORE(1, b_re + d*t2_im, b_im - d*t2_re);
+                        FFT_STORE(2, b_re - d*t2_im, b_im + d*t2_re);
+                    }
+                }
+            } break;
+        case 4:
+            for (int p = 0; p < m; p++) {
+                for (int q = 0; q < s; q++) {
+                    const float a0_re = x_re[q + s*(p + 0*m)], a0_im = x_im[q + s*(p + 0*m)];
+                    const float a1_re = x_re[q + s*(p + 1*m)], a1_im = x_im[q + s*(p + 1*m)];
+                    const float a2_re = x_re[q + s*(p + 2*m)], a2_im = x_im[q + s*(p + 2*m)];
+                    const float a3_re = x_re[q + s*(p + 3*m)], a3_im = x_im[q + s*(p + 3*m)];
+
+                    const float t0_re = a0_re + a2_re, t0_im = a0_im + a2_im;
+                    const float t1_re = a0_re - a2_re, t1_im = a0_im - a2_im;
+                    const float t2_re = a1_re + a3_re, t2_im = a1_im + a3_im;
+                    const float t3_re = a1_re - a3_re, t3_im = a1_im - a3_im;
+
+                    // y1 = t1 - i*t3, y3 = t1 + i*t3
+                    FFT_STORE(0, t0_re + t2_re, t0_im + t2_im);
+                    FFT_STORE(1, t1_re + t3_im, t1_im - t3_re);
+                    FFT_STORE(2, t0_re - t2_re, t0_im - t2_im);
+                    FFT_STORE(3, t1_re - t3_im, t1_im + t3_re);
+                }
+            }
+            break;
+        case 5:
+            {
+                const float c1 = cos(2*M_PI/5);
+                const float c2 = cos(4*M_PI/5);
+                const float d1 = sin(2*M_PI/5);
+                const float d2 = sin(4*M_PI/5);
+
+                for (int p = 0; p < m; p++) {
+                    for (int q = 0; q < s; q++) {
+                        const float a0_re = x_re[q + s*(p + 0*m)], a0_im = x_im[q + s*(p + 0*m)];
+                        const float a1_re = x_re[q + s*(p + 1*m)], a1_im = x_im[q + s*(p + 1*m)];
+                        const float a2_re = x_re[q + s*(p + 2*m)], a2_im = x_im[q + s*(p + 2*m)];
+                        const float a3_re = x_re[q + s*(p + 3*m)], a3_im = x_im[q + s*(p + 3*m)];
+                        const float a4_re = x_re[q + s*(p + 4*m)], a4_im = x_im[q + s*(p + 4*m)];
+
+                        const float t1_re = a1_re + a4_re, t1_im = a1_im + a4_im;
+                        const float t2_re = a2_re + a3_re, t2_im = a2_im + a3_im;
+                        const float t3_re = a1_re - a4_re, t3_im = a1_im - a4_im;
+                        const float t4_re = a2_re - a3_re, t4_im = a2_im - a3_im;
+
+                        const float b1_re = a0_re + c1*t1_re + c2*t2_re;
+                        const float b1_im = a0_im + c1*t1_im + c2*t2_im;
+                        const float b2_re = a0_re + c2*t1_re + c1*t2_re;
+                        const float b2_im = a0_im + c2*t1_im + c1*t2_im;
+
+                        const float e1_re = d1*t3_re + d2*t4_re;
+                        const float e1_im = d1*t3_im + d2*t4_im;
+                        const float e2_re = d2*t3_re - d1*t4_re;
+                        const float e2_im = d2*t3_im - d1*t4_im;
+
+                        // y1 = b1 - i*e1, y4 = b1 + i*e1, y2 = b2 - i*e2, y3 = b2 + i*e2
+                        FFT_STORE(0, a0_re + t1_re + t2_re, a0_im + t1_im + t2_im);
+                        FFT_STORE(1, b1_re + e1_im, b1_im - e1_re);
+                        FFT_STORE(2, b2_re + e2_im, b2_im - e2_re);
+                        FFT_STORE(3, b2_re - e2_im, b2_im + e2_re);
+                        FFT_STORE(4, b1_re - e1_im, b1_im + e1_re);
+                    }
+                }
+            } break;
+        default:
+            for (int p = 0; p < m; p++) {
+                for (int q = 0; q < s; q++) {
+                    for (int j = 0; j < r; j++) {
+                        float sum_re = 0.0f;
+                        float sum_im = 0.0f;
+                        for (int k = 0; k < r; k++) {
+                            const float a_re = x_re[q + s*(p + k*m)];
+                            const float a_im = x_im[q + s*(p + k*m)];
+                            const float c_re = st.dft_re[j*r + k];
+                            const float c_im = st.dft_im[j*r + k];
+                            sum_re += a_re*c_re - a_im*c_im;
+                            sum_im += a_re*c_im + a_im*c_re;
+                        }
+                        FFT_STORE(j, sum_re, sum_im);
+                    }
+                }
+            }
+            break;
     }
+
+    #undef FFT_STORE
 }
 
-// Cooley-Tukey FFT
-// poor man's implementation - use something better
-// input is real-valued
-// output is complex-valued
-static void fft(float* in, int N, float* out) {
-    if (N == 1) {
-        out[0] = in[0];
-        out[1] = 0;
-        return;
-    }
+// FFT of n = plan.n real values
+// output: bins 0..n/2, complex-valued, interleaved (n + 2 values)
+// work: scratch space for 2*n values
+static void fft(const whisper_fft_plan & plan, const float * in, float * out, float * work) {
+    const int n_half = plan.n/2;
 
-    const int half_N = N / 2;
-    if (N - half_N*2 == 1) {
-        dft(in, N, out);
-        return;
-    }
+    float * x_re = work;
+    float * x_im = work + 1*n_half;
+    float * y_re = work + 2*n_half;
+    float * y_im = work + 3*n_half;
 
-    float* even = in + N;
-    for (int i = 0; i < half_N; ++i) {
-        even[i]= in[2*i];
+    for (int i = 0; i < n_half; i++) {
+        x_re[i] = in[2*i + 0];
+        x_im[i] = in[2*i + 1];
     }
-    float* even_fft = out + 2 * N;
-    fft(even, half_N, even_fft);
 
-    float* odd = even;
-    for (int i = 0; i < half_N; ++i) {
-        odd[i] = in[2*i + 1];
+    for (const auto & st : plan.stages) {
+        fft_stage(st, x_re, x_im, y_re, y_im);
+        std::swap(x_re, y_re);
+        std::swap(x_im, y_im);
     }
-    float* odd_fft = even_fft + N;
-    fft(odd, half_N, odd_fft);
 
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
-    for (int k = 0; k < half_N; k++) {
-        int idx = k * sin_cos_step; // t = 2*M_PI*k/N
-        float re = global_cache.cos_vals[idx]; // cos(t)
-        float im = -global_cache.sin_vals[idx]; // sin(t)
+    // split the spectra of the even (E) and odd (O) samples:
+    // E[k] = (Z[k] + conj(Z[n/2 - k]))/2, O[k] = -i*(Z[k] - conj(Z[n/2 - k]))/2, X[k] = E[k] + exp(-2*pi*i*k/n)*O[k]
+    for (int k = 0; k <= n_half; k++) {
+        const int k0 = k % n_half;
+        const int k1 = (n_half - k) % n_half;
 
-        float re_odd = odd_fft[2*k + 0];
-        float im_odd = odd_fft[2*k + 1];
+        const float z0_re = x_re[k0], z0_im = x_im[k0];
+        const float z1_re = x_re[k1], z1_im = x_im[k1];
 
-        out[2*k + 0] = even_fft[2*k + 0] + re*re_odd - im*im_odd;
-        out[2*k + 1] = even_fft[2*k + 1] + re*im_odd + im*re_odd;
+        const float e_re = 0.5f*(z0_re + z1_re);
+        const float e_im = 0.5f*(z0_im - z1_im);
+        const float o_re = 0.5f*(z0_im + z1_im);
+        const float o_im = 0.5f*(z1_re - z0_re);
 
-        out[2*(k + half_N) + 0] = even_fft[2*k + 0] - re*re_odd + im*im_odd;
-        out[2*(k + half_N) + 1] = even_fft[2*k + 1] - re*im_odd - im*re_odd;
+        const float w_re = plan.split_re[k];
+        const float w_im = plan.split_im[k];
+
+        out[2*k + 0] = e_re + w_re*o_re - w_im*o_im;
+        out[2*k + 1] = e_im + w_re*o_im + w_im*o_re;
     }
 }
 
-static void log_mel_spectrogram_worker_thread(int ith, const float * hann, const std::vector<float> & samples,
-                                              int n_samples, int frame_size, int frame_step, int n_threads,
-                                              const whisper_filters & filters, whisper_mel & mel) {
-    std::vector<float> fft_in(frame_size * 2, 0.0);
-    std::vector<float> fft_out(frame_size * 2 * 2 * 2);
+// log10 of a positive normal float
+// the exponent comes from the bits, the log of the mantissa (scaled to [sqrt(1/2), sqrt(2))) from the
+// series 2*atanh(z), z = (m - 1)/(m + 1), |z| < 0.172 - accurate to a few ulp, without branches or
+// calls, so a loop over it vectorizes
+static inline float log10_fast(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    int e = int((bits >> 23) & 0xff) - 127;
+    bits = (bits & 0x007fffff) | 0x3f800000;
+
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+
+    const bool above = m > 1.41421356f;
+    m = above ? 0.5f*m : m;
+    e = above ? e + 1 : e;
+
+    const float z  = (m - 1.0f)/(m + 1.0f);
+    const float z2 = z*z;
+
+    const float ln_m = 2.0f*z*(1.0f + z2*(1.0f/3.0f + z2*(1.0f/5.0f + z2*(1.0f/7.0f + z2*(1.0f/9.0f)))));
 
-    int n_fft = filters.n_fft;
-    int i = ith;
+    return (float(e)*0.693147181f + ln_m)*0.434294482f;
+}
+
+// log mel energies of one Hann-windowed frame of WHISPER_N_FFT samples, unnormalized
+// fft_out needs 4*frame_size values: the spectrum and the FFT work space
+// writes filters.n_mel values to dst with the given stride
+static void log_mel_frame(const float * fft_in, float * fft_out, int frame_size,
+                          const whisper_filters & filters, float * dst, int dst_stride) {
+    const int n_fft = filters.n_fft;
 
     // make sure n_fft == 1 + (WHISPER_N_FFT / 2), bin_0 to bin_nyquist
     assert(n_fft == 1 + (frame_size / 2));
+    assert(frame_size == global_cache.fft_plan.n);
+
+    // FFT
+    fft(global_cache.fft_plan, fft_in, fft_out, fft_out + 2*frame_size);
+
+    // Calculate modulus^2 of complex numbers
+    // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
+    float * power = fft_out + 2*frame_size;
+    for (int j = 0; j < n_fft; j++) {
+        power[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
+    }
+
+    // mel spectrogram - only the nonzero span of each filter
+    float * sums = fft_out;
+    for (int j = 0; j < filters.n_mel; j++) {
+        const float * p = power + filters.start[j];
+        const float * w = filters.weights.data() + filters.offset[j];
+        const int     n = filters.len[j];
+
+        float sum = 0.0f;
+        for (int k = 0; k < n; k++) {
+            sum += p[k] * w[k];
+        }
+        sums[j] = std::max(sum, 1e-10f);
+    }
+
+    for (int j = 0; j < filters.n_mel; j++) {
+        sums[j] = log10_fast(sums[j]);
+    }
+
+    for (int j = 0; j < filters.n_mel; j++) {
+        dst[j * dst_stride] = sums[j];
+    }
+}
+
+// one input of log_mel_spectrogram_batch()
+struct whisper_mel_task {
+    const float * samples   = nullptr;
+    int           n_samples = 0;
+    whisper_mel * mel       = nullptr;
+
+    std::vector<float> samples_padded;
+    int n_fft_frames = 0; // frames that see audio, the rest are zero padding
+};
+
+// frames per unit of work of the pool
+#define WHISPER_MEL_CHUNK 32
+
+static void log_mel_spectrogram_frames(const whisper_mel_task & task, int i0, int i1,
+                                       const whisper_filters & filters, whisper_mel_scratch & scratch) {
+    const int frame_size = WHISPER_N_FFT;
+    const int frame_step = WHISPER_HOP_LENGTH;
+
+    const float * hann    = global_cache.hann_window;
+    const float * samples = task.samples_padded.data();
+
+    // padded length that holds audio
+    const int n_samples = task.n_samples + frame_size/2;
+
+    whisper_mel & mel = *task.mel;
+
+    std::vector<float> & fft_in = scratch.fft_in;
+
+    int i = i0;
 
     // calculate FFT only when fft_in are not all zero
-    for (; i < std::min(n_samples / frame_step + 1, mel.n_len); i += n_threads) {
+    for (; i < std::min(i1, task.n_fft_frames); i++) {
         const int offset = i * frame_step;
 
         // apply Hann window (~10% faster)
@@ -3147,39 +4601,12 @@ static void log_mel_spectrogram_worker_thread(int ith, const float * hann, const
             std::fill(fft_in.begin() + (n_samples - offset), fft_in.end(), 0.0);
         }
 
-        // FFT
-        fft(fft_in.data(), frame_size, fft_out.data());
-
-        // Calculate modulus^2 of complex numbers
-        // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
-        for (int j = 0; j < n_fft; j++) {
-            fft_out[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
-        }
-
-        // mel spectrogram
-        for (int j = 0; j < mel.n_mel; j++) {
-            double sum = 0.0;
-            // unroll loop (suggested by GH user @lunixbochs)
-            int k = 0;
-            for (k = 0; k < n_fft - 3; k += 4) {
-                sum +=
-                        fft_out[k + 0] * filters.data[j * n_fft + k + 0] +
-                        fft_out[k + 1] * filters.data[j * n_fft + k + 1] +
-                        fft_out[k + 2] * filters.data[j * n_fft + k + 2] +
-                        fft_out[k + 3] * filters.data[j * n_fft + k + 3];
-            }
-            // handle n_fft remainder
-            for (; k < n_fft; k++) {
-                sum += fft_out[k] * filters.data[j * n_fft + k];
-            }
-            sum = log10(std::max(sum, 1e-10));
-            mel.data[j * mel.n_len + i] = sum;
-        }
+        log_mel_frame(fft_in.data(), scratch.fft_out.data(), frame_size, filters, mel.data.data() + i, mel.n_len);
     }
 
     // Otherwise fft_out are all zero
     double sum = log10(1e-10);
-    for (; i < mel.n_len; i += n_threads) {
+    for (; i < i1; i++) {
         for (int j = 0; j < mel.n_mel; j++) {
             mel.data[j * mel.n_len + i] = sum;
         }
@@ -3187,81 +4614,112 @@ static void log_mel_spectrogram_worker_thread(int ith, const float * hann, const
 }
 
 // ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L110-L157
-static bool log_mel_spectrogram(
-              whisper_state & wstate,
-              const float * samples,
-              const int   n_samples,
-              const int   /*sample_rate*/,
-              const int   frame_size,
-              const int   frame_step,
-              const int   n_mel,
-              const int   n_threads,
-              const whisper_filters & filters,
-              const bool   debug,
-              whisper_mel & mel) {
-    const int64_t t_start_us = ggml_time_us();
-
-    // Hann window
-    WHISPER_ASSERT(frame_size == WHISPER_N_FFT && "Unsupported frame_size");
-    const float * hann = global_cache.hann_window;
+// the frames of all the tasks are computed together on the pool, then every spectrogram is
+// clamped and normalized on its own
+static void log_mel_spectrogram_batch(
+        whisper_mel_pool & pool,
+        whisper_mel_task * tasks,
+                     int   n_tasks,
+                     int   n_threads,
+ const whisper_filters & filters) {
+    const int frame_size = WHISPER_N_FFT;
+    const int frame_step = WHISPER_HOP_LENGTH;
 
     // Calculate the length of padding
     int64_t stage_1_pad = WHISPER_SAMPLE_RATE * 30;
     int64_t stage_2_pad = frame_size / 2;
 
-    // Initialize a vector and copy data from C array to it.
-    std::vector<float> samples_padded;
-    samples_padded.resize(n_samples + stage_1_pad + stage_2_pad * 2);
-    std::copy(samples, samples + n_samples, samples_padded.begin() + stage_2_pad);
+    // units of work: (task, first frame)
+    std::vector<std::pair<int, int>> chunks;
 
-    // pad 30 seconds of zeros at the end of audio (480,000 samples) + reflective pad 200 samples at the end of audio
-    std::fill(samples_padded.begin() + n_samples + stage_2_pad, samples_padded.begin() + n_samples + stage_1_pad + 2 * stage_2_pad, 0);
+    for (int t = 0; t < n_tasks; t++) {
+        whisper_mel_task & task = tasks[t];
+        whisper_mel & mel = *task.mel;
 
-    // reflective pad 200 samples at the beginning of audio
-    std::reverse_copy(samples + 1, samples + 1 + stage_2_pad, samples_padded.begin());
+        const float * samples = task.samples;
+        const int   n_samples = task.n_samples;
 
-    mel.n_mel     = n_mel;
-    // https://github.com/pytorch/pytorch/blob/main/aten/src/ATen/native/SpectralOps.cpp#L936
-    // Calculate number of frames + remove the last frame
-    mel.n_len     = (samples_padded.size() - frame_size) / frame_step;
-    // Calculate semi-padded sample length to ensure compatibility
-    mel.n_len_org = 1 + (n_samples + stage_2_pad - frame_size) / frame_step;
-    mel.data.resize(mel.n_mel * mel.n_len);
+        // Initialize a vector and copy data from C array to it.
+        // the 30 seconds of zeros at the end are not stored - their frames are constant
+        std::vector<float> & samples_padded = task.samples_padded;
+        samples_padded.assign(n_samples + stage_2_pad * 2, 0.0f);
+        std::copy(samples, samples + n_samples, samples_padded.begin() + stage_2_pad);
 
-    {
-        std::vector<std::thread> workers(n_threads - 1);
-        for (int iw = 0; iw < n_threads - 1; ++iw) {
-            workers[iw] = std::thread(
-                    log_mel_spectrogram_worker_thread, iw + 1, hann, std::cref(samples_padded),
-                    n_samples + stage_2_pad, frame_size, frame_step, n_threads,
-                    std::cref(filters), std::ref(mel));
-        }
+        // reflective pad 200 samples at the beginning of audio
+        std::reverse_copy(samples + 1, samples + 1 + stage_2_pad, samples_padded.begin());
+
+        mel.n_mel     = filters.n_mel;
+        // https://github.com/pytorch/pytorch/blob/main/aten/src/ATen/native/SpectralOps.cpp#L936
+        // Calculate number of frames + remove the last frame
+        mel.n_len     = (n_samples + stage_1_pad + stage_2_pad * 2 - frame_size) / frame_step;
+        // Calculate semi-padded sample length to ensure compatibility
+        mel.n_len_org = 1 + (n_samples + stage_2_pad - frame_size) / frame_step;
+        mel.data.resize(mel.n_mel * mel.n_len);
 
-        // main thread
-        log_mel_spectrogram_worker_thread(0, hann, samples_padded, n_samples + stage_2_pad, frame_size, frame_step, n_threads, filters, mel);
+        task.n_fft_frames = std::min<int>((n_samples + stage_2_pad) / frame_step + 1, mel.n_len);
 
-        for (int iw = 0; iw < n_threads - 1; ++iw) {
-            workers[iw].join();
+        for (int i = 0; i < mel.n_len; i += WHISPER_MEL_CHUNK) {
+            chunks.emplace_back(t, i);
         }
     }
 
-    // clamping and normalization
-    double mmax = -1e20;
-    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
-        if (mel.data[i] > mmax) {
-            mmax = mel.data[i];
+    pool.parallel_for(n_threads, chunks.size(), [&](int c, whisper_mel_scratch & scratch) {
+        const whisper_mel_task & task = tasks[chunks[c].first];
+
+        const int i0 = chunks[c].second;
+        const int i1 = std::min(i0 + WHISPER_MEL_CHUNK, task.mel->n_len);
+
+        log_mel_spectrogram_frames(task, i0, i1, filters, scratch);
+    });
+
+    pool.parallel_for(n_threads, n_tasks, [&](int t, whisper_mel_scratch & /*scratch*/) {
+        whisper_mel & mel = *tasks[t].mel;
+
+        // clamping and normalization
+        double mmax = -1e20;
+        for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
+            if (mel.data[i] > mmax) {
+                mmax = mel.data[i];
+            }
         }
-    }
 
-    mmax -= 8.0;
+        mmax -= 8.0;
+
+        for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
+            if (mel.data[i] < mmax) {
+                mel.data[i] = mmax;
+            }
 
-    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
-        if (mel.data[i] < mmax) {
-            mel.data[i] = mmax;
+            mel.data[i] = (mel.data[i] + 4.0)/4.0;
         }
+    });
+}
 
-        mel.data[i] = (mel.data[i] + 4.0)/4.0;
-    }
+static bool log_mel_spectrogram(
+              whisper_mel_pool & pool,
+              whisper_state & wstate,
+              const float * samples,
+              const int   n_samples,
+              const int   /*sample_rate*/,
+              const int   frame_size,
+              const int   frame_step,
+              const int   n_mel,
+              const int   n_threads,
+              const whisper_filters & filters,
+              const bool   debug,
+              whisper_mel & mel) {
+    const int64_t t_start_us = ggml_time_us();
+
+    WHISPER_ASSERT(frame_size == WHISPER_N_FFT && "Unsupported frame_size");
+    WHISPER_ASSERT(frame_step == WHISPER_HOP_LENGTH && "Unsupported frame_step");
+    WHISPER_ASSERT(n_mel == filters.n_mel && "Unsupported n_mel");
+
+    whisper_mel_task task;
+    task.samples   = samples;
+    task.n_samples = n_samples;
+    task.mel       = &mel;
+
+    log_mel_spectrogram_batch(pool, &task, 1, n_threads, filters);
 
     wstate.t_mel_us += ggml_time_us() - t_start_us;
 
@@ -3279,6 +4737,72 @@ static bool log_mel_spectrogram(
     return true;
 }
 
+// streaming log mel spectrogram
+//
+// frame i covers the samples [i*hop - n_fft/2, i*hop + n_fft/2) of the stream, and it is complete
+// once all of them have been pushed - from then on it does not change and is computed only once
+// the frames that reach past the end of the audio are recomputed with zero padding for every
+// window, exactly as log_mel_spectrogram() pads the end of its input
+//
+// the first frames of the stream use the same reflective padding as log_mel_spectrogram(), so a
+// window that starts at the beginning of the stream gives the same spectrogram as the batch path
+// after whisper_mel_stream_keep() the first frames of the window see the real preceding audio instead
+struct whisper_mel_stream {
+    const whisper_filters * filters = nullptr;
+
+    // the first samples of the stream, for the reflective padding
+    std::vector<float> head;
+
+    // samples still needed by frames that are not complete yet: [pcm_offset, n_samples)
+    std::vector<float> pcm;
+    int64_t pcm_offset = 0;
+    int64_t n_samples  = 0;
+
+    // unnormalized log mel energies of the complete frames in the window, frame-major: [frame_offset, n_frames)
+    std::vector<float> frames;
+    int64_t frame_offset = 0;
+    int64_t n_frames     = 0;
+
+    // (frame, max over the mel bands) with decreasing maxima, for the clamping of the window
+    std::deque<std::pair<int64_t, float>> frame_max;
+
+    std::vector<float> fft_in;
+    std::vector<float> fft_out;
+    std::vector<float> tail;
+
+    int64_t t_mel_us = 0;
+};
+
+// sample k of the stream, with the reflective padding before the start and zeros past the end
+static float whisper_mel_stream_sample(const whisper_mel_stream & stream, int64_t k) {
+    if (k < 0) {
+        k = -k;
+        if (k >= stream.n_samples) {
+            return 0.0f;
+        }
+        return stream.head[k];
+    }
+
+    if (k >= stream.n_samples) {
+        return 0.0f;
+    }
+
+    return stream.pcm[k - stream.pcm_offset];
+}
+
+static void whisper_mel_stream_frame(whisper_mel_stream & stream, int64_t i, float * dst, int dst_stride) {
+    const int frame_size = WHISPER_N_FFT;
+    const int64_t offset = i*WHISPER_HOP_LENGTH - frame_size/2;
+
+    const float * hann = global_cache.hann_window;
+
+    for (int j = 0; j < frame_size; j++) {
+        stream.fft_in[j] = hann[j] * whisper_mel_stream_sample(stream, offset + j);
+    }
+
+    log_mel_frame(stream.fft_in.data(), stream.fft_out.data(), frame_size, *stream.filters, dst, dst_stride);
+}
+
 // split text into tokens
 //
 // ref: https://github.com/openai/gpt-2/blob/a74da5d99abaaba920de8131d64da2862a8f213b/src/encoder.py#L53
@@ -3637,6 +5161,9 @@ struct whisper_context_params whisper_context_default_params() {
             /*.heads            =*/ NULL,
         },
         /*.dtw_mem_size         =*/ 1024*1024*128,
+
+        /*.encoder_n_layer      =*/ 0,
+        /*.encoder_layer_step   =*/ 1,
     };
     return result;
 }
@@ -3734,6 +5261,9 @@ struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_
     WHISPER_LOG_INFO("%s: flash attn = %d\n", __func__, params.flash_attn);
     WHISPER_LOG_INFO("%s: gpu_device = %d\n", __func__, params.gpu_device);
     WHISPER_LOG_INFO("%s: dtw        = %d\n", __func__, params.dtw_token_timestamps);
+    if (params.encoder_n_layer > 0 || params.encoder_layer_step > 1) {
+        WHISPER_LOG_INFO("%s: enc layers = %d, step %d\n", __func__, params.encoder_n_layer, params.encoder_layer_step);
+    }
     WHISPER_LOG_INFO("%s: devices    = %zu\n", __func__, ggml_backend_dev_count());
     WHISPER_LOG_INFO("%s: backends   = %zu\n", __func__, ggml_backend_reg_count());
 
@@ -3826,6 +5356,7 @@ void whisper_free_state(struct whisper_state * state) {
         whisper_kv_cache_free(state->kv_self);
         whisper_kv_cache_free(state->kv_cross);
         whisper_kv_cache_free(state->kv_pad);
+        whisper_kv_cache_free(state->kv_pad_batch);
 
 #ifdef WHISPER_USE_COREML
         if (state->ctx_coreml != nullptr) {
@@ -3847,6 +5378,7 @@ void whisper_free_state(struct whisper_state * state) {
         ggml_backend_sched_free(state->sched_encode.sched);
         ggml_backend_sched_free(state->sched_cross.sched);
         ggml_backend_sched_free(state->sched_decode.sched);
+        ggml_backend_sched_free(state->sched_batch.sched);
 
         for (auto & backend : state->backends) {
             ggml_backend_free(backend);
@@ -3876,6 +5408,12 @@ void whisper_free(struct whisper_context * ctx) {
 
         whisper_free_state(ctx->state);
 
+        ggml_backend_sched_free(ctx->decode_queue.sched.sched);
+
+        for (auto & backend : ctx->decode_queue.backends) {
+            ggml_backend_free(backend);
+        }
+
         delete ctx;
     }
 }
@@ -3893,7 +5431,15 @@ void whisper_free_params(struct whisper_full_params * params) {
 }
 
 int whisper_pcm_to_mel_with_state(struct whisper_context * ctx, struct whisper_state * state, const float * samples, int n_samples, int n_threads) {
-    if (!log_mel_spectrogram(*state, samples, n_samples, WHISPER_SAMPLE_RATE, WHISPER_N_FFT, WHISPER_HOP_LENGTH, ctx->model.filters.n_mel, n_threads, ctx->model.filters, false, state->mel)) {
+    // the reflective padding reads WHISPER_N_FFT/2 samples after the first one
+    if (n_samples <= WHISPER_N_FFT/2) {
+        WHISPER_LOG_ERROR("%s: input is too short: %d samples\n", __func__, n_samples);
+        return -1;
+    }
+
+    state->mel_gen++;
+
+    if (!log_mel_spectrogram(ctx->mel_pool, *state, samples, n_samples, WHISPER_SAMPLE_RATE, WHISPER_N_FFT, WHISPER_HOP_LENGTH, ctx->model.filters.n_mel, n_threads, ctx->model.filters, false, state->mel)) {
         WHISPER_LOG_ERROR("%s: failed to compute mel spectrogram\n", __func__);
         return -1;
     }
@@ -3905,6 +5451,39 @@ int whisper_pcm_to_mel(struct whisper_context * ctx, const float * samples, int
     return whisper_pcm_to_mel_with_state(ctx, ctx->state, samples, n_samples, n_threads);
 }
 
+int whisper_pcm_to_mel_batch(
+        struct whisper_context * ctx,
+         struct whisper_state ** states,
+                  const float ** samples,
+                     const int * n_samples,
+                           int   n_batch,
+                           int   n_threads) {
+    const int64_t t_start_us = ggml_time_us();
+
+    std::vector<whisper_mel_task> tasks(n_batch);
+    for (int i = 0; i < n_batch; i++) {
+        if (n_samples[i] <= WHISPER_N_FFT/2) {
+            WHISPER_LOG_ERROR("%s: input %d is too short: %d samples\n", __func__, i, n_samples[i]);
+            return -1;
+        }
+
+        tasks[i].samples   = samples[i];
+        tasks[i].n_samples = n_samples[i];
+        tasks[i].mel       = &states[i]->mel;
+
+        states[i]->mel_gen++;
+    }
+
+    log_mel_spectrogram_batch(ctx->mel_pool, tasks.data(), n_batch, n_threads, ctx->model.filters);
+
+    const int64_t t_mel_us = ggml_time_us() - t_start_us;
+    for (int i = 0; i < n_batch; i++) {
+        states[i]->t_mel_us += t_mel_us;
+    }
+
+    return 0;
+}
+
 int whisper_set_mel_with_state(
         struct whisper_context * ctx,
           struct whisper_state * state,
@@ -3916,6 +5495,8 @@ int whisper_set_mel_with_state(
         return -1;
     }
 
+    state->mel_gen++;
+
     state->mel.n_len     = n_len;
     state->mel.n_len_org = n_len;
     state->mel.n_mel     = n_mel;
@@ -3934,6 +5515,189 @@ int whisper_set_mel(
     return whisper_set_mel_with_state(ctx, ctx->state, data, n_len, n_mel);
 }
 
+struct whisper_mel_stream * whisper_mel_stream_init(struct whisper_context * ctx) {
+    whisper_mel_stream * stream = new whisper_mel_stream;
+
+    stream->filters = &ctx->model.filters;
+
+    stream->fft_in.resize(WHISPER_N_FFT, 0.0f);
+    stream->fft_out.resize(WHISPER_N_FFT * 4);
+
+    return stream;
+}
+
+void whisper_mel_stream_free(struct whisper_mel_stream * stream) {
+    delete stream;
+}
+
+void whisper_mel_stream_reset(struct whisper_mel_stream * stream) {
+    stream->head.clear();
+    stream->pcm.clear();
+    stream->pcm_offset = 0;
+    stream->n_samples  = 0;
+
+    stream->frames.clear();
+    stream->frame_offset = 0;
+    stream->n_frames     = 0;
+
+    stream->frame_max.clear();
+}
+
+int whisper_mel_stream_push(struct whisper_mel_stream * stream, const float * samples, int n_samples) {
+    if (n_samples <= 0) {
+        return 0;
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    const int n_mel   = stream->filters->n_mel;
+    const int n_pad   = WHISPER_N_FFT/2;
+    const int n_head  = n_pad + 1;
+
+    if ((int) stream->head.size() < n_head) {
+        const int n = std::min(n_samples, n_head - (int) stream->head.size());
+        stream->head.insert(stream->head.end(), samples, samples + n);
+    }
+
+    stream->pcm.insert(stream->pcm.end(), samples, samples + n_samples);
+    stream->n_samples += n_samples;
+
+    // frames completed by the new samples
+    const int64_t n_frames = stream->n_samples >= n_pad ? (stream->n_samples - n_pad)/WHISPER_HOP_LENGTH + 1 : 0;
+
+    if (n_frames > stream->n_frames) {
+        const int64_t n_window = stream->n_frames - stream->frame_offset;
+
+        stream->frames.resize((n_frames - stream->frame_offset)*n_mel);
+
+        for (int64_t i = stream->n_frames; i < n_frames; i++) {
+            float * dst = stream->frames.data() + (n_window + i - stream->n_frames)*n_mel;
+
+            whisper_mel_stream_frame(*stream, i, dst, 1);
+
+            const float fmax = *std::max_element(dst, dst + n_mel);
+            while (!stream->frame_max.empty() && stream->frame_max.back().second <= fmax) {
+                stream->frame_max.pop_back();
+            }
+            stream->frame_max.emplace_back(i, fmax);
+        }
+
+        stream->n_frames = n_frames;
+
+        // keep only the samples of the frames that are not complete yet
+        const int64_t pcm_offset = std::max<int64_t>(0, stream->n_frames*WHISPER_HOP_LENGTH - n_pad);
+        if (pcm_offset > stream->pcm_offset) {
+            stream->pcm.erase(stream->pcm.begin(), stream->pcm.begin() + (pcm_offset - stream->pcm_offset));
+            stream->pcm_offset = pcm_offset;
+        }
+    }
+
+    stream->t_mel_us += ggml_time_us() - t_start_us;
+
+    return 0;
+}
+
+void whisper_mel_stream_keep(struct whisper_mel_stream * stream, int n_samples) {
+    const int n_mel = stream->filters->n_mel;
+
+    // first frame centered at or after the start of the kept audio
+    int64_t frame_offset = std::max<int64_t>(0, stream->n_samples - n_samples);
+    frame_offset = (frame_offset + WHISPER_HOP_LENGTH - 1)/WHISPER_HOP_LENGTH;
+    frame_offset = std::min(frame_offset, stream->n_frames);
+
+    if (frame_offset <= stream->frame_offset) {
+        return;
+    }
+
+    stream->frames.erase(stream->frames.begin(), stream->frames.begin() + (frame_offset - stream->frame_offset)*n_mel);
+    stream->frame_offset = frame_offset;
+
+    while (!stream->frame_max.empty() && stream->frame_max.front().first < frame_offset) {
+        stream->frame_max.pop_front();
+    }
+}
+
+int whisper_mel_stream_to_state(struct whisper_context * ctx, struct whisper_state * state, struct whisper_mel_stream * stream) {
+    if (stream->filters != &ctx->model.filters) {
+        WHISPER_LOG_ERROR("%s: the mel stream was created for a different context\n", __func__);
+        return -1;
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    const int frame_size = WHISPER_N_FFT;
+    const int frame_step = WHISPER_HOP_LENGTH;
+    const int n_mel      = stream->filters->n_mel;
+
+    // same frame counts as log_mel_spectrogram() for the samples of the window
+    const int64_t stage_1_pad = WHISPER_SAMPLE_RATE * 30;
+    const int64_t stage_2_pad = frame_size / 2;
+    const int64_t n_samples   = stream->n_samples - stream->frame_offset*frame_step;
+
+    auto & mel = state->mel;
+
+    state->mel_gen++;
+
+    mel.n_mel     = n_mel;
+    mel.n_len     = (n_samples + stage_1_pad + stage_2_pad * 2 - frame_size) / frame_step;
+    mel.n_len_org = 1 + (n_samples + stage_2_pad - frame_size) / frame_step;
+    mel.data.resize(mel.n_mel * mel.n_len);
+
+    const int n_window = stream->n_frames - stream->frame_offset;
+
+    // frames that reach past the end of the audio, then frames of zero padding only
+    const int n_tail = std::max(0, std::min<int>((n_samples + stage_2_pad) / frame_step + 1, mel.n_len) - n_window);
+
+    stream->tail.resize(n_tail*n_mel);
+    for (int i = 0; i < n_tail; i++) {
+        whisper_mel_stream_frame(*stream, stream->n_frames + i, stream->tail.data() + i*n_mel, 1);
+    }
+
+    const float pad = log10(1e-10);
+
+    // clamping and normalization
+    double mmax = pad;
+    if (!stream->frame_max.empty()) {
+        mmax = std::max<double>(mmax, stream->frame_max.front().second);
+    }
+    for (int i = 0; i < n_tail*n_mel; i++) {
+        mmax = std::max<double>(mmax, stream->tail[i]);
+    }
+
+    mmax -= 8.0;
+
+    auto normalize = [mmax](float v) -> float {
+        if (v < mmax) {
+            v = mmax;
+        }
+        return (v + 4.0)/4.0;
+    };
+
+    for (int i = 0; i < n_window; i++) {
+        const float * src = stream->frames.data() + i*n_mel;
+        for (int j = 0; j < n_mel; j++) {
+            mel.data[j*mel.n_len + i] = normalize(src[j]);
+        }
+    }
+
+    for (int i = 0; i < n_tail; i++) {
+        const float * src = stream->tail.data() + i*n_mel;
+        for (int j = 0; j < n_mel; j++) {
+            mel.data[j*mel.n_len + n_window + i] = normalize(src[j]);
+        }
+    }
+
+    const float pad_norm = normalize(pad);
+    for (int j = 0; j < n_mel; j++) {
+        std::fill(mel.data.begin() + j*mel.n_len + n_window + n_tail, mel.data.begin() + (j + 1)*mel.n_len, pad_norm);
+    }
+
+    state->t_mel_us += stream->t_mel_us + (ggml_time_us() - t_start_us);
+    stream->t_mel_us = 0;
+
+    return 0;
+}
+
 int whisper_encode_with_state(struct whisper_context * ctx, struct whisper_state * state, int offset, int n_threads) {
     if (!whisper_encode_internal(*ctx, *state, offset, n_threads, nullptr, nullptr)) {
         WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
@@ -3943,6 +5707,19 @@ int whisper_encode_with_state(struct whisper_context * ctx, struct whisper_state
     return 0;
 }
 
+int whisper_encode_batch(struct whisper_context * ctx, struct whisper_state ** states, const int * offsets, int n_states, int n_threads) {
+    if (n_states <= 0) {
+        return 0;
+    }
+
+    if (!whisper_encode_batch_internal(*ctx, states, offsets, n_states, n_threads)) {
+        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        return -1;
+    }
+
+    return 0;
+}
+
 int whisper_encode(struct whisper_context * ctx, int offset, int n_threads) {
     if (!whisper_encode_internal(*ctx, *ctx->state, offset, n_threads, nullptr, nullptr)) {
         WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
@@ -3965,6 +5742,35 @@ int whisper_decode_with_state(struct whisper_context * ctx, struct whisper_state
     return 0;
 }
 
+int whisper_decode_batch(
+        struct whisper_context * ctx,
+         struct whisper_state ** states,
+          const whisper_token ** tokens,
+                     const int * n_tokens,
+                     const int * n_past,
+                           int   n_states,
+                           int   n_threads) {
+    if (n_states <= 0) {
+        return 0;
+    }
+
+    std::vector<const whisper_batch *> batches(n_states);
+    for (int i = 0; i < n_states; ++i) {
+        whisper_batch_prep_legacy(states[i]->batch, tokens[i], n_tokens[i], n_past[i], 0);
+
+        whisper_kv_cache_seq_rm(states[i]->kv_self, 0, n_past[i], -1);
+
+        batches[i] = &states[i]->batch;
+    }
+
+    if (!whisper_decode_batch_internal(*ctx, states, batches.data(), n_states, n_threads)) {
+        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        return 1;
+    }
+
+    return 0;
+}
+
 int whisper_decode(struct whisper_context * ctx, const whisper_token * tokens, int n_tokens, int n_past, int n_threads) {
     if (ctx->state == nullptr) {
         WHISPER_LOG_ERROR("%s: ERROR state was not loaded.\n", __func__);
@@ -4267,11 +6073,19 @@ struct whisper_timings * whisper_get_timings(struct whisper_context * ctx) {
         return nullptr;
     }
     whisper_timings * timings = new whisper_timings;
-    timings->sample_ms = 1e-3f * ctx->state->t_sample_us / std::max(1, ctx->state->n_sample);
-    timings->encode_ms = 1e-3f * ctx->state->t_encode_us / std::max(1, ctx->state->n_encode);
-    timings->decode_ms = 1e-3f * ctx->state->t_decode_us / std::max(1, ctx->state->n_decode);
-    timings->batchd_ms = 1e-3f * ctx->state->t_batchd_us / std::max(1, ctx->state->n_batchd);
-    timings->prompt_ms = 1e-3f * ctx->state->t_prompt_us / std::max(1, ctx->state->n_prompt);
+    *timings = whisper_get_timings_from_state(ctx->state);
+    return timings;
+}
+
+struct whisper_timings whisper_get_timings_from_state(struct whisper_state * state) {
+    whisper_timings timings;
+    timings.sample_ms = 1e-3f * state->t_sample_us / std::max(1, state->n_sample);
+    timings.encode_ms = 1e-3f * state->t_encode_us / std::max(1, state->n_encode);
+    timings.decode_ms = 1e-3f * state->t_decode_us / std::max(1, state->n_decode);
+    timings.batchd_ms = 1e-3f * state->t_batchd_us / std::max(1, state->n_batchd);
+    timings.prompt_ms = 1e-3f * state->t_prompt_us / std::max(1, state->n_prompt);
+    timings.n_encode     = state->n_encode;
+    timings.n_encode_hit = state->n_encode_hit;
     return timings;
 }
 
@@ -4281,41 +6095,53 @@ void whisper_print_timings(struct whisper_context * ctx) {
     WHISPER_LOG_INFO("\n");
     WHISPER_LOG_INFO("%s:     load time = %8.2f ms\n", __func__, ctx->t_load_us / 1000.0f);
     if (ctx->state != nullptr) {
-
-        const int32_t n_sample = std::max(1, ctx->state->n_sample);
-        const int32_t n_encode = std::max(1, ctx->state->n_encode);
-        const int32_t n_decode = std::max(1, ctx->state->n_decode);
-        const int32_t n_batchd = std::max(1, ctx->state->n_batchd);
-        const int32_t n_prompt = std::max(1, ctx->state->n_prompt);
-
-        WHISPER_LOG_INFO("%s:     fallbacks = %3d p / %3d h\n", __func__, ctx->state->n_fail_p, ctx->state->n_fail_h);
-        WHISPER_LOG_INFO("%s:      mel time = %8.2f ms\n", __func__, ctx->state->t_mel_us / 1000.0f);
-        WHISPER_LOG_INFO("%s:   sample time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_sample_us, n_sample, 1e-3f * ctx->state->t_sample_us / n_sample);
-        WHISPER_LOG_INFO("%s:   encode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_encode_us, n_encode, 1e-3f * ctx->state->t_encode_us / n_encode);
-        WHISPER_LOG_INFO("%s:   decode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_decode_us, n_decode, 1e-3f * ctx->state->t_decode_us / n_decode);
-        WHISPER_LOG_INFO("%s:   batchd time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_batchd_us, n_batchd, 1e-3f * ctx->state->t_batchd_us / n_batchd);
-        WHISPER_LOG_INFO("%s:   prompt time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_prompt_us, n_prompt, 1e-3f * ctx->state->t_prompt_us / n_prompt);
+        whisper_print_timings_from_state(ctx->state);
     }
     WHISPER_LOG_INFO("%s:    total time = %8.2f ms\n", __func__, (t_end_us - ctx->t_start_us)/1000.0f);
 }
 
+void whisper_print_timings_from_state(struct whisper_state * state) {
+    const int32_t n_sample = std::max(1, state->n_sample);
+    const int32_t n_encode = std::max(1, state->n_encode);
+    const int32_t n_decode = std::max(1, state->n_decode);
+    const int32_t n_batchd = std::max(1, state->n_batchd);
+    const int32_t n_prompt = std::max(1, state->n_prompt);
+
+    // the lines read the same as those of whisper_print_timings()
+    const char * name = "whisper_print_timings";
+
+    WHISPER_LOG_INFO("%s:     fallbacks = %3d p / %3d h\n", name, state->n_fail_p, state->n_fail_h);
+    WHISPER_LOG_INFO("%s:      mel time = %8.2f ms\n", name, state->t_mel_us / 1000.0f);
+    WHISPER_LOG_INFO("%s:   sample time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", name, 1e-3f * state->t_sample_us, n_sample, 1e-3f * state->t_sample_us / n_sample);
+    WHISPER_LOG_INFO("%s:   encode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", name, 1e-3f * state->t_encode_us, n_encode, 1e-3f * state->t_encode_us / n_encode);
+    WHISPER_LOG_INFO("%s:  encode cache = %5d hits / %5d calls\n", name, state->n_encode_hit, state->n_encode + state->n_encode_hit);
+    WHISPER_LOG_INFO("%s:   decode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", name, 1e-3f * state->t_decode_us, n_decode, 1e-3f * state->t_decode_us / n_decode);
+    WHISPER_LOG_INFO("%s:   batchd time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", name, 1e-3f * state->t_batchd_us, n_batchd, 1e-3f * state->t_batchd_us / n_batchd);
+    WHISPER_LOG_INFO("%s:   prompt time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", name, 1e-3f * state->t_prompt_us, n_prompt, 1e-3f * state->t_prompt_us / n_prompt);
+}
+
 void whisper_reset_timings(struct whisper_context * ctx) {
     ctx->t_start_us = ggml_time_us();
     if (ctx->state != nullptr) {
-        ctx->state->t_mel_us = 0;
-        ctx->state->t_sample_us = 0;
-        ctx->state->t_encode_us = 0;
-        ctx->state->t_decode_us = 0;
-        ctx->state->t_batchd_us = 0;
-        ctx->state->t_prompt_us = 0;
-        ctx->state->n_sample = 0;
-        ctx->state->n_encode = 0;
-        ctx->state->n_decode = 0;
-        ctx->state->n_batchd = 0;
-        ctx->state->n_prompt = 0;
+        whisper_reset_timings_from_state(ctx->state);
     }
 }
 
+void whisper_reset_timings_from_state(struct whisper_state * state) {
+    state->t_mel_us = 0;
+    state->t_sample_us = 0;
+    state->t_encode_us = 0;
+    state->t_decode_us = 0;
+    state->t_batchd_us = 0;
+    state->t_prompt_us = 0;
+    state->n_sample = 0;
+    state->n_encode = 0;
+    state->n_decode = 0;
+    state->n_batchd = 0;
+    state->n_prompt = 0;
+    state->n_encode_hit = 0;
+}
+
 static int whisper_has_coreml(void) {
 #ifdef WHISPER_USE_COREML
     return 1;
@@ -5993,6 +7819,8 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.vad_model_path              =*/ nullptr,
 
         /* vad_params =*/ whisper_vad_default_params(),
+
+        /*.batch_decode                =*/ false,
     };
 
     switch (strategy) {
@@ -6724,6 +8552,74 @@ static bool whisper_vad(
     return true;
 }
 
+// smallest bucket of encoder context that covers n_frames mel frames (2 frames per audio_ctx position)
+// audio longer than the model context is processed in 30 s windows, so it gets the full context
+// the compute buffers are reserved for the full context in whisper_init_state(), and the smaller
+// graphs have the same topology, so switching between buckets does not re-reserve the schedulers
+static int whisper_audio_ctx_auto(const whisper_context & ctx, int n_frames) {
+    const int n_audio_ctx = ctx.model.hparams.n_audio_ctx;
+    const int n_ctx       = GGML_PAD((n_frames + 1)/2, WHISPER_AUDIO_CTX_BUCKET);
+
+    return n_ctx >= n_audio_ctx ? 0 : n_ctx;
+}
+
+// decoder pass of whisper_full_with_state() on state.batch
+// with params.batch_decode the pass goes through the queue of the context: a caller that finds no pass running
+// takes all the queued requests and runs them as one whisper_decode_batch_internal() pass, the others wait for
+// it. while a pass runs, the next steps of the other calls pile up, so the batch grows with the concurrency
+static bool whisper_full_decode(
+        struct whisper_context & ctx,
+          struct whisper_state & state,
+     const whisper_full_params & params) {
+    if (!params.batch_decode) {
+        return whisper_decode_internal(ctx, state, state.batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data);
+    }
+
+    auto & queue = ctx.decode_queue;
+
+    whisper_decode_queue::request req;
+    req.state = &state;
+
+    std::unique_lock<std::mutex> lock(queue.mutex);
+
+    queue.pending.push_back(&req);
+
+    while (!req.done) {
+        if (queue.running) {
+            queue.cv.wait(lock);
+            continue;
+        }
+
+        // lead the next pass
+        std::vector<whisper_decode_queue::request *> reqs;
+        reqs.swap(queue.pending);
+
+        queue.running = true;
+        lock.unlock();
+
+        std::vector<whisper_state *>       states;
+        std::vector<const whisper_batch *> batches;
+        for (auto * r : reqs) {
+            states.push_back(r->state);
+            batches.push_back(&r->state->batch);
+        }
+
+        const bool ok = whisper_decode_batch_internal(ctx, states.data(), batches.data(), reqs.size(), params.n_threads);
+
+        lock.lock();
+
+        for (auto * r : reqs) {
+            r->ok   = ok;
+            r->done = true;
+        }
+
+        queue.running = false;
+        queue.cv.notify_all();
+    }
+
+    return req.ok && !(params.abort_callback && params.abort_callback(params.abort_callback_user_data));
+}
+
 int whisper_full_with_state(
         struct whisper_context * ctx,
           struct whisper_state * state,
@@ -6761,6 +8657,18 @@ int whisper_full_with_state(
         }
     }
 
+    const int seek_start = params.offset_ms/10;
+    const int seek_end = params.duration_ms == 0 ? whisper_n_len_from_state(state) : seek_start + params.duration_ms/10;
+
+    // overwrite audio_ctx, max allowed is hparams.n_audio_ctx
+    // done before the language detection, so that it encodes the same window as the first pass at seek 0
+    // and the transcription reuses its cross-attention KV cache instead of running the encoder again
+    if (params.audio_ctx > whisper_n_audio_ctx(ctx)) {
+        WHISPER_LOG_ERROR("%s: audio_ctx is larger than the maximum allowed (%d > %d)\n", __func__, params.audio_ctx, whisper_n_audio_ctx(ctx));
+        return -5;
+    }
+    state->exp_n_audio_ctx = params.audio_ctx < 0 ? whisper_audio_ctx_auto(*ctx, seek_end - seek_start) : params.audio_ctx;
+
     // auto-detect language if not specified
     if (params.language == nullptr || strlen(params.language) == 0 || strcmp(params.language, "auto") == 0 || params.detect_language) {
         std::vector<float> probs(whisper_lang_max_id() + 1, 0.0f);
@@ -6788,9 +8696,6 @@ int whisper_full_with_state(
         }
     }
 
-    const int seek_start = params.offset_ms/10;
-    const int seek_end = params.duration_ms == 0 ? whisper_n_len_from_state(state) : seek_start + params.duration_ms/10;
-
     // if length of spectrogram is less than 100ms (10 frames), then return
     // basically don't process anything that is less than 100ms
     // ref: https://github.com/ggml-org/whisper.cpp/issues/2065
@@ -6880,13 +8785,6 @@ int whisper_full_with_state(
         }
     }
 
-    // overwrite audio_ctx, max allowed is hparams.n_audio_ctx
-    if (params.audio_ctx > whisper_n_audio_ctx(ctx)) {
-        WHISPER_LOG_ERROR("%s: audio_ctx is larger than the maximum allowed (%d > %d)\n", __func__, params.audio_ctx, whisper_n_audio_ctx(ctx));
-        return -5;
-    }
-    state->exp_n_audio_ctx = params.audio_ctx;
-
     // these tokens determine the task that will be performed
     std::vector<whisper_token> prompt_init = { whisper_token_sot(ctx), };
 
@@ -7066,7 +8964,7 @@ int whisper_full_with_state(
 
                 whisper_batch_prep_legacy(state->batch, prompt.data(), prompt.size(), 0, 0);
 
-                if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                if (!whisper_full_decode(*ctx, *state, params)) {
                     WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
                     return -8;
                 }
@@ -7378,7 +9276,7 @@ int whisper_full_with_state(
 
                     assert(batch.n_tokens > 0);
 
-                    if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                    if (!whisper_full_decode(*ctx, *state, params)) {
                         WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
                         return -9;
                     }
@@ -7668,14 +9566,15 @@ int whisper_full(
     return whisper_full_with_state(ctx, ctx->state, params, samples, n_samples);
 }
 
-int whisper_full_parallel(
+int whisper_full_parallel_with_state(
         struct whisper_context * ctx,
+        struct whisper_state * state,
         struct whisper_full_params params,
         const float * samples,
         int n_samples,
         int n_processors) {
     if (n_processors == 1) {
-        return whisper_full(ctx, params, samples, n_samples);
+        return whisper_full_with_state(ctx, state, params, samples, n_samples);
     }
     int ret = 0;
 
@@ -7717,8 +9616,8 @@ int whisper_full_parallel(
         // We need to disable the print real-time for this one as well, otherwise it will show only for the first chunk.
         params_cur.print_realtime = false;
 
-        // Run the first transformation using default state but only for the first chunk.
-        ret = whisper_full_with_state(ctx, ctx->state, std::move(params_cur), samples, offset_samples + n_samples_per_processor);
+        // Run the first transformation using the given state but only for the first chunk.
+        ret = whisper_full_with_state(ctx, state, std::move(params_cur), samples, offset_samples + n_samples_per_processor);
     }
 
     for (int i = 0; i < n_processors - 1; ++i) {
@@ -7727,7 +9626,7 @@ int whisper_full_parallel(
 
     const int64_t offset_t = (int64_t) params.offset_ms/10.0;
 
-    // combine results into result_state->result_all from all other states
+    // combine results into state->result_all from all other states
     for (int i = 0; i < n_processors - 1; ++i) {
         auto& results_i = states[i]->result_all;
 
@@ -7737,40 +9636,41 @@ int whisper_full_parallel(
             result.t1 += 100 * ((i + 1) * n_samples_per_processor) / WHISPER_SAMPLE_RATE + offset_t;
 
             // make sure that segments are not overlapping
-            if (!ctx->state->result_all.empty()) {
-                result.t0 = std::max(result.t0, ctx->state->result_all.back().t1);
+            if (!state->result_all.empty()) {
+                result.t0 = std::max(result.t0, state->result_all.back().t1);
             }
 
-            ctx->state->result_all.push_back(std::move(result));
+            state->result_all.push_back(std::move(result));
 
             // call the new_segment_callback for each segment
             if (params.new_segment_callback) {
-                params.new_segment_callback(ctx, ctx->state, 1, params.new_segment_callback_user_data);
+                params.new_segment_callback(ctx, state, 1, params.new_segment_callback_user_data);
             }
         }
 
-        ctx->state->t_mel_us += states[i]->t_mel_us;
+        state->t_mel_us += states[i]->t_mel_us;
 
-        ctx->state->t_sample_us += states[i]->t_sample_us;
-        ctx->state->t_encode_us += states[i]->t_encode_us;
-        ctx->state->t_decode_us += states[i]->t_decode_us;
-        ctx->state->t_batchd_us += states[i]->t_batchd_us;
-        ctx->state->t_prompt_us += states[i]->t_prompt_us;
+        state->t_sample_us += states[i]->t_sample_us;
+        state->t_encode_us += states[i]->t_encode_us;
+        state->t_decode_us += states[i]->t_decode_us;
+        state->t_batchd_us += states[i]->t_batchd_us;
+        state->t_prompt_us += states[i]->t_prompt_us;
 
-        ctx->state->n_sample += states[i]->n_sample;
-        ctx->state->n_encode += states[i]->n_encode;
-        ctx->state->n_decode += states[i]->n_decode;
-        ctx->state->n_batchd += states[i]->n_batchd;
-        ctx->state->n_prompt += states[i]->n_prompt;
+        state->n_sample += states[i]->n_sample;
+        state->n_encode += states[i]->n_encode;
+        state->n_encode_hit += states[i]->n_encode_hit;
+        state->n_decode += states[i]->n_decode;
+        state->n_batchd += states[i]->n_batchd;
+        state->n_prompt += states[i]->n_prompt;
 
         whisper_free_state(states[i]);
     }
 
     // average the timings
-    ctx->state->t_mel_us    /= n_processors;
-    ctx->state->t_sample_us /= n_processors;
-    ctx->state->t_encode_us /= n_processors;
-    ctx->state->t_decode_us /= n_processors;
+    state->t_mel_us    /= n_processors;
+    state->t_sample_us /= n_processors;
+    state->t_encode_us /= n_processors;
+    state->t_decode_us /= n_processors;
 
     // print information about the audio boundaries
     WHISPER_LOG_WARN("\n");
@@ -7783,6 +9683,15 @@ int whisper_full_parallel(
     return ret;
 }
 
+int whisper_full_parallel(
+        struct whisper_context * ctx,
+        struct whisper_full_params params,
+        const float * samples,
+        int n_samples,
+        int n_processors) {
+    return whisper_full_parallel_with_state(ctx, ctx->state, params, samples, n_samples, n_processors);
+}
+
 int whisper_full_n_segments_from_state(struct whisper_state * state) {
     return state->result_all.size();
 }
@@ -8272,6 +10181,121 @@ WHISPER_API const char * whisper_bench_ggml_mul_mat_str(int n_threads) {
     return s.c_str();
 }
 
+WHISPER_API int whisper_bench_conv(int n_threads) {
+    fputs(whisper_bench_conv_str(n_threads), stderr);
+    return 0;
+}
+
+WHISPER_API const char * whisper_bench_conv_str(int n_threads) {
+    whisper_load_backends();
+
+    static std::string s;
+    s = "";
+    char strbuf[256];
+
+    ggml_time_init();
+
+    const int n_max  = 128;
+    const int n_mels = 80;
+
+    // n_audio_state of tiny, base, small, medium and large
+    const std::vector<int> states = { 384, 512, 768, 1024, 1280, };
+
+    // full 30 s window and a 5 s window, as used with a reduced audio_ctx
+    const std::vector<int> ctxs = { 1500, 250, };
+
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> dist(-0.1f, 0.1f);
+
+    for (int n_state : states) {
+        for (int n_ctx : ctxs) {
+            // weights, mel and the intermediates of both stems, including the F16 im2col buffers
+            const size_t n_bytes =
+                (3llu*n_mels*n_state + 3llu*n_state*n_state)*sizeof(ggml_fp16_t) +
+                (2llu*n_ctx*n_mels)*(1 + 3) * sizeof(float) +
+                (2llu*n_ctx*n_state)*(3 + 1 + 2)*sizeof(float) +
+                (1llu*n_ctx*n_state)*(3 + 1 + 2)*sizeof(float) + 16*ggml_tensor_overhead() + 2*ggml_graph_overhead();
+
+            struct ggml_init_params gparams = {
+                /*.mem_size   =*/ n_bytes + 1024*1024,
+                /*.mem_buffer =*/ nullptr,
+                /*.no_alloc   =*/ false,
+            };
+
+            struct ggml_context * ctx0 = ggml_init(gparams);
+
+            whisper_model model;
+
+            model.e_conv_1_w = ggml_new_tensor_3d(ctx0, GGML_TYPE_F16, 3, n_mels,  n_state);
+            model.e_conv_1_b = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 1, n_state);
+            model.e_conv_2_w = ggml_new_tensor_3d(ctx0, GGML_TYPE_F16, 3, n_state, n_state);
+            model.e_conv_2_b = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 1, n_state);
+
+            struct ggml_tensor * mel = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels);
+
+            for (auto * t : { model.e_conv_1_w, model.e_conv_2_w }) {
+                for (int64_t i = 0; i < ggml_nelements(t); ++i) {
+                    ((ggml_fp16_t *) t->data)[i] = ggml_fp32_to_fp16(dist(rng));
+                }
+            }
+            for (auto * t : { model.e_conv_1_b, model.e_conv_2_b, mel }) {
+                for (int64_t i = 0; i < ggml_nelements(t); ++i) {
+                    ((float *) t->data)[i] = dist(rng);
+                }
+            }
+
+            struct ggml_tensor * out[2];
+            double tms[2];
+            int    nrun[2];
+
+            for (int k = 0; k < 2; ++k) {
+                out[k] = whisper_build_conv(ctx0, model, mel, k == 1);
+
+                struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+                ggml_build_forward_expand(gf, out[k]);
+
+                double tsum = 0.0;
+                int    n    = 0;
+
+                // heat-up
+                ggml_graph_compute_helper(gf, n_threads, nullptr, nullptr);
+
+                for (int i = 0; i < n_max; ++i) {
+                    const int64_t t0 = ggml_time_us();
+
+                    ggml_graph_compute_helper(gf, n_threads, nullptr, nullptr);
+
+                    const int64_t t1 = ggml_time_us();
+
+                    tsum += (t1 - t0)*1e-6;
+                    n++;
+
+                    if (tsum > 1.0 && n >= 3) {
+                        break;
+                    }
+                }
+
+                tms[k]  = 1e3*tsum/n;
+                nrun[k] = n;
+            }
+
+            float max_diff = 0.0f;
+            for (int64_t i = 0; i < ggml_nelements(out[0]); ++i) {
+                max_diff = std::max(max_diff, std::fabs(((float *) out[0]->data)[i] - ((float *) out[1]->data)[i]));
+            }
+
+            ggml_free(ctx0);
+
+            snprintf(strbuf, sizeof(strbuf), "conv stem %4d x %4d: im2col %8.2f ms (%3d runs) | fused %8.2f ms (%3d runs) | speed-up %5.2fx | max diff %.2e\n",
+                    n_state, n_ctx, tms[0], nrun[0], tms[1], nrun[1], tms[0]/tms[1], max_diff);
+            s += strbuf;
+        }
+    }
+
+    return s.c_str();
+}
+
 // =================================================================================================
 
 // =================================================================================================
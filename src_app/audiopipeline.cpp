@@ -0,0 +1,293 @@
+#include "audiopipeline.h"
+
+#include "whisper.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <chrono>
+
+namespace {
+    // Не чаще ~30 кадров волны в секунду и одного отчёта статистики в секунду
+    const int kWaveformIntervalMs = 33;
+    const int kStatsIntervalMs    = 1000;
+
+    // Кольцо захвата разгружается каждые ~20 мс, двух секунд хватает с большим запасом
+    const int kCaptureRingMs = 2000;
+    const int kDrainTimeoutMs = 20;
+
+    // Аудио перед срабатыванием детектора: начало фразы обычно тише её середины
+    const int kPrerollMs = 300;
+
+    size_t msToSamples(int ms)
+    {
+        return size_t((1e-3 * ms) * WHISPER_SAMPLE_RATE);
+    }
+
+    int fillPercent(size_t size, size_t capacity)
+    {
+        return capacity > 0 ? int((100 * size) / capacity) : 0;
+    }
+}
+
+AudioPipeline::AudioPipeline(QObject *parent)
+    : QThread(parent)
+{
+    qRegisterMetaType<PipelineStats>("PipelineStats");
+}
+
+AudioPipeline::~AudioPipeline()
+{
+    stopCapture();
+}
+
+bool AudioPipeline::startCapture(int captureId, int displayMs, int queueMs, const SpeechGate::Params &gateParams)
+{
+    if (m_running) {
+        qDebug() << "Audio pipeline is already running.";
+        return false;
+    }
+
+    m_captureRing.reset(msToSamples(kCaptureRingMs));
+    m_inferenceRing.reset(msToSamples(queueMs));
+    m_peaks.reset(msToSamples(displayMs));
+    m_chunk.resize(m_captureRing.capacity());
+
+    m_gate.reset(gateParams, WHISPER_SAMPLE_RATE);
+    m_preroll.reset(msToSamples(kPrerollMs));
+    m_prerollCopy.reserve(m_preroll.capacity());
+
+    m_inferencePushed = 0;
+    m_utteranceEnd = 0;
+    m_inferenceRead = 0;
+    m_utteranceEndTaken = 0;
+
+    m_captureDropped = 0;
+    m_inferenceDropped = 0;
+    m_uiCoalesced = 0;
+    m_gatedSamples = 0;
+
+    SDL_AudioSpec requested;
+    SDL_AudioSpec obtained;
+
+    SDL_zero(requested);
+    SDL_zero(obtained);
+
+    requested.freq     = WHISPER_SAMPLE_RATE;
+    requested.format   = AUDIO_F32;
+    requested.channels = 1;
+    requested.samples  = 1024;
+    requested.callback = &AudioPipeline::sdlCallback;
+    requested.userdata = this;
+
+    const char *name = captureId >= 0 ? SDL_GetAudioDeviceName(captureId, SDL_TRUE) : nullptr;
+    m_device = SDL_OpenAudioDevice(name, SDL_TRUE, &requested, &obtained, 0);
+
+    if (!m_device) {
+        qWarning() << "Couldn't open an audio device for capture:" << SDL_GetError();
+        return false;
+    }
+
+    qDebug() << "Capture device opened: rate" << obtained.freq << "channels" << obtained.channels
+             << "samples per frame" << obtained.samples;
+
+    m_running = true;
+    start();
+
+    SDL_PauseAudioDevice(m_device, 0);
+
+    return true;
+}
+
+void AudioPipeline::stopCapture()
+{
+    if (m_device) {
+        SDL_PauseAudioDevice(m_device, 1);
+    }
+
+    if (m_running) {
+        m_running = false;
+
+        m_captureCv.notify_all();
+        {
+            std::lock_guard<std::mutex> lock(m_inferenceMutex);
+        }
+        m_inferenceCv.notify_all();
+
+        wait();
+    }
+
+    if (m_device) {
+        SDL_CloseAudioDevice(m_device);
+        m_device = 0;
+    }
+}
+
+bool AudioPipeline::waitForSamples(size_t n, int timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(m_inferenceMutex);
+
+    auto ready = [&]() {
+        return m_inferenceRing.size() >= n || m_utteranceEnd.load() > m_utteranceEndTaken;
+    };
+
+    m_inferenceCv.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&]() {
+        return !m_running || ready();
+    });
+
+    return ready();
+}
+
+size_t AudioPipeline::readSamples(float *dst, size_t n)
+{
+    const size_t n_read = m_inferenceRing.pop(dst, n);
+    m_inferenceRead += n_read;
+
+    return n_read;
+}
+
+bool AudioPipeline::takeEndOfUtterance()
+{
+    const uint64_t end = m_utteranceEnd.load();
+    if (end <= m_utteranceEndTaken || m_inferenceRead < end) {
+        return false;
+    }
+
+    m_utteranceEndTaken = end;
+    return true;
+}
+
+size_t AudioPipeline::availableSamples() const
+{
+    return m_inferenceRing.size();
+}
+
+PipelineStats AudioPipeline::stats() const
+{
+    PipelineStats s;
+
+    s.captureDropped   = m_captureDropped;
+    s.inferenceDropped = m_inferenceDropped;
+    s.uiCoalesced      = m_uiCoalesced;
+    s.captureFill      = fillPercent(m_captureRing.size(), m_captureRing.capacity());
+    s.inferenceFill    = fillPercent(m_inferenceRing.size(), m_inferenceRing.capacity());
+    s.gatedSamples     = m_gatedSamples;
+    s.speech           = m_gate.isSpeech();
+
+    return s;
+}
+
+void AudioPipeline::sdlCallback(void *userdata, uint8_t *stream, int len)
+{
+    AudioPipeline *pipeline = static_cast<AudioPipeline *>(userdata);
+    pipeline->onCapture(reinterpret_cast<const float *>(stream), len / sizeof(float));
+}
+
+// Вызывается из аудиопотока SDL: без блокировок и аллокаций
+void AudioPipeline::onCapture(const float *data, size_t n)
+{
+    if (!m_running) {
+        return;
+    }
+
+    const size_t written = m_captureRing.push(data, n);
+    if (written < n) {
+        m_captureDropped += n - written;
+    }
+
+    // Уведомление без захвата мьютекса: если читатель пропустит его,
+    // он проснётся по таймауту kDrainTimeoutMs
+    m_captureCv.notify_one();
+}
+
+void AudioPipeline::pushInference(const float *data, size_t n)
+{
+    // Распознавание не успевает - отбрасываем новые данные, а не блокируем захват
+    const size_t written = m_inferenceRing.push(data, n);
+    if (written < n) {
+        m_inferenceDropped += n - written;
+    }
+
+    m_inferencePushed += written;
+}
+
+void AudioPipeline::run()
+{
+    qDebug() << "Audio pipeline thread started.";
+
+    QElapsedTimer waveformTimer;
+    QElapsedTimer statsTimer;
+    waveformTimer.start();
+    statsTimer.start();
+
+    bool displayDirty = false;
+
+    while (m_running) {
+        {
+            std::unique_lock<std::mutex> lock(m_captureMutex);
+            m_captureCv.wait_for(lock, std::chrono::milliseconds(kDrainTimeoutMs), [&]() {
+                return !m_running || m_captureRing.size() > 0;
+            });
+        }
+
+        bool received = false;
+
+        size_t n = 0;
+        while ((n = m_captureRing.pop(m_chunk.data(), m_chunk.size())) > 0) {
+            received = true;
+
+            if (displayDirty) {
+                ++m_uiCoalesced;
+            }
+            m_peaks.push(m_chunk.data(), n);
+            displayDirty = true;
+
+            // Детектор речи работает кадрами, фраза начинается и заканчивается на их границе
+            const size_t frame = std::max<size_t>(1, m_gate.frameSize());
+            for (size_t i = 0; i < n; i += frame) {
+                const float *piece = m_chunk.data() + i;
+                const size_t n_piece = std::min(frame, n - i);
+
+                const SpeechGate::Event event = m_gate.process(piece, n_piece);
+
+                if (event == SpeechGate::SpeechStart) {
+                    m_preroll.copyTo(m_prerollCopy);
+                    m_preroll.clear();
+                    pushInference(m_prerollCopy.data(), m_prerollCopy.size());
+                }
+
+                if (m_gate.isSpeech() || event == SpeechGate::SpeechEnd || !m_gate.enabled()) {
+                    pushInference(piece, n_piece);
+                } else {
+                    m_preroll.push(piece, n_piece);
+                    m_gatedSamples += n_piece;
+                }
+
+                if (event == SpeechGate::SpeechEnd) {
+                    m_utteranceEnd = m_inferencePushed;
+                }
+            }
+        }
+
+        if (received) {
+            {
+                std::lock_guard<std::mutex> lock(m_inferenceMutex);
+            }
+            m_inferenceCv.notify_one();
+        }
+
+        if (displayDirty && waveformTimer.elapsed() >= kWaveformIntervalMs) {
+            emit waveformUpdated();
+
+            displayDirty = false;
+            waveformTimer.restart();
+        }
+
+        if (statsTimer.elapsed() >= kStatsIntervalMs) {
+            emit statsUpdated(stats());
+            statsTimer.restart();
+        }
+    }
+
+    qDebug() << "Audio pipeline thread finished.";
+}
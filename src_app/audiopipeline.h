@@ -0,0 +1,114 @@
+#ifndef AUDIOPIPELINE_H
+#define AUDIOPIPELINE_H
+
+#include <QThread>
+#include <QObject>
+#include <QMetaType>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include <SDL.h>
+#include <SDL_audio.h>
+
+#include "spscringbuffer.h"
+#include "waveformpeaks.h"
+#include "speechgate.h"
+#include "slidingaudiowindow.h"
+
+// Счётчики конвейера захвата: сколько данных потеряно на каждой стадии
+// и насколько заполнены очереди между стадиями
+struct PipelineStats {
+    quint64 captureDropped   = 0; // семплы, не поместившиеся в кольцо захвата (callback SDL)
+    quint64 inferenceDropped = 0; // семплы, отброшенные из-за отставания распознавания
+    quint64 uiCoalesced      = 0; // порции аудио, объединённые в одно обновление волны
+    int     captureFill      = 0; // заполненность кольца захвата, %
+    int     inferenceFill    = 0; // заполненность очереди распознавания, %
+    quint64 gatedSamples     = 0; // семплы тишины, не отправленные на распознавание
+    bool    speech           = false;
+};
+
+Q_DECLARE_METATYPE(PipelineStats)
+
+// Конвейер аудио из трёх стадий:
+//
+//   SDL callback -> [SPSC кольцо захвата] -> стадия подготовки (этот поток)
+//                -> [SPSC очередь распознавания] -> WhisperRecognizer
+//                -> UI (пирамида пиков волны и статистика, сигналы с ограничением частоты)
+//
+// Callback SDL никогда не блокируется, а долгий whisper_full не мешает
+// забирать аудио из устройства и обновлять волну.
+//
+// Стадия подготовки пропускает в очередь распознавания только фразы (SpeechGate),
+// с небольшим запасом аудио перед началом речи. В тишине распознавание спит,
+// а конец фразы отмечается позицией в потоке, чтобы распознавание сразу её дописало.
+class AudioPipeline : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit AudioPipeline(QObject *parent = nullptr);
+    ~AudioPipeline();
+
+    // displayMs - длина отображаемой волны, queueMs - ёмкость очереди распознавания
+    bool startCapture(int captureId, int displayMs, int queueMs, const SpeechGate::Params &gateParams);
+    void stopCapture();
+
+    // Стадия распознавания: ждёт, пока в очереди наберётся n семплов или закончится фраза
+    bool waitForSamples(size_t n, int timeoutMs);
+    size_t readSamples(float *dst, size_t n);
+    size_t availableSamples() const;
+
+    // true один раз на каждую законченную фразу, когда все её семплы уже прочитаны
+    bool takeEndOfUtterance();
+
+    PipelineStats stats() const;
+
+    // Общая с UI пирамида пиков; виджет читает её сам по сигналу waveformUpdated
+    const WaveformPeaks *peaks() const { return &m_peaks; }
+
+signals:
+    void waveformUpdated();
+    void statsUpdated(const PipelineStats &stats);
+
+protected:
+    void run() override;
+
+private:
+    static void sdlCallback(void *userdata, uint8_t *stream, int len);
+    void onCapture(const float *data, size_t n);
+    void pushInference(const float *data, size_t n);
+
+    SDL_AudioDeviceID m_device = 0;
+    std::atomic_bool m_running{false};
+
+    SpscRingBuffer<float> m_captureRing;   // callback SDL -> стадия подготовки
+    SpscRingBuffer<float> m_inferenceRing; // стадия подготовки -> распознавание
+
+    // Мьютексы нужны только ожидающей стороне, callback SDL их не захватывает
+    std::mutex m_captureMutex;
+    std::condition_variable m_captureCv;
+    std::mutex m_inferenceMutex;
+    std::condition_variable m_inferenceCv;
+
+    std::atomic<quint64> m_captureDropped{0};
+    std::atomic<quint64> m_inferenceDropped{0};
+    std::atomic<quint64> m_uiCoalesced{0};
+    std::atomic<quint64> m_gatedSamples{0};
+
+    SpeechGate m_gate;
+    SlidingAudioWindow m_preroll;       // тишина перед началом фразы
+    std::vector<float> m_prerollCopy;
+
+    // Позиции в потоке очереди распознавания (в семплах от старта захвата)
+    uint64_t m_inferencePushed = 0;             // пишет только стадия подготовки
+    std::atomic<uint64_t> m_utteranceEnd{0};    // конец последней законченной фразы
+    uint64_t m_inferenceRead = 0;               // дальше - только стадия распознавания
+    uint64_t m_utteranceEndTaken = 0;
+
+    WaveformPeaks m_peaks;
+    std::vector<float> m_chunk;
+};
+
+#endif // AUDIOPIPELINE_H
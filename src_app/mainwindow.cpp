@@ -13,6 +13,17 @@
 #include <QApplication>
 #include <QStyle>
 #include <QProcess>
+#include <QStatusBar>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QTextCursor>
+#include <QTextCharFormat>
+
+namespace {
+    // !!! Здесь нужно указать путь к модели whisper !!!
+    // Пока используем "ggml-base.en.bin", предполагая, что она лежит в ../models
+    const char *kDefaultModelPath = "../models/ggml-base.en.bin";
+}
 
 // Для инициализации SDL Audio в главном потоке, если это необходимо.
 // Хотя мы инициализируем SDL Audio в потоке WhisperRecognizer,
@@ -24,6 +35,9 @@ MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
 {
     createUi();
+
+    // Модель загружается один раз при старте, а не по кнопке Start
+    modelManager->requestModel(kDefaultModelPath, whisper_params().n_threads);
 }
 
 MainWindow::~MainWindow()
@@ -37,8 +51,11 @@ void MainWindow::createUi()
 {
     // Создаем элементы UI
     startStopButton = new QPushButton("Start Recognition", this);
+    loadModelButton = new QPushButton("Load Model...", this);
     recognizedTextEdit = new QPlainTextEdit(this);
     waveformWidget = new WaveformWidget(this);
+    pipelineStatsLabel = new QLabel(this);
+    rtfLabel = new QLabel(this);
 
     // Настраиваем элементы UI
     recognizedTextEdit->setReadOnly(true); // Текст только для чтения
@@ -49,6 +66,7 @@ void MainWindow::createUi()
 
     // Добавляем элементы в компоновщики
     horizontalLayout->addWidget(startStopButton);
+    horizontalLayout->addWidget(loadModelButton);
     // Добавляем другие элементы управления, если они будут
 
     layout->addLayout(horizontalLayout);
@@ -60,14 +78,30 @@ void MainWindow::createUi()
     centralWidget->setLayout(layout);
     setCentralWidget(centralWidget);
 
+    // Потери и заполненность очередей аудиоконвейера
+    statusBar()->addPermanentWidget(pipelineStatsLabel);
+    // Настройки, выбранные контроллером real-time factor
+    statusBar()->addPermanentWidget(rtfLabel);
+
     // Создаем экземпляр WhisperRecognizer
     recognizer = new WhisperRecognizer(this);
+    modelManager = new ModelManager(this);
+
+    // До окончания первой загрузки запускать нечего
+    startStopButton->setEnabled(false);
 
     // Соединяем сигналы и слоты
     connect(startStopButton, &QPushButton::clicked, this, &MainWindow::onStartStopButtonClicked);
-    connect(recognizer, &WhisperRecognizer::textRecognized, this, &MainWindow::onTextRecognized);
-    connect(recognizer, SIGNAL(waveformUpdated(const QVector<float> &)),
-            waveformWidget, SLOT(updateWaveform(const QVector<float> &)));
+    connect(loadModelButton, &QPushButton::clicked, this, &MainWindow::onLoadModelButtonClicked);
+    connect(modelManager, &ModelManager::modelLoading, this, &MainWindow::onModelLoading);
+    connect(modelManager, &ModelManager::modelReady, this, &MainWindow::onModelReady);
+    connect(modelManager, &ModelManager::modelFailed, this, &MainWindow::onModelFailed);
+    connect(recognizer, &WhisperRecognizer::partialTextRecognized, this, &MainWindow::onPartialTextRecognized);
+    connect(recognizer, &WhisperRecognizer::segmentFinalized, this, &MainWindow::onTextRecognized);
+    waveformWidget->setPeaks(recognizer->waveformPeaks());
+    connect(recognizer, &WhisperRecognizer::waveformUpdated, waveformWidget, &WaveformWidget::updateWaveform);
+    connect(recognizer, &WhisperRecognizer::pipelineStatsUpdated, this, &MainWindow::onPipelineStatsUpdated);
+    connect(recognizer, &WhisperRecognizer::rtfUpdated, this, &MainWindow::onRtfUpdated);
 
     // Дополнительные настройки или инициализация
     // Например, установка иконки для кнопки
@@ -83,36 +117,124 @@ void MainWindow::onStartStopButtonClicked()
         startStopButton->setIcon(style()->standardIcon(QStyle::SP_MediaPlay));
         qDebug() << "Распознавание остановлено по кнопке.";
     } else {
-        // Если распознавание остановлено, запускаем его
-        // !!! Здесь нужно указать путь к модели whisper !!!
-        // Пока используем заглушку "ggml-base.en.bin", предполагая, что она в текущей директории или путях поиска
-        recognizer->startRecognition("../models/ggml-base.en.bin"); // Передаем относительный путь к модели
+        // Если распознавание остановлено, запускаем его на уже загруженной модели
+        recognizer->startRecognition();
         startStopButton->setText("Stop Recognition");
         startStopButton->setIcon(style()->standardIcon(QStyle::SP_MediaStop));
         recognizedTextEdit->clear(); // Очищаем поле текста при новом запуске
+        hasOpenSegment = false;
         recognizedTextEdit->appendPlainText("--- Распознавание запущено ---"); // Вставляем тестовую строку
         qDebug() << "Распознавание запущено по кнопке.";
     }
 }
 
-void MainWindow::onTextRecognized(const QString &text)
+void MainWindow::setSegmentText(quint64 segmentId, const QString &text, bool isFinal)
 {
-    qDebug() << "Received recognized text:" << text; // DEBUG: Проверяем, что приходит в слот
+    const QString trimmedText = text.trimmed();
+
+    QTextCursor cursor(recognizedTextEdit->document());
+    cursor.movePosition(QTextCursor::End);
 
-    // Trim whitespace from the recognized text
-    QString trimmedText = text.trimmed();
+    // Промежуточный текст показываем серым, окончательный - обычным цветом
+    QTextCharFormat format;
+    if (!isFinal) {
+        format.setForeground(Qt::gray);
+    }
+
+    if (hasOpenSegment && openSegmentId == segmentId) {
+        // Заменяем промежуточный текст сегмента на месте
+        cursor.movePosition(QTextCursor::StartOfBlock, QTextCursor::KeepAnchor);
+
+        if (trimmedText.isEmpty()) {
+            // Удаляем блок вместе с переводом строки перед ним
+            cursor.movePosition(QTextCursor::PreviousCharacter, QTextCursor::KeepAnchor);
+            cursor.removeSelectedText();
+            hasOpenSegment = false;
+            return;
+        }
 
-    // Append recognized text to the text edit
-    // Only append if the trimmed text is not empty
-    if (!trimmedText.isEmpty()) {
-        recognizedTextEdit->appendPlainText(trimmedText); // Используем appendPlainText для добавления текста
-        qDebug() << "Appended trimmed text to QPlainTextEdit:" << trimmedText; // DEBUG: Подтверждаем выполнение appendPlainText с обрезанным текстом
-        recognizedTextEdit->ensureCursorVisible(); // Прокручиваем к последней строке
+        cursor.insertText(trimmedText, format);
     } else {
-        qDebug() << "Recognized text is empty or only whitespace after trimming. Not appending.";
+        // Only append if the trimmed text is not empty
+        if (trimmedText.isEmpty()) {
+            return;
+        }
+
+        if (!recognizedTextEdit->document()->isEmpty()) {
+            cursor.insertBlock();
+        }
+        cursor.insertText(trimmedText, format);
     }
 
+    hasOpenSegment = !isFinal;
+    openSegmentId = segmentId;
+
+    recognizedTextEdit->ensureCursorVisible(); // Прокручиваем к последней строке
+}
+
+void MainWindow::onPartialTextRecognized(quint64 segmentId, const QString &text)
+{
+    setSegmentText(segmentId, text, false);
+}
+
+void MainWindow::onTextRecognized(quint64 segmentId, const QString &text)
+{
+    setSegmentText(segmentId, text, true);
+
     // TODO: Вставить текст в активное окно с помощью xdotool
     // Для тестирования пока просто выводим в консоль
     // QProcess::startDetached("xdotool type \"" + text + "\""); // Keep original text for xdotool if needed later
-} 
\ No newline at end of file
+}
+
+void MainWindow::onPipelineStatsUpdated(const PipelineStats &stats)
+{
+    pipelineStatsLabel->setText(QString("%6 | Capture: %1% (dropped %2) | Inference: %3% (dropped %4) | UI coalesced: %5 | Skipped silence: %7 s")
+                                    .arg(stats.captureFill)
+                                    .arg(stats.captureDropped)
+                                    .arg(stats.inferenceFill)
+                                    .arg(stats.inferenceDropped)
+                                    .arg(stats.uiCoalesced)
+                                    .arg(stats.speech ? "Speech" : "Silence")
+                                    .arg(stats.gatedSamples / WHISPER_SAMPLE_RATE));
+}
+
+void MainWindow::onRtfUpdated(const RtfStats &stats)
+{
+    rtfLabel->setText(QString("RTF %1 (target %2) | step %3 ms | window %4 ms | threads %5 | encode %6 ms")
+                          .arg(stats.rtf, 0, 'f', 2)
+                          .arg(stats.targetRtf, 0, 'f', 2)
+                          .arg(stats.stepMs)
+                          .arg(stats.lengthMs)
+                          .arg(stats.nThreads)
+                          .arg(stats.encodeMs, 0, 'f', 0));
+}
+
+void MainWindow::onLoadModelButtonClicked()
+{
+    const QString path = QFileDialog::getOpenFileName(this, "Select Whisper Model", "../models",
+                                                      "Whisper models (*.bin)");
+    if (path.isEmpty()) {
+        return;
+    }
+
+    // Загрузка идёт в фоне; текущая модель продолжает работать, пока новая не готова
+    modelManager->requestModel(path, whisper_params().n_threads);
+}
+
+void MainWindow::onModelLoading(const QString &modelPath)
+{
+    statusBar()->showMessage("Loading model " + QFileInfo(modelPath).fileName() + "...");
+}
+
+void MainWindow::onModelReady(const QString &modelPath, qint64 loadMs)
+{
+    recognizer->setModel(modelManager->currentModel());
+    startStopButton->setEnabled(true);
+
+    statusBar()->showMessage(QString("Model %1 ready (%2 ms)").arg(QFileInfo(modelPath).fileName()).arg(loadMs));
+}
+
+void MainWindow::onModelFailed(const QString &modelPath)
+{
+    statusBar()->showMessage("Failed to load model " + modelPath);
+}
@@ -6,8 +6,10 @@
 #include <QVBoxLayout>
 #include <QWidget>
 #include <QLabel>
+#include <QPlainTextEdit>
 
 #include "whisperrecognizer.h"
+#include "modelmanager.h"
 #include "waveformwidget.h"
 
 class MainWindow : public QMainWindow
@@ -20,17 +22,34 @@ public:
 
 private slots:
     void onStartStopButtonClicked();
-    void onTextRecognized(const QString &text);
-    void onWaveformUpdated(const QVector<float> &waveform);
+    void onPartialTextRecognized(quint64 segmentId, const QString &text);
+    void onTextRecognized(quint64 segmentId, const QString &text);
+    void onPipelineStatsUpdated(const PipelineStats &stats);
+    void onRtfUpdated(const RtfStats &stats);
+    void onLoadModelButtonClicked();
+    void onModelLoading(const QString &modelPath);
+    void onModelReady(const QString &modelPath, qint64 loadMs);
+    void onModelFailed(const QString &modelPath);
 
 private:
+    void createUi();
+    void setSegmentText(quint64 segmentId, const QString &text, bool isFinal);
+
     QPushButton *startStopButton;
-    QLabel *recognizedTextLabel;
+    QPushButton *loadModelButton;
+    QPlainTextEdit *recognizedTextEdit;
+    QLabel *pipelineStatsLabel;
+    QLabel *rtfLabel;
     WaveformWidget *waveformWidget;
     WhisperRecognizer *recognizer;
+    ModelManager *modelManager;
 
     bool isRecognitionActive = false;
 
+    // Последний блок текста - промежуточная гипотеза этого сегмента
+    bool hasOpenSegment = false;
+    quint64 openSegmentId = 0;
+
     // Add other UI elements here later
 };
 
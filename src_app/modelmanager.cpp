@@ -0,0 +1,153 @@
+#include "modelmanager.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <vector>
+
+WhisperModel::~WhisperModel()
+{
+    if (state) {
+        whisper_free_state(state);
+    }
+    if (ctx) {
+        whisper_free(ctx);
+    }
+}
+
+ModelManager::ModelManager(QObject *parent)
+    : QThread(parent)
+{
+}
+
+ModelManager::~ModelManager()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pendingPath.clear();
+    }
+
+    // Загрузку прервать нельзя, дожидаемся её окончания
+    wait();
+}
+
+void ModelManager::requestModel(const QString &modelPath, int nThreads)
+{
+    bool needStart = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_pendingPath = modelPath.toStdString();
+        m_nThreads = nThreads;
+
+        if (!m_busy) {
+            m_busy = true;
+            needStart = true;
+        }
+    }
+
+    if (needStart) {
+        // Поток мог ещё не выйти из run() после предыдущей загрузки
+        wait();
+        start();
+    }
+}
+
+WhisperModelPtr ModelManager::currentModel() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_current;
+}
+
+void ModelManager::run()
+{
+    while (true) {
+        std::string path;
+        int nThreads = 1;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if (m_pendingPath.empty()) {
+                m_busy = false;
+                return;
+            }
+
+            path.swap(m_pendingPath);
+            nThreads = m_nThreads;
+        }
+
+        const QString qpath = QString::fromStdString(path);
+        emit modelLoading(qpath);
+
+        QElapsedTimer timer;
+        timer.start();
+
+        WhisperModelPtr model = loadModel(path, nThreads);
+        if (!model) {
+            emit modelFailed(qpath);
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_current = model;
+        }
+
+        qDebug() << "Whisper model" << qpath << "is ready in" << timer.elapsed() << "ms";
+        emit modelReady(qpath, timer.elapsed());
+    }
+}
+
+WhisperModelPtr ModelManager::loadModel(const std::string &modelPath, int nThreads)
+{
+    WhisperModelPtr model = std::make_shared<WhisperModel>();
+    model->path = modelPath;
+
+    whisper_context_params cparams = whisper_context_default_params();
+    model->ctx = whisper_init_from_file_with_params_no_state(modelPath.c_str(), cparams);
+
+    if (model->ctx == nullptr) {
+        qDebug() << "Failed to load whisper model from" << QString::fromStdString(modelPath);
+        return nullptr;
+    }
+
+    model->state = whisper_init_state(model->ctx);
+    if (model->state == nullptr) {
+        qDebug() << "Failed to allocate whisper state for" << QString::fromStdString(modelPath);
+        return nullptr;
+    }
+
+    warmUp(*model, nThreads);
+
+    return model;
+}
+
+// Один проход кодировщика и декодера по секунде тишины: буферы вычислений,
+// страницы весов и ядра бэкенда оказываются готовы до первого нажатия Start
+void ModelManager::warmUp(WhisperModel &model, int nThreads)
+{
+    const std::vector<float> silence(WHISPER_SAMPLE_RATE, 0.0f);
+
+    struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.n_threads        = nThreads;
+    wparams.language         = "en"; // без определения языка - ровно один проход кодировщика
+    wparams.no_context       = true;
+    wparams.no_timestamps    = true;
+    wparams.single_segment   = true;
+    wparams.print_special    = false;
+    wparams.print_progress   = false;
+    wparams.print_realtime   = false;
+    wparams.print_timestamps = false;
+    wparams.max_tokens       = 1;
+    wparams.temperature_inc  = 0.0f; // без повторов с повышенной температурой
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (whisper_full_with_state(model.ctx, model.state, wparams, silence.data(), silence.size()) != 0) {
+        qWarning() << "Warm-up pass failed, the first step will be slower.";
+        return;
+    }
+
+    qDebug() << "Warm-up pass took" << timer.elapsed() << "ms";
+}
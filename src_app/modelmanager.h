@@ -0,0 +1,65 @@
+#ifndef MODELMANAGER_H
+#define MODELMANAGER_H
+
+#include <QThread>
+#include <QObject>
+#include <QString>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "whisper.h"
+
+// Загруженная модель: контекст и прогретое состояние, готовые к whisper_full_with_state.
+// Освобождается, когда отпускается последняя ссылка, поэтому при смене модели
+// распознавание спокойно дорабатывает шаг на старой.
+struct WhisperModel {
+    std::string path;
+    struct whisper_context *ctx   = nullptr;
+    struct whisper_state   *state = nullptr;
+
+    WhisperModel() = default;
+    WhisperModel(const WhisperModel &) = delete;
+    WhisperModel &operator=(const WhisperModel &) = delete;
+    ~WhisperModel();
+};
+
+using WhisperModelPtr = std::shared_ptr<WhisperModel>;
+
+// Держит модель резидентной между сессиями распознавания и загружает новые
+// модели в фоновом потоке, не блокируя GUI
+class ModelManager : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit ModelManager(QObject *parent = nullptr);
+    ~ModelManager();
+
+    // Запрашивает загрузку модели; повторные запросы во время загрузки
+    // заменяют ожидающий, загружается только последний
+    void requestModel(const QString &modelPath, int nThreads);
+
+    // Текущая готовая модель или nullptr, пока ничего не загружено
+    WhisperModelPtr currentModel() const;
+
+signals:
+    void modelLoading(const QString &modelPath);
+    void modelReady(const QString &modelPath, qint64 loadMs);
+    void modelFailed(const QString &modelPath);
+
+protected:
+    void run() override;
+
+private:
+    static WhisperModelPtr loadModel(const std::string &modelPath, int nThreads);
+    static void warmUp(WhisperModel &model, int nThreads);
+
+    mutable std::mutex m_mutex;
+    WhisperModelPtr m_current;
+    std::string m_pendingPath;
+    int m_nThreads = 1;
+    bool m_busy = false;
+};
+
+#endif // MODELMANAGER_H
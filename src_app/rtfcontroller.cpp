@@ -0,0 +1,110 @@
+#include "rtfcontroller.h"
+
+#include <algorithm>
+
+namespace {
+    // Сглаживание замеров и пауза после изменения, чтобы новые настройки успели проявиться
+    const float kSmoothing    = 0.3f;
+    const int   kCooldownSteps = 3;
+
+    const int kStepIncrementMs   = 500;
+    const int kLengthIncrementMs = 1000;
+
+    // Ниже этой доли цели запас считается большим
+    const float kSlackRatio = 0.4f;
+
+    // Потоки оставляем, только если кодировщик ускорился хотя бы на 5%
+    const float kThreadGain = 0.95f;
+
+    float smooth(float prev, float value)
+    {
+        return prev < 0.0f ? value : prev + kSmoothing * (value - prev);
+    }
+}
+
+void RtfController::reset(const Params &params, const Settings &initial)
+{
+    m_params   = params;
+    m_settings = initial;
+
+    m_settings.stepMs   = std::max(params.minStepMs, std::min(params.maxStepMs, initial.stepMs));
+    m_settings.lengthMs = std::max(params.minLengthMs, std::min(params.maxLengthMs, initial.lengthMs));
+    m_settings.nThreads = std::max(params.minThreads, std::min(params.maxThreads, initial.nThreads));
+
+    m_rtf = m_encodeMs = m_decodeMs = -1.0f;
+    m_cooldown = 0;
+    m_probing = false;
+    m_threadCeiling = params.maxThreads;
+}
+
+void RtfController::setThreads(int nThreads)
+{
+    m_probing = true;
+    m_probeFrom = m_settings.nThreads;
+    m_probeEncodeMs = m_encodeMs;
+
+    m_settings.nThreads = nThreads;
+
+    // Старое сглаженное время относится к другому числу потоков
+    m_encodeMs = -1.0f;
+}
+
+bool RtfController::update(const Measurement &m)
+{
+    m_rtf      = smooth(m_rtf, m.processMs / float(std::max(1, m_settings.stepMs)));
+    m_encodeMs = smooth(m_encodeMs, m.encodeMs);
+    m_decodeMs = smooth(m_decodeMs, m.decodeMs);
+
+    if (m_cooldown > 0) {
+        --m_cooldown;
+        return false;
+    }
+
+    Settings &s = m_settings;
+
+    if (m_probing) {
+        m_probing = false;
+
+        if (m_encodeMs > m_probeEncodeMs * kThreadGain && s.nThreads > m_probeFrom) {
+            // Дополнительный поток не помог - упёрлись в память или ядра
+            m_threadCeiling = m_probeFrom;
+            s.nThreads = m_probeFrom;
+            m_encodeMs = m_probeEncodeMs;
+            m_cooldown = kCooldownSteps;
+            return true;
+        }
+    }
+
+    bool changed = false;
+
+    if (m_rtf > m_params.targetRtf) {
+        if (s.nThreads < m_threadCeiling) {
+            setThreads(s.nThreads + 1);
+            changed = true;
+        } else if (s.stepMs < m_params.maxStepMs) {
+            s.stepMs = std::min(m_params.maxStepMs, s.stepMs + kStepIncrementMs);
+            changed = true;
+        } else if (s.lengthMs > m_params.minLengthMs) {
+            s.lengthMs = std::max(m_params.minLengthMs, s.lengthMs - kLengthIncrementMs);
+            changed = true;
+        }
+    } else if (m_rtf < m_params.targetRtf * kSlackRatio) {
+        if (s.lengthMs < m_params.maxLengthMs) {
+            s.lengthMs = std::min(m_params.maxLengthMs, s.lengthMs + kLengthIncrementMs);
+            changed = true;
+        } else if (s.stepMs > m_params.minStepMs) {
+            s.stepMs = std::max(m_params.minStepMs, s.stepMs - kStepIncrementMs);
+            changed = true;
+        } else if (s.nThreads > m_params.minThreads) {
+            s.nThreads -= 1;
+            m_encodeMs = -1.0f;
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        m_cooldown = kCooldownSteps;
+    }
+
+    return changed;
+}
@@ -0,0 +1,80 @@
+#ifndef RTFCONTROLLER_H
+#define RTFCONTROLLER_H
+
+#include <QMetaType>
+
+// Подстраивает шаг, длину окна и число потоков под
+// измеренный real-time factor: время обработки шага / длительность шага.
+// audio_ctx whisper_full подбирает сам по длине окна (audio_ctx = -1).
+// Если RTF выше цели - сначала добавляет потоки, пока это ускоряет кодировщик,
+// затем увеличивает шаг и укорачивает окно. Если запас большой - в обратном
+// порядке возвращает длину окна, уменьшает задержку и освобождает ядра.
+class RtfController
+{
+public:
+    struct Params {
+        float targetRtf   = 0.5f;  // доля шага, которую может занимать обработка
+        int   minStepMs   = 1000;
+        int   maxStepMs   = 5000;
+        int   minLengthMs = 5000;
+        int   maxLengthMs = 10000; // исходная длина окна, к ней контроллер возвращается
+        int   minThreads  = 1;
+        int   maxThreads  = 4;
+    };
+
+    struct Settings {
+        int stepMs   = 3000;
+        int lengthMs = 10000;
+        int nThreads = 4;
+    };
+
+    // Замер одного шага: полное время whisper_full и средние из whisper_timings
+    struct Measurement {
+        float processMs = 0.0f;
+        float encodeMs  = 0.0f;
+        float decodeMs  = 0.0f;
+    };
+
+    void reset(const Params &params, const Settings &initial);
+
+    // Учитывает замер, возвращает true, если настройки изменились
+    bool update(const Measurement &m);
+
+    const Settings &settings() const { return m_settings; }
+    float rtf() const { return m_rtf; }
+    float encodeMs() const { return m_encodeMs; }
+    float decodeMs() const { return m_decodeMs; }
+
+private:
+    void setThreads(int nThreads);
+
+    Params   m_params;
+    Settings m_settings;
+
+    float m_rtf      = -1.0f; // сглаженные значения, < 0 - замеров ещё не было
+    float m_encodeMs = -1.0f;
+    float m_decodeMs = -1.0f;
+
+    int m_cooldown = 0;       // шагов до следующего изменения
+
+    // Проба числа потоков: если кодировщик не ускорился, возвращаемся и больше не пробуем
+    bool  m_probing = false;
+    int   m_probeFrom = 0;
+    float m_probeEncodeMs = 0.0f;
+    int   m_threadCeiling = 0;
+};
+
+// Текущее состояние контроллера для UI
+struct RtfStats {
+    float rtf       = 0.0f;
+    float targetRtf = 0.0f;
+    float encodeMs  = 0.0f;
+    float decodeMs  = 0.0f;
+    int   stepMs    = 0;
+    int   lengthMs  = 0;
+    int   nThreads  = 0;
+};
+
+Q_DECLARE_METATYPE(RtfStats)
+
+#endif // RTFCONTROLLER_H
@@ -0,0 +1,79 @@
+#include "slidingaudiowindow.h"
+
+#include <algorithm>
+#include <cstring>
+
+SlidingAudioWindow::SlidingAudioWindow(size_t capacity)
+{
+    reset(capacity);
+}
+
+void SlidingAudioWindow::reset(size_t capacity)
+{
+    m_buffer.assign(capacity, 0.0f);
+    m_head = 0;
+    m_size = 0;
+    m_total = 0;
+}
+
+void SlidingAudioWindow::clear()
+{
+    m_head = 0;
+    m_size = 0;
+}
+
+void SlidingAudioWindow::push(const float *data, size_t n)
+{
+    const size_t cap = m_buffer.size();
+    if (cap == 0 || n == 0) {
+        return;
+    }
+
+    m_total += n;
+
+    // В окно всё равно попадут только последние cap семплов
+    if (n > cap) {
+        data += n - cap;
+        n = cap;
+    }
+
+    // Позиция записи - сразу за последним семплом
+    size_t pos = (m_head + m_size) % cap;
+
+    const size_t n0 = std::min(n, cap - pos);
+    memcpy(m_buffer.data() + pos, data, n0*sizeof(float));
+    memcpy(m_buffer.data(), data + n0, (n - n0)*sizeof(float));
+
+    if (m_size + n > cap) {
+        // Перезаписали самые старые семплы - сдвигаем начало окна
+        const size_t n_drop = m_size + n - cap;
+        m_head = (m_head + n_drop) % cap;
+        m_size = cap;
+    } else {
+        m_size += n;
+    }
+}
+
+void SlidingAudioWindow::keepLast(size_t n)
+{
+    if (n >= m_size) {
+        return;
+    }
+
+    m_head = (m_head + (m_size - n)) % m_buffer.size();
+    m_size = n;
+}
+
+void SlidingAudioWindow::copyTo(std::vector<float> &dst) const
+{
+    dst.resize(m_size);
+    if (m_size == 0) {
+        return;
+    }
+
+    const size_t cap = m_buffer.size();
+    const size_t n0 = std::min(m_size, cap - m_head);
+
+    memcpy(dst.data(), m_buffer.data() + m_head, n0*sizeof(float));
+    memcpy(dst.data() + n0, m_buffer.data(), (m_size - n0)*sizeof(float));
+}
@@ -0,0 +1,43 @@
+#ifndef SLIDINGAUDIOWINDOW_H
+#define SLIDINGAUDIOWINDOW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Кольцевой буфер фиксированной ёмкости (length + keep семплов) для потокового распознавания.
+// Память выделяется один раз в reset(), дальше push()/keepLast() работают без аллокаций,
+// поэтому стоимость шага не зависит от длительности сессии.
+class SlidingAudioWindow
+{
+public:
+    explicit SlidingAudioWindow(size_t capacity = 0);
+
+    void reset(size_t capacity);
+    void clear();
+
+    // Добавляет новые семплы; если окно переполнено, самые старые вытесняются
+    void push(const float *data, size_t n);
+
+    // Оставляет только последние n семплов (перекрытие между окнами)
+    void keepLast(size_t n);
+
+    // Копирует окно (от старых семплов к новым) в dst.
+    // Если у dst достаточная ёмкость, перераспределения памяти не происходит.
+    void copyTo(std::vector<float> &dst) const;
+
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_buffer.size(); }
+    bool isFull() const { return m_size == m_buffer.size(); }
+
+    // Абсолютная позиция (в семплах) конца окна с момента reset()
+    uint64_t totalPushed() const { return m_total; }
+
+private:
+    std::vector<float> m_buffer;
+    size_t m_head = 0; // индекс самого старого семпла
+    size_t m_size = 0;
+    uint64_t m_total = 0;
+};
+
+#endif // SLIDINGAUDIOWINDOW_H
@@ -0,0 +1,84 @@
+#define _USE_MATH_DEFINES // for M_PI
+
+#include "speechgate.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const int kFrameMs = 20;
+
+    // Фон быстро опускается и медленно поднимается: короткие паузы
+    // между словами не успевают поднять порог
+    const float kFloorAttack  = 0.5f;
+    const float kFloorRelease = 0.01f;
+}
+
+void SpeechGate::reset(const Params &params, int sampleRate)
+{
+    m_params     = params;
+    m_sampleRate = sampleRate;
+    m_frameSize  = size_t(sampleRate * kFrameMs / 1000);
+
+    // Однополюсный фильтр верхних частот, убирает гул и постоянную составляющую
+    const float rc = 1.0f / (2.0f * float(M_PI) * params.highPassHz);
+    const float dt = 1.0f / float(sampleRate);
+    m_alpha = rc / (rc + dt);
+
+    m_prevIn  = 0.0f;
+    m_prevOut = 0.0f;
+
+    m_noiseFloor = -1.0f;
+    m_speech = false;
+    m_silentSamples = 0;
+}
+
+SpeechGate::Event SpeechGate::process(const float *data, size_t n)
+{
+    if (!m_params.enabled || n == 0) {
+        return None;
+    }
+
+    float energy = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        const float y = m_alpha * (m_prevOut + data[i] - m_prevIn);
+        m_prevIn  = data[i];
+        m_prevOut = y;
+
+        energy += std::fabs(y);
+    }
+    energy /= float(n);
+
+    if (m_noiseFloor < 0.0f) {
+        m_noiseFloor = energy;
+    }
+
+    const bool loud = energy > std::max(m_params.minEnergy, m_noiseFloor * m_params.thresholdRatio);
+
+    if (!loud) {
+        const float k = energy < m_noiseFloor ? kFloorAttack : kFloorRelease;
+        m_noiseFloor += k * (energy - m_noiseFloor);
+    }
+
+    if (loud) {
+        m_silentSamples = 0;
+
+        if (!m_speech) {
+            m_speech = true;
+            return SpeechStart;
+        }
+
+        return None;
+    }
+
+    if (m_speech) {
+        m_silentSamples += n;
+
+        if (m_silentSamples >= size_t(m_params.endSilenceMs) * m_sampleRate / 1000) {
+            m_speech = false;
+            return SpeechEnd;
+        }
+    }
+
+    return None;
+}
@@ -0,0 +1,54 @@
+#ifndef SPEECHGATE_H
+#define SPEECHGATE_H
+
+#include <cstddef>
+
+// Дешёвый энергетический детектор речи для отсечения тишины до распознавания.
+// Как vad_simple из examples/common.cpp: фильтр верхних частот и средний модуль
+// сигнала, но считается инкрементально по кадрам и сравнивается с адаптивным
+// уровнем фонового шума, а не с энергией всего окна.
+class SpeechGate
+{
+public:
+    struct Params {
+        bool  enabled        = true;
+        float highPassHz     = 100.0f;
+        float thresholdRatio = 3.0f;   // во сколько раз кадр громче фона, чтобы считаться речью
+        float minEnergy      = 1e-3f;  // абсолютный порог среднего модуля, ниже - всегда тишина
+        int   endSilenceMs   = 800;    // тишина после речи, после которой фраза закончена
+    };
+
+    enum Event {
+        None,
+        SpeechStart,
+        SpeechEnd,
+    };
+
+    void reset(const Params &params, int sampleRate);
+
+    // Классифицирует очередной кусок аудио; длина куска - порядка frameSize()
+    Event process(const float *data, size_t n);
+
+    // Идёт фраза: от первого громкого кадра до endSilenceMs тишины после последнего
+    bool isSpeech() const { return m_speech; }
+
+    bool enabled() const { return m_params.enabled; }
+
+    size_t frameSize() const { return m_frameSize; }
+
+private:
+    Params m_params;
+    int    m_sampleRate = 0;
+    size_t m_frameSize  = 0;
+
+    // Состояние фильтра верхних частот
+    float m_alpha = 0.0f;
+    float m_prevIn  = 0.0f;
+    float m_prevOut = 0.0f;
+
+    float  m_noiseFloor = -1.0f;
+    bool   m_speech = false;
+    size_t m_silentSamples = 0;
+};
+
+#endif // SPEECHGATE_H
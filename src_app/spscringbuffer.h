@@ -0,0 +1,93 @@
+#ifndef SPSCRINGBUFFER_H
+#define SPSCRINGBUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lock-free кольцевой буфер для одного писателя и одного читателя.
+// Курсоры монотонно растут, индекс в буфере - курсор по маске (ёмкость - степень двойки).
+// Писатель никогда не ждёт читателя: то, что не поместилось, отбрасывается, и push()
+// возвращает количество реально записанных элементов - это и есть сигнал backpressure.
+template <typename T>
+class SpscRingBuffer
+{
+public:
+    explicit SpscRingBuffer(size_t capacity = 0)
+    {
+        reset(capacity);
+    }
+
+    // Не потокобезопасно: вызывать, пока ни писатель, ни читатель не работают
+    void reset(size_t capacity)
+    {
+        size_t cap = 1;
+        while (cap < capacity) {
+            cap <<= 1;
+        }
+
+        m_buffer.assign(capacity > 0 ? cap : 0, T());
+        m_mask = m_buffer.empty() ? 0 : cap - 1;
+
+        m_write.store(0, std::memory_order_relaxed);
+        m_read.store(0, std::memory_order_relaxed);
+    }
+
+    // Только писатель
+    size_t push(const T *data, size_t n)
+    {
+        const uint64_t w = m_write.load(std::memory_order_relaxed);
+        const uint64_t r = m_read.load(std::memory_order_acquire);
+
+        const size_t n_free = m_buffer.size() - size_t(w - r);
+        n = std::min(n, n_free);
+
+        for (size_t i = 0; i < n; ++i) {
+            m_buffer[(w + i) & m_mask] = data[i];
+        }
+
+        m_write.store(w + n, std::memory_order_release);
+
+        return n;
+    }
+
+    // Только читатель
+    size_t pop(T *data, size_t n)
+    {
+        const uint64_t r = m_read.load(std::memory_order_relaxed);
+        const uint64_t w = m_write.load(std::memory_order_acquire);
+
+        n = std::min(n, size_t(w - r));
+
+        for (size_t i = 0; i < n; ++i) {
+            data[i] = m_buffer[(r + i) & m_mask];
+        }
+
+        m_read.store(r + n, std::memory_order_release);
+
+        return n;
+    }
+
+    // Приблизительное значение, если вызывается не из читателя/писателя
+    size_t size() const
+    {
+        const uint64_t w = m_write.load(std::memory_order_acquire);
+        const uint64_t r = m_read.load(std::memory_order_acquire);
+
+        return size_t(w - r);
+    }
+
+    size_t capacity() const { return m_buffer.size(); }
+
+private:
+    std::vector<T> m_buffer;
+    size_t m_mask = 0;
+
+    // Курсоры на разных кэш-линиях, чтобы писатель и читатель не мешали друг другу
+    alignas(64) std::atomic<uint64_t> m_write{0};
+    alignas(64) std::atomic<uint64_t> m_read{0};
+};
+
+#endif // SPSCRINGBUFFER_H
@@ -0,0 +1,85 @@
+#include "transcriptstabilizer.h"
+
+#include <QRegularExpression>
+
+#include <algorithm>
+
+namespace {
+    QStringList splitWords(const QString &text)
+    {
+        static const QRegularExpression re("\\s+");
+        return text.split(re, Qt::SkipEmptyParts);
+    }
+
+    QString joinRange(const QStringList &words, int from, int to)
+    {
+        return words.mid(from, to - from).join(' ');
+    }
+}
+
+QString TranscriptStabilizer::update(const QString &hypothesis)
+{
+    const QStringList words = splitWords(hypothesis);
+
+    // Длина общего префикса с предыдущей гипотезой
+    int n_agree = 0;
+    const int n_max = int(std::min(words.size(), m_previous.size()));
+    while (n_agree < n_max && words[n_agree] == m_previous[n_agree]) {
+        ++n_agree;
+    }
+
+    m_previous = words;
+
+    if (n_agree <= m_committed) {
+        return QString();
+    }
+
+    const QString stable = joinRange(words, m_committed, n_agree);
+    m_committed = n_agree;
+
+    return stable;
+}
+
+QString TranscriptStabilizer::finalize()
+{
+    QString rest;
+    if (m_committed < m_previous.size()) {
+        rest = joinRange(m_previous, m_committed, int(m_previous.size()));
+    }
+
+    reset();
+
+    return rest;
+}
+
+void TranscriptStabilizer::reset()
+{
+    m_previous.clear();
+    m_committed = 0;
+}
+
+QString TranscriptStabilizer::pending() const
+{
+    if (m_committed >= m_previous.size()) {
+        return QString();
+    }
+
+    return joinRange(m_previous, m_committed, int(m_previous.size()));
+}
+
+QString TranscriptStabilizer::committed() const
+{
+    return joinRange(m_previous, 0, m_committed);
+}
+
+QString TranscriptStabilizer::preview(const QString &hypothesis) const
+{
+    const QStringList words = splitWords(hypothesis);
+
+    QStringList result = m_previous.mid(0, m_committed);
+    if (words.size() > m_committed) {
+        result += words.mid(m_committed);
+    }
+
+    return result.join(' ');
+}
@@ -0,0 +1,37 @@
+#ifndef TRANSCRIPTSTABILIZER_H
+#define TRANSCRIPTSTABILIZER_H
+
+#include <QString>
+#include <QStringList>
+
+// Фиксация стабильного текста при распознавании скользящим окном.
+// Слово считается стабильным, когда оно совпало в двух последовательных гипотезах
+// для одного и того же окна (local agreement). Зафиксированный текст больше не меняется,
+// поэтому наружу отдаются только новые стабильные слова.
+class TranscriptStabilizer
+{
+public:
+    // Принимает новую гипотезу для текущего окна, возвращает вновь зафиксированный текст
+    QString update(const QString &hypothesis);
+
+    // Окно закончилось: фиксирует остаток последней гипотезы и начинает новое окно
+    QString finalize();
+
+    void reset();
+
+    // Ещё не зафиксированный хвост последней гипотезы
+    QString pending() const;
+
+    // Весь зафиксированный текст текущего окна
+    QString committed() const;
+
+    // Текст для показа промежуточной гипотезы: зафиксированные слова не меняются,
+    // из hypothesis берётся только то, что идёт после них
+    QString preview(const QString &hypothesis) const;
+
+private:
+    QStringList m_previous;  // слова последней гипотезы
+    int m_committed = 0;     // сколько слов текущего окна уже отдано наружу
+};
+
+#endif // TRANSCRIPTSTABILIZER_H
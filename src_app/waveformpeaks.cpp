@@ -0,0 +1,130 @@
+#include "waveformpeaks.h"
+
+#include <algorithm>
+
+void WaveformPeaks::reset(size_t windowSamples, size_t baseBinSize, int nLevels)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_levels.clear();
+
+    size_t binSize = std::max<size_t>(1, baseBinSize);
+    for (int i = 0; i < nLevels && binSize <= windowSamples; ++i) {
+        Level level;
+        level.binSize = binSize;
+        level.bins.resize((windowSamples + binSize - 1) / binSize);
+
+        m_levels.push_back(level);
+        binSize *= 2;
+    }
+
+    m_version.fetch_add(1, std::memory_order_release);
+}
+
+void WaveformPeaks::pushBin(size_t level, Peak peak)
+{
+    while (level < m_levels.size()) {
+        Level &lv = m_levels[level];
+
+        lv.bins[lv.head] = peak;
+        lv.head = (lv.head + 1) % lv.bins.size();
+        lv.count = std::min(lv.count + 1, lv.bins.size());
+
+        if (level + 1 >= m_levels.size()) {
+            return;
+        }
+
+        // Два интервала уровня образуют один интервал следующего
+        Level &parent = m_levels[level + 1];
+        if (parent.partialN == 0) {
+            parent.partial = peak;
+        } else {
+            parent.partial.min = std::min(parent.partial.min, peak.min);
+            parent.partial.max = std::max(parent.partial.max, peak.max);
+        }
+
+        if (++parent.partialN < 2) {
+            return;
+        }
+
+        parent.partialN = 0;
+        ++level;
+        peak = parent.partial;
+    }
+}
+
+void WaveformPeaks::push(const float *data, size_t n)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_levels.empty()) {
+        return;
+    }
+
+    Level &base = m_levels[0];
+
+    for (size_t i = 0; i < n; ++i) {
+        const float x = data[i];
+
+        if (base.partialN == 0) {
+            base.partial.min = x;
+            base.partial.max = x;
+        } else {
+            base.partial.min = std::min(base.partial.min, x);
+            base.partial.max = std::max(base.partial.max, x);
+        }
+
+        if (++base.partialN == base.binSize) {
+            base.partialN = 0;
+            pushBin(0, base.partial);
+        }
+    }
+
+    m_version.fetch_add(1, std::memory_order_release);
+}
+
+uint64_t WaveformPeaks::render(int nColumns, std::vector<Peak> &columns, float &maxAbs) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const uint64_t version = m_version.load(std::memory_order_relaxed);
+
+    columns.assign(std::max(nColumns, 0), Peak());
+    maxAbs = 0.0f;
+
+    if (nColumns <= 0 || m_levels.empty() || m_levels[0].count == 0) {
+        return version;
+    }
+
+    // Пока окно не заполнено, растягиваем по ширине то, что есть
+    const size_t filled = m_levels[0].count * m_levels[0].binSize;
+    const double samplesPerColumn = double(filled) / nColumns;
+
+    // Самый грубый уровень, у которого на колонку приходится хотя бы один интервал
+    size_t l = 0;
+    while (l + 1 < m_levels.size() && m_levels[l + 1].count > 0 &&
+           double(m_levels[l + 1].binSize) <= samplesPerColumn) {
+        ++l;
+    }
+
+    const Level &lv = m_levels[l];
+    const size_t cap   = lv.bins.size();
+    const size_t first = (lv.head + cap - lv.count) % cap;
+
+    for (int c = 0; c < nColumns; ++c) {
+        const size_t b0 = (size_t(c) * lv.count) / nColumns;
+        const size_t b1 = std::max(b0 + 1, (size_t(c + 1) * lv.count) / nColumns);
+
+        Peak p = lv.bins[(first + b0) % cap];
+        for (size_t b = b0 + 1; b < b1 && b < lv.count; ++b) {
+            const Peak &q = lv.bins[(first + b) % cap];
+            p.min = std::min(p.min, q.min);
+            p.max = std::max(p.max, q.max);
+        }
+
+        columns[c] = p;
+        maxAbs = std::max(maxAbs, std::max(-p.min, p.max));
+    }
+
+    return version;
+}
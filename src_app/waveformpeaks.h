@@ -0,0 +1,58 @@
+#ifndef WAVEFORMPEAKS_H
+#define WAVEFORMPEAKS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Пирамида пиков (min/max) для отрисовки волны.
+// Уровень 0 хранит min/max по baseBinSize семплов, каждый следующий - по вдвое большим
+// интервалам. Каждый уровень - кольцо на длину окна, поэтому пирамида обновляется
+// инкрементально при поступлении аудио, а отрисовка читает только уровень, у которого
+// на колонку экрана приходится один-два интервала, - стоимость кадра зависит от ширины
+// виджета, а не от длины окна.
+//
+// Писатель - стадия подготовки аудио, читатель - UI. Блокировка короткая с обеих сторон,
+// version() позволяет читателю не перестраивать колонки, если данные не менялись.
+class WaveformPeaks
+{
+public:
+    struct Peak {
+        float min = 0.0f;
+        float max = 0.0f;
+    };
+
+    // Не потокобезопасно относительно push(): вызывать до старта писателя
+    void reset(size_t windowSamples, size_t baseBinSize = 64, int nLevels = 8);
+
+    // Только писатель
+    void push(const float *data, size_t n);
+
+    uint64_t version() const { return m_version.load(std::memory_order_acquire); }
+
+    // Сворачивает видимое окно в nColumns колонок, возвращает версию данных.
+    // maxAbs - максимум модуля по окну, для масштабирования по высоте
+    uint64_t render(int nColumns, std::vector<Peak> &columns, float &maxAbs) const;
+
+private:
+    struct Level {
+        size_t binSize = 0;
+        std::vector<Peak> bins; // кольцо завершённых интервалов
+        size_t head  = 0;       // куда писать следующий интервал
+        size_t count = 0;       // сколько интервалов в кольце
+
+        Peak   partial;         // текущий незавершённый интервал
+        size_t partialN = 0;    // семплов (уровень 0) или дочерних интервалов в нём
+    };
+
+    void pushBin(size_t level, Peak peak);
+
+    mutable std::mutex m_mutex;
+    std::vector<Level> m_levels;
+
+    std::atomic<uint64_t> m_version{0};
+};
+
+#endif // WAVEFORMPEAKS_H
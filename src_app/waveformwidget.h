@@ -3,28 +3,41 @@
 
 #include <QWidget>
 #include <QVector>
+#include <QLine>
 #include <QPainter>
 #include <QPen>
 #include <QColor>
 #include <vector>
 
+#include "waveformpeaks.h"
+
 class WaveformWidget : public QWidget
 {
     Q_OBJECT
 
 public:
     explicit WaveformWidget(QWidget *parent = nullptr);
-    
+
+    // Источник данных - пирамида пиков конвейера захвата, виджет её не владеет
+    void setPeaks(const WaveformPeaks *peaks);
+
 public slots:
-    void updateWaveform(const QVector<float> &data);
-    
+    void updateWaveform();
+
 protected:
     void paintEvent(QPaintEvent *event) override;
-    
+
 private:
-    QVector<float> m_waveform_data;
+    const WaveformPeaks *m_peaks = nullptr;
+
+    // Колонки последнего кадра: пересчитываются, только если изменились данные или ширина
+    std::vector<WaveformPeaks::Peak> m_columns;
+    float m_maxAmplitude = 0.0f;
+    uint64_t m_columnsVersion = 0;
+    QVector<QLine> m_lines;
+
     QPen m_pen;
     QColor m_backgroundColor;
 };
 
-#endif // WAVEFORMWIDGET_H 
\ No newline at end of file
+#endif // WAVEFORMWIDGET_H
@@ -1,20 +1,35 @@
 #include "whisperrecognizer.h"
-#include "common.h"
-#include "common-whisper.h"
 
 #include <QDebug>
 #include <QElapsedTimer>
-#include <thread>
+#include <algorithm>
 #include <string>
 #include <vector>
 
-// Статические колбэки для SDL Audio
 namespace {
-    audio_async * g_audio_async = nullptr;
+    // Как часто поток распознавания проверяет флаг остановки, пока ждёт аудио
+    const int kWaitTimeoutMs = 100;
 
-    void audio_callback(void * userdata, uint8_t * stream, int len)
+    // Отрезает незавершённую UTF-8 последовательность в конце: токен может
+    // заканчиваться посреди многобайтного символа
+    size_t completeUtf8Length(const std::string &s)
     {
-        g_audio_async->callback(stream, len);
+        size_t n = s.size();
+        size_t i = n;
+        while (i > 0 && n - i < 4 && (uint8_t(s[i - 1]) & 0xC0) == 0x80) {
+            --i;
+        }
+        if (i == 0) {
+            return n;
+        }
+
+        const uint8_t lead = uint8_t(s[i - 1]);
+        size_t len = 1;
+        if      ((lead & 0xE0) == 0xC0) len = 2;
+        else if ((lead & 0xF0) == 0xE0) len = 3;
+        else if ((lead & 0xF8) == 0xF0) len = 4;
+
+        return (n - (i - 1) < len) ? i - 1 : n;
     }
 }
 
@@ -33,13 +48,17 @@ struct whisper_params get_default_params() {
 
 WhisperRecognizer::WhisperRecognizer(QObject *parent)
     : QThread(parent),
-    // Используем значения step_ms и length_ms из m_params, которые инициализируются get_default_params
-      m_audio(get_default_params().step_ms + get_default_params().length_ms)
+      m_pipeline(new AudioPipeline(this))
 {
-    m_ctx = nullptr; // Инициализируем указатель нулевым значением
     m_isRecognitionRunning = false;
     m_params = get_default_params(); // Инициализируем m_params
 
+    qRegisterMetaType<RtfStats>("RtfStats");
+
+    // Волну и статистику конвейер отдаёт сам, поток распознавания в этом не участвует
+    connect(m_pipeline, &AudioPipeline::waveformUpdated, this, &WhisperRecognizer::waveformUpdated);
+    connect(m_pipeline, &AudioPipeline::statsUpdated, this, &WhisperRecognizer::pipelineStatsUpdated);
+
     // Инициализируем SDL субсистемы здесь, если они еще не инициализированы где-то централизованно
     // В противном случае, если SDL_Init уже вызывался, повторный вызов безопасен.
     if (SDL_Init(SDL_INIT_AUDIO) < 0) {
@@ -53,28 +72,36 @@ WhisperRecognizer::~WhisperRecognizer()
     // Поток завершится при завершении функции run()
     stopRecognition(); // Остановка потока
     wait(); // Ждем завершения потока
+}
 
-    freeWhisper();
+void WhisperRecognizer::setModel(const WhisperModelPtr &model)
+{
+    std::lock_guard<std::mutex> lock(m_modelMutex);
+    m_model = model;
 }
 
-void WhisperRecognizer::startRecognition(const QString &modelPath)
+bool WhisperRecognizer::hasModel() const
+{
+    std::lock_guard<std::mutex> lock(m_modelMutex);
+    return m_model != nullptr;
+}
+
+void WhisperRecognizer::startRecognition()
 {
     if (m_isRecognitionRunning) {
         qDebug() << "Recognition is already running.";
         return;
     }
 
-    // Сохраняем путь к модели
-    m_modelPath = modelPath.toStdString();
-
-    // Инициализация whisper и аудио
-    if (!initWhisper()) {
-        qDebug() << "Failed to initialize Whisper.";
+    if (!hasModel()) {
+        qDebug() << "Whisper model is not loaded yet.";
         return;
     }
 
+    // Предыдущий запуск мог ещё дорабатывать шаг: abort_callback прерывает его быстро
+    QThread::wait();
+
     if (!initAudio()) {
-        freeWhisper();
         qDebug() << "Failed to initialize audio.";
         return;
     }
@@ -94,8 +121,8 @@ void WhisperRecognizer::stopRecognition()
     // Сбрасываем флаг
     m_isRecognitionRunning = false;
 
-    // Остановка аудиозахвата
-    m_audio.pause();
+    // Остановка аудиозахвата, ожидание в run() прервётся
+    freeAudio();
 
     qDebug() << "Recognition stopped.";
 }
@@ -105,200 +132,290 @@ bool WhisperRecognizer::isRunning() const
     return m_isRecognitionRunning;
 }
 
+const WaveformPeaks *WhisperRecognizer::waveformPeaks() const
+{
+    return m_pipeline->peaks();
+}
+
 void WhisperRecognizer::run()
 {
     qDebug() << "Whisper recognition thread started.";
 
-    int n_samples = 0; // Общее количество обработанных семплов (для отслеживания смещения)
+    // Контроллер может только укоротить окно, поэтому length_ms - его максимум
+    RtfController::Params controllerParams;
+    controllerParams.targetRtf   = m_params.target_rtf;
+    controllerParams.maxStepMs   = std::max(m_params.step_ms, m_params.max_step_ms);
+    controllerParams.maxLengthMs = m_params.length_ms;
+    controllerParams.minLengthMs = std::min(controllerParams.minLengthMs, m_params.length_ms);
+    controllerParams.maxThreads  = std::max(1, (int) std::thread::hardware_concurrency());
+
+    if (!m_params.adaptive) {
+        controllerParams.minStepMs   = controllerParams.maxStepMs   = m_params.step_ms;
+        controllerParams.minLengthMs = controllerParams.maxLengthMs = m_params.length_ms;
+        controllerParams.minThreads  = controllerParams.maxThreads  = m_params.n_threads;
+    }
 
-    const int n_samples_step = (1e-3 * m_params.step_ms) * WHISPER_SAMPLE_RATE;
-    const int n_samples_len  = (1e-3 * m_params.length_ms) * WHISPER_SAMPLE_RATE;
+    RtfController::Settings initial;
+    initial.stepMs   = m_params.step_ms;
+    initial.lengthMs = m_params.length_ms;
+    initial.nThreads = m_params.n_threads;
+
+    m_controller.reset(controllerParams, initial);
+
+    const int n_samples_max  = (1e-3 * controllerParams.maxLengthMs) * WHISPER_SAMPLE_RATE;
     const int n_samples_keep = (1e-3 * m_params.keep_ms) * WHISPER_SAMPLE_RATE;
 
-    //std::vector<float> pcmf32; // Локальный буфер для аудиоданных - БОЛЬШЕ НЕ ИСПОЛЬЗУЕМ ТАК
-    //std::vector<float> temp_buffer; // Временный буфер для захваченных данных - БОЛЬШЕ НЕ ИСПОЛЬЗУЕМ ТАК
+    // Окно фиксированной ёмкости: length + keep семплов.
+    // Все буферы выделяются здесь один раз, дальше шаг работает без аллокаций
+    // и обрабатывает не больше length + keep семплов независимо от длительности сессии.
+    m_window.reset(n_samples_max + n_samples_keep);
+    m_stabilizer.reset();
+    m_partialTokens = 0;
 
-    // Инициализация буферов перекрытия
-    m_pcmf32_old.clear();
+    m_pcmf32.clear();
+    m_pcmf32.reserve(n_samples_max + n_samples_keep);
     m_pcmf32_new.clear();
+    m_pcmf32_new.reserve(n_samples_max + n_samples_keep);
 
     while (m_isRecognitionRunning) {
-        // Захват аудио (захватываем step_ms данных)
-        // Используем step_ms для получения небольших порций новых данных
-        m_audio.get(m_params.step_ms, m_pcmf32_new);
+        const RtfController::Settings &settings = m_controller.settings();
 
-        if (m_pcmf32_new.empty()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        const int n_samples_step = (1e-3 * settings.stepMs)   * WHISPER_SAMPLE_RATE;
+        const int n_samples_len  = (1e-3 * settings.lengthMs) * WHISPER_SAMPLE_RATE;
+
+        // Ждём, пока стадия подготовки накопит step_ms речи или закончится фраза.
+        // В тишине в очередь ничего не приходит, и кодировщик не запускается
+        if (!m_pipeline->waitForSamples(n_samples_step, kWaitTimeoutMs)) {
             continue;
         }
 
-        // Логика буферизации с перекрытием, как в stream.cpp
-        // take up to params.length_ms audio from previous iteration
-        const int n_samples_take = std::min((int) m_pcmf32_old.size(), std::max(0, n_samples_keep + n_samples_len - (int)m_pcmf32_new.size()));
+        // Забираем всё накопленное, но не больше свободного места в окне.
+        // Остальное остаётся в очереди: если распознавание отстаёт, очередь
+        // заполняется и новые данные отбрасываются на стадии подготовки
+        const size_t n_free = m_window.capacity() - m_window.size();
+        m_pcmf32_new.resize(n_free);
+        m_pcmf32_new.resize(m_pipeline->readSamples(m_pcmf32_new.data(), n_free));
 
-        std::vector<float> pcmf32_processing; // Буфер для текущей обработки
-        pcmf32_processing.resize(m_pcmf32_new.size() + n_samples_take);
+        // Конец фразы: дописываем её сразу, не дожидаясь полного шага
+        const bool endOfUtterance = m_pipeline->takeEndOfUtterance();
 
-        for (int i = 0; i < n_samples_take; i++) {
-            pcmf32_processing[i] = m_pcmf32_old[m_pcmf32_old.size() - n_samples_take + i];
+        if (m_pcmf32_new.empty()) {
+            // Окно уже распознано целиком, повторный проход ничего не добавит
+            if (endOfUtterance) {
+                finalizeSegment();
+                clearWindow();
+            }
+            continue;
         }
 
-        memcpy(pcmf32_processing.data() + n_samples_take, m_pcmf32_new.data(), m_pcmf32_new.size()*sizeof(float));
+        m_window.push(m_pcmf32_new.data(), m_pcmf32_new.size());
+
+        // initialize whisper_full_params for greedy sampling
+        struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+        wparams.n_threads        = settings.nThreads;
+        wparams.audio_ctx        = -1; // контекст кодировщика по длине окна, без 30 с тишины
+        wparams.language         = "auto"; // Всегда auto-detect язык
+        wparams.translate        = false;
+        wparams.no_context       = true;
+        wparams.no_timestamps    = true;
+        wparams.single_segment   = true; // Обрабатываем окно как один сегмент
+        wparams.print_special    = false;
+        wparams.print_progress   = false;
+        wparams.print_realtime   = false;
+        wparams.print_timestamps = false;
+        wparams.token_timestamps = false;
+        wparams.max_len          = 0;
+        wparams.temperature      = 0.8f;
+        wparams.temperature_inc  = 0.2f;
+        wparams.logprob_thold    = -1.0f;
+        wparams.no_speech_thold  = 0.6f;
+
+        // Отключаем VAD, как в оригинальном stream.cpp
+        wparams.vad = false;
+
+        // Остановка прерывает текущий шаг, не дожидаясь конца декодирования
+        wparams.abort_callback = [](void *user_data) {
+            return !static_cast<WhisperRecognizer *>(user_data)->m_isRecognitionRunning.load();
+        };
+        wparams.abort_callback_user_data = this;
+
+        // Промежуточные гипотезы по мере появления токенов
+        wparams.logits_filter_callback = &WhisperRecognizer::onDecoderStep;
+        wparams.logits_filter_callback_user_data = this;
+        m_partialTokens = 0;
+
+        // Ссылка держит модель живой до конца шага, даже если её уже сменили
+        WhisperModelPtr model;
+        {
+            std::lock_guard<std::mutex> lock(m_modelMutex);
+            model = m_model;
+        }
 
-        // Обновляем буфер старых данных для следующей итерации
-        m_pcmf32_old = pcmf32_processing;
+        whisper_reset_timings_from_state(model->state);
 
-        // copy to waveform data (using the processing buffer)
-        {
-            // Создаем QVector для передачи через сигнал
-            QVector<float> waveform_qvector;
-            waveform_qvector.reserve(pcmf32_processing.size());
-            for (float sample : pcmf32_processing) {
-                waveform_qvector.append(sample);
-            }
+        QElapsedTimer stepTimer;
+        stepTimer.start();
 
-            emit waveformUpdated(waveform_qvector); // Передаем QVector<float> для обновления
-        }
+        // Спектрограмма уже в состоянии, whisper_full получает её вместо семплов
+        pushMel(model);
 
-        // process frames
-        // Теперь условие зависит от размера буфера для обработки
-        // В stream.cpp обработка идет порциями step_ms, но whisper_full может работать с length_ms
-        // Попробуем обрабатывать порциями length_ms, как в stream.cpp, когда буфер обработки достаточно большой
-
-        qDebug() << "pcmf32_processing.size():" << pcmf32_processing.size() << ", n_samples_len:" << n_samples_len; // DEBUG: Размер буфера и порог
-
-        if ((int)pcmf32_processing.size() >= n_samples_len) {
-
-            qDebug() << "Calling whisper_full..."; // DEBUG: Вызов whisper_full
-
-            // initialize whisper_full_params for greedy sampling
-            struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-
-            // Настройки параметров распознавания из m_params и хардкода
-            wparams.n_threads       = m_params.n_threads; // Используем n_threads из m_params
-            wparams.language        = "auto"; // Всегда auto-detect язык
-            wparams.translate     = false; // Пока отключаем перевод
-            wparams.no_context    = true; // Пока не сохраняем контекст
-            wparams.no_timestamps = true; // Без временных меток
-            wparams.single_segment  = true; // Обрабатываем как один сегмент
-            wparams.print_special   = false; // Не печатаем спецтокены
-            wparams.print_progress  = false;
-            wparams.print_realtime  = false;
-            wparams.print_timestamps = false;
-            wparams.token_timestamps = false;
-            wparams.max_len = 0;
-            // Дополнительные параметры, которые могут быть нужны для качества:
-            wparams.temperature = 0.8f;
-            wparams.temperature_inc = 0.2f;
-            wparams.logprob_thold = -1.0f;
-            wparams.no_speech_thold = 0.6f;
-            // VAD параметры (используются в whisper_full, если включен VAD)
-            // wparams.vad_thold = m_params.vad_thold;
-            // wparams.freq_thold = m_params.freq_thold;
-
-            // Отключаем VAD, как в оригинальном stream.cpp
-            wparams.vad = false;
-
-            // Beam search параметры (используются если WHISPER_SAMPLING_BEAM_SEARCH)
-            // wparams.beam_search.beam_size = ...
-            // wparams.beam_search.patience = ...
-
-            // [TDRZ] tinydiarize (если модель поддерживает)
-            // wparams.tdrz_enable = m_params.tinydiarize; // Если tinydiarize настраивается
-
-            // Вызов whisper_full на буфере обработки
-            // Передаем контекст whisper, параметры и данные аудио
-            if (whisper_full(m_ctx, wparams, pcmf32_processing.data(), pcmf32_processing.size()) != 0) {
-                fprintf(stderr, "failed to process audio\\n");
-                // continue; // Не пропускаем итерацию, чтобы не потерять данные
-            } else {
-                // extract texts from the new segments
-                const int n_segments = whisper_full_n_segments(m_ctx);
-                qDebug() << "whisper_full returned, n_segments:" << n_segments; // DEBUG: Количество сегментов
-
-                for (int i = 0; i < n_segments; i++) {
-                    const char * text = whisper_full_get_segment_text(m_ctx, i);
-                    qDebug() << "Recognized text segment:" << QString(text); // DEBUG: Выводим распознанный текст
-
-                    emit textRecognized(QString(text));
-                }
+        if (whisper_full_with_state(model->ctx, model->state, wparams, nullptr, 0) != 0) {
+            if (m_isRecognitionRunning) {
+                qWarning() << "failed to process audio";
             }
+        } else {
+            updateController(model->state, stepTimer.nsecsElapsed() / 1e6f);
 
-            // Обновляем общее количество обработанных семплов
-            n_samples += pcmf32_processing.size() - n_samples_take; // Учитываем только новые семплы
+            QString hypothesis;
+            const int n_segments = whisper_full_n_segments_from_state(model->state);
+            for (int i = 0; i < n_segments; i++) {
+                hypothesis += QString::fromUtf8(whisper_full_get_segment_text_from_state(model->state, i));
+            }
 
-            // Очищаем буфер новых данных после использования
-            m_pcmf32_new.clear();
+            // Слова, совпавшие в двух последовательных гипотезах, дальше не меняются
+            m_stabilizer.update(hypothesis);
+            emit partialTextRecognized(m_segmentId, m_stabilizer.preview(hypothesis));
         }
 
-        // Небольшая задержка, чтобы не перегружать процессор
-        QThread::msleep(10);
-    }
-
-    // process any remaining audio (если нужно обработать остаток после остановки)
-    // ЭТОТ БЛОК СЕЙЧАС НЕ АКТИВЕН В НАШЕЙ ЛОГИКЕ, Т.К. МЫ НЕ УДАЛЯЕМ СЕМПЛЫ
-    /*
-    if (!pcmf32.empty()) {
-        // ... логика обработки остатка ...
+        // Окно сдвигается и при ошибке, иначе оно так и останется заполненным
+
+        if (endOfUtterance) {
+            // Дальше тишина, переносить хвост окна в следующую фразу незачем
+            finalizeSegment();
+            clearWindow();
+        } else if ((int) m_window.size() + n_samples_step > n_samples_len) {
+            // Следующий шаг не поместится в length_ms: фиксируем остаток гипотезы и оставляем
+            // keep_ms для следующего окна, чтобы смягчить разрыв слов на границе
+            finalizeSegment();
+            m_window.keepLast(n_samples_keep);
+            whisper_mel_stream_keep(m_melStream, n_samples_keep);
+        }
     }
-    */
 
+    // Остаток последнего окна тоже считается окончательным
+    finalizeSegment();
 
-    // Очистка буферов после завершения распознавания
-    m_pcmf32_old.clear();
+    clearWindow();
     m_pcmf32_new.clear();
-    // pcmf32_processing локальный и будет удален при выходе из scope
+
+    whisper_mel_stream_free(m_melStream);
+    m_melStream = nullptr;
+    m_melModel.reset();
 
     qDebug() << "Whisper recognition thread finished.";
 }
 
-bool WhisperRecognizer::initWhisper()
+void WhisperRecognizer::updateController(struct whisper_state *state, float processMs)
 {
-    // Загрузка модели whisper
-    // TODO: Handle model loading errors
-    whisper_context_params cparams = whisper_context_default_params();
-    m_ctx = whisper_init_from_file_with_params(m_modelPath.c_str(), cparams);
+    const struct whisper_timings timings = whisper_get_timings_from_state(state);
 
-    if (m_ctx == nullptr) {
-        qDebug() << "Failed to load whisper model from" << QString::fromStdString(m_modelPath);
-        return false;
+    RtfController::Measurement m;
+    m.processMs = processMs;
+    m.encodeMs  = timings.encode_ms;
+    m.decodeMs  = timings.decode_ms;
+
+    if (m_controller.update(m)) {
+        const RtfController::Settings &s = m_controller.settings();
+        qDebug() << "RTF" << m_controller.rtf() << "-> step" << s.stepMs << "ms, length" << s.lengthMs
+                 << "ms, threads" << s.nThreads;
     }
 
-    qDebug() << "Whisper model loaded successfully.";
-    return true;
+    RtfStats stats;
+    stats.rtf       = m_controller.rtf();
+    stats.targetRtf = m_params.target_rtf;
+    stats.encodeMs  = m_controller.encodeMs();
+    stats.decodeMs  = m_controller.decodeMs();
+    stats.stepMs    = m_controller.settings().stepMs;
+    stats.lengthMs  = m_controller.settings().lengthMs;
+    stats.nThreads  = m_controller.settings().nThreads;
+
+    emit rtfUpdated(stats);
 }
 
-void WhisperRecognizer::freeWhisper()
+void WhisperRecognizer::pushMel(const WhisperModelPtr &model)
 {
-    if (m_ctx) {
-        whisper_free(m_ctx);
-        m_ctx = nullptr;
-        qDebug() << "Whisper context freed.";
+    if (model != m_melModel) {
+        // Новая модель: спектрограмма всего окна считается заново с её фильтрами
+        whisper_mel_stream_free(m_melStream);
+        m_melStream = whisper_mel_stream_init(model->ctx);
+        m_melModel = model;
+
+        m_window.copyTo(m_pcmf32);
+        whisper_mel_stream_push(m_melStream, m_pcmf32.data(), m_pcmf32.size());
+    } else {
+        whisper_mel_stream_push(m_melStream, m_pcmf32_new.data(), m_pcmf32_new.size());
     }
+
+    whisper_mel_stream_to_state(model->ctx, model->state, m_melStream);
 }
 
-bool WhisperRecognizer::initAudio()
+void WhisperRecognizer::clearWindow()
 {
-    // Инициализация SDL
-    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
-        qDebug() << "SDL could not initialize! SDL_Error:" << SDL_GetError();
-        return false;
+    m_window.clear();
+
+    if (m_melStream) {
+        whisper_mel_stream_reset(m_melStream);
+    }
+}
+
+void WhisperRecognizer::finalizeSegment()
+{
+    QString text = m_stabilizer.committed();
+    const QString rest = m_stabilizer.finalize();
+    if (!rest.isEmpty()) {
+        text = text.isEmpty() ? rest : text + ' ' + rest;
+    }
+
+    // Пустой сегмент тоже финализируется, чтобы UI убрал его промежуточный текст
+    emit segmentFinalized(m_segmentId, text);
+    ++m_segmentId;
+}
+
+void WhisperRecognizer::onDecoderStep(struct whisper_context *ctx, struct whisper_state * /*state*/,
+                                      const whisper_token_data *tokens, int n_tokens,
+                                      float * /*logits*/, void *user_data)
+{
+    WhisperRecognizer *self = static_cast<WhisperRecognizer *>(user_data);
+
+    // При нескольких декодерах (best_of) и повторах с другой температурой callback
+    // вызывается для каждого из них; отдаём гипотезу, только когда она стала длиннее
+    if (n_tokens == 0 || n_tokens <= self->m_partialTokens) {
+        if (n_tokens == 0) {
+            self->m_partialTokens = 0;
+        }
+        return;
     }
+    self->m_partialTokens = n_tokens;
 
-    // TODO: Реализовать выбор аудиоустройства
-    // Пока используем устройство по умолчанию
+    const whisper_token token_eot = whisper_token_eot(ctx);
 
-    // Инициализация m_audio с нужной длиной буфера уже произошла в конструкторе
-    // Теперь инициализируем аудиозахват
-    if (!m_audio.init(m_params.capture_id, WHISPER_SAMPLE_RATE)) {
-         qDebug() << "Failed to initialize audio capture.";
-         return false;
+    std::string &text = self->m_partialUtf8;
+    text.clear();
+    for (int i = 0; i < n_tokens; ++i) {
+        if (tokens[i].id < token_eot) {
+            text += whisper_token_to_str(ctx, tokens[i].id);
+        }
     }
-    
-    // Запускаем аудиозахват
-    if (!m_audio.resume()) {
-         qDebug() << "Failed to resume audio capture.";
-         // TODO: Handle error, maybe call m_audio.free() and return false
+
+    const QString hypothesis = QString::fromUtf8(text.data(), int(completeUtf8Length(text)));
+    emit self->partialTextRecognized(self->m_segmentId, self->m_stabilizer.preview(hypothesis));
+}
+
+bool WhisperRecognizer::initAudio()
+{
+    SpeechGate::Params gateParams;
+    gateParams.enabled        = m_params.vad_gate;
+    gateParams.thresholdRatio = m_params.vad_thold;
+    gateParams.endSilenceMs   = m_params.vad_end_ms;
+
+    // Очередь распознавания вмещает окно и ещё один (максимальный) шаг:
+    // пока идёт whisper_full, захват продолжается без потерь
+
+    if (!m_pipeline->startCapture(m_params.capture_id, m_params.length_ms,
+                                  m_params.length_ms + std::max(m_params.step_ms, m_params.max_step_ms), gateParams)) {
+        qDebug() << "Failed to initialize audio capture.";
+        return false;
     }
 
     qDebug() << "Audio initialized successfully.";
@@ -307,14 +424,6 @@ bool WhisperRecognizer::initAudio()
 
 void WhisperRecognizer::freeAudio()
 {
-    // Деинициализация audio_async происходит автоматически в деструкторе
-    // Деинициализация SDL
-    SDL_Quit();
+    m_pipeline->stopCapture();
     qDebug() << "Audio freed.";
 }
-
-// TODO: Реализовать функцию processAudio() если потребуется отдельная обработка
-// void WhisperRecognizer::processAudio()
-// {
-//     // Логика обработки аудио
-// } 
\ No newline at end of file
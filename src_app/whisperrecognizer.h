@@ -13,10 +13,11 @@
 #include <algorithm>
 
 #include "whisper.h"
-#include "common-sdl.h"
-#include "common-whisper.h"
-#include <SDL.h>
-#include <SDL_audio.h>
+#include "audiopipeline.h"
+#include "modelmanager.h"
+#include "slidingaudiowindow.h"
+#include "transcriptstabilizer.h"
+#include "rtfcontroller.h"
 
 // Definition of whisper_params for audio capture, model path, and threads
 struct whisper_params {
@@ -26,6 +27,17 @@ struct whisper_params {
     int32_t keep_ms    = 200;
     int32_t capture_id = -1;
 
+    // Распознавание только во время речи, конец фразы - после vad_end_ms тишины
+    bool    vad_gate   = true;
+    float   vad_thold  = 3.0f;
+    int32_t vad_end_ms = 800;
+
+    // step_ms, length_ms, audio_ctx и n_threads подстраиваются под target_rtf;
+    // значения выше - начальные, length_ms - ещё и максимальная длина окна
+    bool    adaptive    = true;
+    float   target_rtf  = 0.5f;
+    int32_t max_step_ms = 5000;
+
     std::string model     = "models/ggml-small.bin"; // Use a multilingual model
     // std::string fname_out; // Не используем сохранение аудио в этом приложении
 };
@@ -38,40 +50,71 @@ public:
     explicit WhisperRecognizer(QObject *parent = nullptr);
     ~WhisperRecognizer();
 
-    void startRecognition(const QString &modelPath);
+    // Модель подготавливает ModelManager; смена модели во время распознавания
+    // подхватывается на следующем шаге
+    void setModel(const WhisperModelPtr &model);
+    bool hasModel() const;
+
+    void startRecognition();
     void stopRecognition();
 
     bool isRunning() const;
 
+    const WaveformPeaks *waveformPeaks() const;
+
 signals:
-    void textRecognized(const QString &text);
-    void waveformUpdated(const QVector<float> &data);
+    // Промежуточная гипотеза сегмента segmentId, обновляется по мере декодирования токенов.
+    // Следующий partial или final с тем же segmentId заменяет её
+    void partialTextRecognized(quint64 segmentId, const QString &text);
+
+    // Окончательный текст сегмента, после него segmentId больше не встречается
+    void segmentFinalized(quint64 segmentId, const QString &text);
+    void waveformUpdated();
+    void pipelineStatsUpdated(const PipelineStats &stats);
+    void rtfUpdated(const RtfStats &stats);
 
 protected:
     void run() override;
 
 private:
     std::atomic_bool m_isRecognitionRunning = false;
-    struct whisper_context *m_ctx;
-    std::string m_modelPath;
 
-    // Audio capture members - adapted from stream.cpp
-    audio_async m_audio;
-    std::vector<float> m_pcmf32;
-    std::vector<float> m_pcmf32_old;
-    std::vector<float> m_pcmf32_new;
+    mutable std::mutex m_modelMutex;
+    WhisperModelPtr m_model;
+
+    // Захват и подготовка аудио в отдельных потоках, сюда приходят готовые семплы
+    AudioPipeline *m_pipeline;
+    std::vector<float> m_pcmf32;     // копия окна для пересчёта спектрограммы при смене модели
+    std::vector<float> m_pcmf32_new; // новые семплы текущего шага
+
+    // Спектрограмма окна: кадры считаются только для новых семплов.
+    // Фильтры принадлежат контексту, поэтому поток привязан к модели
+    struct whisper_mel_stream *m_melStream = nullptr;
+    WhisperModelPtr m_melModel;
+
+    // Скользящее окно фиксированной ёмкости и фиксация стабильного текста
+    SlidingAudioWindow m_window;
+    TranscriptStabilizer m_stabilizer;
+    RtfController m_controller;
+
+    // Сегмент - одно окно между финализациями
+    quint64 m_segmentId = 0;
+    int m_partialTokens = 0;          // длина последней отданной промежуточной гипотезы
+    std::string m_partialUtf8;
+
+    // logits_filter_callback: вызывается декодером на каждом шаге с уже выбранными токенами
+    static void onDecoderStep(struct whisper_context *ctx, struct whisper_state *state,
+                              const whisper_token_data *tokens, int n_tokens,
+                              float *logits, void *user_data);
+    void finalizeSegment();
+    void pushMel(const WhisperModelPtr &model);
+    void clearWindow();
+    void updateController(struct whisper_state *state, float processMs);
 
     // Whisper parameters - adapted from stream.cpp
     struct whisper_params m_params;
 
-    // Audio device and buffer members
-    SDL_AudioDeviceID m_audio_device = 0;
-    SDL_AudioSpec m_audio_spec;
-    std::vector<float> m_audio_buffer;
-
     // Private methods for initialization and processing
-    bool initWhisper();
-    void freeWhisper();
     bool initAudio();
     void freeAudio();
 };
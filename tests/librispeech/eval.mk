@@ -6,8 +6,15 @@ WHISPER_MODEL = tiny
 WHISPER_CLI = $(WHISPER_PREFIX)build/bin/whisper-cli
 WHISPER_FLAGS = --no-prints --language en --output-txt
 
-# You can create eval.conf to override the WHISPER_* variables
-# defined above.
+# Encoder layer skipping configurations compared by `make sweep`,
+# as values for --enc-layers and --enc-step (0 layers - all).
+SWEEP_LAYERS = 0 3 2
+SWEEP_STEPS = 1
+SWEEP_LIMIT = 0
+SWEEP_FLAGS = --language en
+
+# You can create eval.conf to override the WHISPER_* and SWEEP_*
+# variables defined above.
 -include eval.conf
 
 # This follows the file structure of the LibriSpeech project.
@@ -29,11 +36,21 @@ $(DONE): $(TRANS_TXTS)
 	$(WHISPER_CLI) $(WHISPER_FLAGS) --model $(WHISPER_PREFIX)models/ggml-$(WHISPER_MODEL).bin --file $^ --output-file $^.tmp
 	mv $^.tmp.txt $^.txt
 
+# WER vs latency of the encoder layer skipping mode.
+SWEEP_DONE = $(WHISPER_MODEL)-sweep.txt
+
+sweep:
+	$(PYTHON) sweep.py --cli $(WHISPER_CLI) --model $(WHISPER_PREFIX)models/ggml-$(WHISPER_MODEL).bin \
+		--layers $(SWEEP_LAYERS) --step $(SWEEP_STEPS) --limit $(SWEEP_LIMIT) -- $(SWEEP_FLAGS) > $(SWEEP_DONE).tmp
+	mv $(SWEEP_DONE).tmp $(SWEEP_DONE)
+	cat $(SWEEP_DONE)
+
 archive:
 	tar -czf $(WHISPER_MODEL).tar.gz --exclude="*.flac" LibriSpeech $(DONE)
 
 clean:
 	@rm -f $(TRANS_TXTS)
 	@rm -f $(DONE)
+	@rm -f $(SWEEP_DONE)
 
-.PHONY: all clean
+.PHONY: all clean sweep
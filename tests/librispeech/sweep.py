@@ -0,0 +1,75 @@
+import argparse
+import glob
+import re
+import subprocess
+import jiwer
+from normalizers import EnglishTextNormalizer
+from eval import get_reference
+
+def get_audio(limit):
+    paths = sorted(glob.glob('LibriSpeech/*/*/*/*.flac'))
+    return paths[:limit] if limit > 0 else paths
+
+def get_timing(stderr, name):
+    m = re.search(r'%s time =\s*([0-9.]+) ms' % name, stderr)
+    return float(m.group(1)) if m else 0.0
+
+def transcribe(args, path, n_layer, step):
+    cmd = [args.cli,
+           '--model', args.model,
+           '--file', path,
+           '--no-timestamps',
+           '--enc-layers', str(n_layer),
+           '--enc-step', str(step)] + args.flags
+
+    res = subprocess.run(cmd, capture_output=True, text=True, check=True)
+
+    # latency of the transcription itself, without loading the model
+    total = get_timing(res.stderr, 'total') - get_timing(res.stderr, 'load')
+
+    return res.stdout.strip(), get_timing(res.stderr, 'encode'), total
+
+def main():
+    parser = argparse.ArgumentParser(description='WER vs latency of the encoder layer skipping mode')
+    parser.add_argument('--cli', default='../../build/bin/whisper-cli')
+    parser.add_argument('--model', default='../../models/ggml-tiny.bin')
+    parser.add_argument('--layers', type=int, nargs='+', default=[0], help='values for --enc-layers, 0 - all')
+    parser.add_argument('--step', type=int, nargs='+', default=[1], help='values for --enc-step')
+    parser.add_argument('--limit', type=int, default=0, help='number of files to transcribe, 0 - all')
+    parser.add_argument('flags', nargs='*', help='extra whisper-cli flags, after --')
+    args = parser.parse_args()
+
+    normalizer = EnglishTextNormalizer()
+
+    ref_orig = get_reference()
+    paths = get_audio(args.limit)
+
+    print(f"{len(paths)} files")
+    print()
+    print("| layers | step |     WER | encode ms | latency ms |")
+    print("| -----: | ---: | ------: | --------: | ---------: |")
+
+    for n_layer in args.layers:
+        for step in args.step:
+            ref_clean = []
+            hyp_clean = []
+
+            t_encode = 0.0
+            t_total  = 0.0
+
+            for path in paths:
+                code = path.split('/')[-1].replace('.flac', '')
+
+                text, encode, total = transcribe(args, path, n_layer, step)
+
+                ref_clean.append(normalizer(ref_orig[code]))
+                hyp_clean.append(normalizer(text))
+
+                t_encode += encode
+                t_total  += total
+
+            wer = jiwer.wer(ref_clean, hyp_clean)
+            print(f"| {n_layer:6d} | {step:4d} | {wer * 100:6.2f}% | {t_encode / len(paths):9.1f} | {t_total / len(paths):10.1f} |", flush=True)
+
+if __name__ == '__main__':
+    main()
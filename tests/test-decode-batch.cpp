@@ -0,0 +1,232 @@
+// Tests of the batched decoder pass
+// whisper.cpp is compiled into the test, so the weights of the empty test model can be filled in
+#include "whisper.cpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+// deterministic test audio: a few tones with a slow chirp and some noise
+static std::vector<float> make_audio(int n_samples, uint32_t seed) {
+    std::vector<float> pcm(n_samples);
+
+    uint32_t rng = seed;
+    for (int i = 0; i < n_samples; ++i) {
+        const double t = double(i)/WHISPER_SAMPLE_RATE;
+
+        rng = rng*1664525u + 1013904223u;
+        const float noise = float(rng >> 8)/float(1 << 24) - 0.5f;
+
+        pcm[i] = float(0.3*sin(2*M_PI*440*t) + 0.2*sin(2*M_PI*(200 + 300*t)*t) + 0.1*sin(2*M_PI*3100*t)) + 0.05f*noise;
+    }
+
+    return pcm;
+}
+
+// the test model has no tensors in its file: fill the weights with small deterministic values
+static void init_weights(whisper_context * ctx) {
+    uint32_t rng = 1;
+
+    for (const auto & it : ctx->model.tensors) {
+        ggml_tensor * t = it.second;
+
+        std::vector<float> data(ggml_nelements(t));
+        for (auto & v : data) {
+            rng = rng*1664525u + 1013904223u;
+            v = 0.1f*(float(rng >> 8)/float(1 << 24) - 0.5f);
+        }
+
+        if (t->type == GGML_TYPE_F32) {
+            ggml_backend_tensor_set(t, data.data(), 0, ggml_nbytes(t));
+        } else {
+            assert(t->type == GGML_TYPE_F16);
+
+            std::vector<ggml_fp16_t> data_f16(data.size());
+            ggml_fp32_to_fp16_row(data.data(), data_f16.data(), data.size());
+
+            ggml_backend_tensor_set(t, data_f16.data(), 0, ggml_nbytes(t));
+        }
+    }
+
+    // whisper_full keeps the segments of loaded models only
+    ctx->model.n_loaded = ctx->model.tensors.size();
+}
+
+// a state with the encoder output of its own audio
+static whisper_state * init_state(whisper_context * ctx, const std::vector<float> & pcm) {
+    whisper_state * state = whisper_init_state(ctx);
+    assert(state != nullptr);
+
+    state->exp_n_audio_ctx = 64;
+
+    assert(whisper_pcm_to_mel_with_state(ctx, state, pcm.data(), pcm.size(), 1) == 0);
+    assert(whisper_encode_with_state(ctx, state, 0, 1) == 0);
+
+    return state;
+}
+
+// whisper_decode_batch gives each state the logits of its own whisper_decode_with_state call, step after step
+static void test_decode_batch(whisper_context * ctx) {
+    const int n_states = 3;
+    const int n_steps  = 20;
+    const int n_vocab  = whisper_n_vocab(ctx);
+
+    whisper_state * states[n_states];
+    whisper_state * refs[n_states];
+
+    // prompts of different lengths, so the states are at different positions
+    std::vector<whisper_token> tokens[n_states];
+
+    for (int i = 0; i < n_states; ++i) {
+        const std::vector<float> pcm = make_audio((2 + i)*WHISPER_SAMPLE_RATE, 10 + i);
+
+        states[i] = init_state(ctx, pcm);
+        refs[i]   = init_state(ctx, pcm);
+
+        tokens[i] = { whisper_token_sot(ctx), whisper_token_not(ctx), };
+        for (int k = 0; k < 2*i; ++k) {
+            tokens[i].push_back(400 + k);
+        }
+    }
+
+    int n_past[n_states] = { 0, };
+
+    for (int step = 0; step < n_steps; ++step) {
+        const whisper_token * tokens_p[n_states];
+        int n_tokens[n_states];
+
+        for (int i = 0; i < n_states; ++i) {
+            tokens_p[i] = tokens[i].data();
+            n_tokens[i] = tokens[i].size();
+
+            assert(whisper_decode_with_state(ctx, refs[i], tokens_p[i], n_tokens[i], n_past[i], 1) == 0);
+        }
+
+        assert(whisper_decode_batch(ctx, states, tokens_p, n_tokens, n_past, n_states, 1) == 0);
+
+        for (int i = 0; i < n_states; ++i) {
+            const float * ref = whisper_get_logits_from_state(refs[i])   + (n_tokens[i] - 1)*n_vocab;
+            const float * out = whisper_get_logits_from_state(states[i]) + (n_tokens[i] - 1)*n_vocab;
+
+            for (int k = 0; k < n_vocab; ++k) {
+                assert(out[k] == ref[k]);
+            }
+
+            // continue with the most likely token
+            n_past[i] += n_tokens[i];
+            tokens[i] = { (whisper_token) (std::max_element(ref, ref + n_vocab) - ref), };
+        }
+    }
+
+    for (int i = 0; i < n_states; ++i) {
+        whisper_free_state(states[i]);
+        whisper_free_state(refs[i]);
+    }
+
+    printf("%s: flash_attn = %d, %d steps match\n", __func__, ctx->params.flash_attn, n_steps);
+}
+
+static std::vector<whisper_token> full_tokens(whisper_state * state) {
+    std::vector<whisper_token> result;
+
+    for (int i = 0; i < whisper_full_n_segments_from_state(state); ++i) {
+        for (int j = 0; j < whisper_full_n_tokens_from_state(state, i); ++j) {
+            result.push_back(whisper_full_get_token_id_from_state(state, i, j));
+        }
+    }
+
+    return result;
+}
+
+// two threads transcribing with batch_decode get the tokens of the same calls without it
+static void test_full_batch_decode(whisper_context * ctx) {
+    const int n_threads = 2;
+
+    whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    params.n_threads       = 1;
+    params.language        = "en";
+    params.audio_ctx       = 100;
+    params.no_timestamps   = true;
+    params.max_tokens      = 16;
+    params.temperature_inc = 0.0f;
+    params.print_progress  = false;
+
+    // the decoder of the test weights would end right away, keep it going up to max_tokens
+    params.logits_filter_callback = [](whisper_context * ctx, whisper_state *, const whisper_token_data *, int, float * logits, void *) {
+        logits[whisper_token_eot(ctx)] = -INFINITY;
+    };
+
+    std::vector<float> pcm[n_threads];
+    std::vector<whisper_token> ref[n_threads];
+
+    for (int i = 0; i < n_threads; ++i) {
+        pcm[i] = make_audio(WHISPER_SAMPLE_RATE + WHISPER_SAMPLE_RATE/2, 20 + i);
+
+        whisper_state * state = whisper_init_state(ctx);
+        assert(whisper_full_with_state(ctx, state, params, pcm[i].data(), pcm[i].size()) == 0);
+
+        ref[i] = full_tokens(state);
+        assert(!ref[i].empty());
+
+        whisper_free_state(state);
+    }
+
+    params.batch_decode = true;
+
+    whisper_state * states[n_threads];
+    for (int i = 0; i < n_threads; ++i) {
+        states[i] = whisper_init_state(ctx);
+    }
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < n_threads; ++i) {
+        workers.emplace_back([&, i]() {
+            assert(whisper_full_with_state(ctx, states[i], params, pcm[i].data(), pcm[i].size()) == 0);
+        });
+    }
+
+    for (auto & worker : workers) {
+        worker.join();
+    }
+
+    for (int i = 0; i < n_threads; ++i) {
+        assert(full_tokens(states[i]) == ref[i]);
+
+        whisper_free_state(states[i]);
+    }
+
+    printf("%s: flash_attn = %d, %d threads match\n", __func__, ctx->params.flash_attn, n_threads);
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s MODEL\n", argv[0]);
+        return 1;
+    }
+
+    for (bool flash_attn : { false, true, }) {
+        whisper_context_params cparams = whisper_context_default_params();
+        cparams.use_gpu    = false;
+        cparams.flash_attn = flash_attn;
+
+        whisper_context * ctx = whisper_init_from_file_with_params_no_state(argv[1], cparams);
+        assert(ctx != nullptr);
+
+        init_weights(ctx);
+
+        test_decode_batch(ctx);
+        test_full_batch_decode(ctx);
+
+        whisper_free(ctx);
+    }
+
+    return 0;
+}
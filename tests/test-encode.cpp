@@ -0,0 +1,419 @@
+// Tests of the encoder pass
+// whisper.cpp is compiled into the test, so the weights of the empty test model can be filled in and the results
+// stored in a state can be compared directly
+#include "whisper.cpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+// audio_ctx of the tests, a short window keeps the encoder passes cheap
+static const int n_audio_ctx_test = 64;
+
+// deterministic test audio: a few tones with a slow chirp and some noise
+static std::vector<float> make_audio(int n_samples, uint32_t seed) {
+    std::vector<float> pcm(n_samples);
+
+    uint32_t rng = seed;
+    for (int i = 0; i < n_samples; ++i) {
+        const double t = double(i)/WHISPER_SAMPLE_RATE;
+
+        rng = rng*1664525u + 1013904223u;
+        const float noise = float(rng >> 8)/float(1 << 24) - 0.5f;
+
+        pcm[i] = float(0.3*sin(2*M_PI*440*t) + 0.2*sin(2*M_PI*(200 + 300*t)*t) + 0.1*sin(2*M_PI*3100*t)) + 0.05f*noise;
+    }
+
+    return pcm;
+}
+
+// the test model has no tensors in its file: fill the weights with small deterministic values
+static void init_weights(whisper_context * ctx) {
+    uint32_t rng = 1;
+
+    for (const auto & it : ctx->model.tensors) {
+        ggml_tensor * t = it.second;
+
+        std::vector<float> data(ggml_nelements(t));
+        for (auto & v : data) {
+            rng = rng*1664525u + 1013904223u;
+            v = 0.1f*(float(rng >> 8)/float(1 << 24) - 0.5f);
+        }
+
+        if (t->type == GGML_TYPE_F32) {
+            ggml_backend_tensor_set(t, data.data(), 0, ggml_nbytes(t));
+        } else {
+            assert(t->type == GGML_TYPE_F16);
+
+            std::vector<ggml_fp16_t> data_f16(data.size());
+            ggml_fp32_to_fp16_row(data.data(), data_f16.data(), data.size());
+
+            ggml_backend_tensor_set(t, data_f16.data(), 0, ggml_nbytes(t));
+        }
+    }
+
+    // whisper_full keeps the segments of loaded models only
+    ctx->model.n_loaded = ctx->model.tensors.size();
+}
+
+static whisper_state * init_state(whisper_context * ctx) {
+    whisper_state * state = whisper_init_state(ctx);
+    assert(state != nullptr);
+
+    state->exp_n_audio_ctx = n_audio_ctx_test;
+
+    return state;
+}
+
+static void encode(whisper_context * ctx, whisper_state * state, int offset) {
+    assert(whisper_encode_with_state(ctx, state, offset, 1) == 0);
+}
+
+// encoder passes computed and served from the cache since the state was created
+static void assert_encodes(whisper_state * state, int n_encode, int n_encode_hit) {
+    const whisper_timings timings = whisper_get_timings_from_state(state);
+
+    assert(timings.n_encode     == n_encode);
+    assert(timings.n_encode_hit == n_encode_hit);
+}
+
+// the encoder pass is reused for the same mel window only
+static void test_encode_cache(whisper_context * ctx) {
+    const std::vector<float> pcm = make_audio(3*WHISPER_SAMPLE_RATE, 1);
+
+    whisper_state * state = init_state(ctx);
+
+    assert(whisper_pcm_to_mel_with_state(ctx, state, pcm.data(), pcm.size(), 1) == 0);
+
+    encode(ctx, state, 0);
+    assert_encodes(state, 1, 0);
+
+    encode(ctx, state, 0);
+    assert_encodes(state, 1, 1);
+
+    // another offset, and back: only the last pass is kept
+    encode(ctx, state, 50);
+    assert_encodes(state, 2, 1);
+
+    encode(ctx, state, 0);
+    assert_encodes(state, 3, 1);
+
+    // another audio_ctx
+    state->exp_n_audio_ctx = n_audio_ctx_test + 32;
+
+    encode(ctx, state, 0);
+    assert_encodes(state, 4, 1);
+
+    state->exp_n_audio_ctx = n_audio_ctx_test;
+
+    encode(ctx, state, 0);
+    assert_encodes(state, 5, 1);
+
+    // a new spectrogram from whisper_set_mel
+    const whisper_mel mel = state->mel;
+
+    std::vector<float> data = mel.data;
+    for (auto & v : data) {
+        v = -v;
+    }
+
+    assert(whisper_set_mel_with_state(ctx, state, data.data(), mel.n_len, mel.n_mel) == 0);
+
+    encode(ctx, state, 0);
+    assert_encodes(state, 6, 1);
+
+    // an identical spectrogram is recognized by its samples
+    assert(whisper_set_mel_with_state(ctx, state, data.data(), mel.n_len, mel.n_mel) == 0);
+
+    encode(ctx, state, 0);
+    assert_encodes(state, 6, 2);
+
+    whisper_free_state(state);
+
+    printf("%s: ok\n", __func__);
+}
+
+// a window that the stream has extended is a new encoder input
+static void test_encode_cache_stream(whisper_context * ctx) {
+    const std::vector<float> pcm = make_audio(WHISPER_SAMPLE_RATE + WHISPER_SAMPLE_RATE/2, 2);
+
+    whisper_state * state = init_state(ctx);
+
+    whisper_mel_stream * stream = whisper_mel_stream_init(ctx);
+
+    // the first second fills 100 of the 2*n_audio_ctx_test frames of the window
+    assert(whisper_mel_stream_push(stream, pcm.data(), WHISPER_SAMPLE_RATE) == 0);
+    assert(whisper_mel_stream_to_state(ctx, state, stream) == 0);
+
+    encode(ctx, state, 0);
+    assert_encodes(state, 1, 0);
+
+    assert(whisper_mel_stream_to_state(ctx, state, stream) == 0);
+
+    encode(ctx, state, 0);
+    assert_encodes(state, 1, 1);
+
+    assert(whisper_mel_stream_push(stream, pcm.data() + WHISPER_SAMPLE_RATE, pcm.size() - WHISPER_SAMPLE_RATE) == 0);
+    assert(whisper_mel_stream_to_state(ctx, state, stream) == 0);
+
+    encode(ctx, state, 0);
+    assert_encodes(state, 2, 1);
+
+    whisper_mel_stream_free(stream);
+    whisper_free_state(state);
+
+    printf("%s: ok\n", __func__);
+}
+
+// a spectrogram from whisper_pcm_to_mel_batch is a new encoder input
+static void test_encode_cache_mel_batch(whisper_context * ctx) {
+    const std::vector<float> pcm0 = make_audio(2*WHISPER_SAMPLE_RATE, 3);
+    const std::vector<float> pcm1 = make_audio(2*WHISPER_SAMPLE_RATE, 4);
+
+    whisper_state * state = init_state(ctx);
+
+    assert(whisper_pcm_to_mel_with_state(ctx, state, pcm0.data(), pcm0.size(), 1) == 0);
+
+    encode(ctx, state, 0);
+    assert_encodes(state, 1, 0);
+
+    const float * samples[] = { pcm1.data(), };
+    const int   n_samples[] = { (int) pcm1.size(), };
+
+    assert(whisper_pcm_to_mel_batch(ctx, &state, samples, n_samples, 1, 1) == 0);
+
+    encode(ctx, state, 0);
+    assert_encodes(state, 2, 0);
+
+    whisper_free_state(state);
+
+    printf("%s: ok\n", __func__);
+}
+
+static std::vector<float> tensor_to_f32(const ggml_tensor * t) {
+    std::vector<float> result(ggml_nelements(t));
+
+    if (t->type == GGML_TYPE_F32) {
+        ggml_backend_tensor_get(t, result.data(), 0, ggml_nbytes(t));
+    } else {
+        assert(t->type == GGML_TYPE_F16);
+
+        std::vector<ggml_fp16_t> data(result.size());
+        ggml_backend_tensor_get(t, data.data(), 0, ggml_nbytes(t));
+
+        ggml_fp16_to_fp32_row(data.data(), result.data(), result.size());
+    }
+
+    return result;
+}
+
+static float max_abs_diff(const std::vector<float> & a, const std::vector<float> & b) {
+    assert(a.size() == b.size());
+
+    float result = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        result = std::max(result, std::fabs(a[i] - b[i]));
+    }
+
+    return result;
+}
+
+static void assert_kv_cross_equal(whisper_state * a, whisper_state * b) {
+    assert(max_abs_diff(tensor_to_f32(a->kv_cross.k), tensor_to_f32(b->kv_cross.k)) == 0.0f);
+    assert(max_abs_diff(tensor_to_f32(a->kv_cross.v), tensor_to_f32(b->kv_cross.v)) == 0.0f);
+}
+
+// the kv_cross of each state after a batched pass is the one of its own whisper_encode_with_state pass
+static void test_encode_batch(whisper_context * ctx) {
+    const int n_states = 3;
+
+    whisper_state * states[n_states];
+    whisper_state * refs[n_states];
+
+    const int offsets[n_states] = { 0, 40, 0, };
+
+    for (int i = 0; i < n_states; ++i) {
+        const std::vector<float> pcm = make_audio((2 + i)*WHISPER_SAMPLE_RATE, 10 + i);
+
+        states[i] = init_state(ctx);
+        refs[i]   = init_state(ctx);
+
+        assert(whisper_pcm_to_mel_with_state(ctx, states[i], pcm.data(), pcm.size(), 1) == 0);
+        assert(whisper_pcm_to_mel_with_state(ctx, refs[i],   pcm.data(), pcm.size(), 1) == 0);
+
+        encode(ctx, refs[i], offsets[i]);
+    }
+
+    assert(whisper_encode_batch(ctx, states, offsets, n_states, 1) == 0);
+
+    for (int i = 0; i < n_states; ++i) {
+        assert_kv_cross_equal(states[i], refs[i]);
+        assert_encodes(states[i], 1, 0);
+    }
+
+    // only the window of the second state changes, it runs alone
+    const int offsets_next[n_states] = { 0, 60, 0, };
+
+    encode(ctx, refs[1], offsets_next[1]);
+
+    assert(whisper_encode_batch(ctx, states, offsets_next, n_states, 1) == 0);
+
+    for (int i = 0; i < n_states; ++i) {
+        assert_kv_cross_equal(states[i], refs[i]);
+        assert_encodes(states[i], 1 + (i == 1), i != 1);
+    }
+
+    for (int i = 0; i < n_states; ++i) {
+        whisper_free_state(states[i]);
+        whisper_free_state(refs[i]);
+    }
+
+    printf("%s: ok\n", __func__);
+}
+
+// with language=auto, the first window reuses the encoder pass of the language detection
+static void test_encode_cache_lang_detect(whisper_context * ctx) {
+    const std::vector<float> pcm = make_audio(WHISPER_SAMPLE_RATE + WHISPER_SAMPLE_RATE/2, 5);
+
+    whisper_state * state = whisper_init_state(ctx);
+    assert(state != nullptr);
+
+    whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    params.n_threads       = 1;
+    params.language        = "auto";
+    params.audio_ctx       = 100; // the whole audio in one window
+    params.no_timestamps   = true;
+    params.max_tokens      = 4;
+    params.temperature_inc = 0.0f;
+    params.print_progress  = false;
+
+    assert(whisper_full_with_state(ctx, state, params, pcm.data(), pcm.size()) == 0);
+    assert_encodes(state, 1, 1);
+
+    whisper_free_state(state);
+
+    printf("%s: ok\n", __func__);
+}
+
+// conv stem of one mel window on the CPU backend
+static std::vector<float> conv_stem(whisper_context * ctx, ggml_backend_t backend, const std::vector<float> & mel, int n_ctx, int n_batch, bool fused) {
+    const int n_mels = ctx->model.hparams.n_mels;
+
+    ggml_init_params params = {
+        /*.mem_size   =*/ 64*ggml_tensor_overhead() + ggml_graph_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+
+    ggml_context * ctx0 = ggml_init(params);
+
+    ggml_tensor * inp = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels, n_batch);
+
+    ggml_tensor * out = whisper_build_conv(ctx0, ctx->model, inp, fused);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+    ggml_build_forward_expand(gf, out);
+
+    ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors(ctx0, backend);
+    assert(buf != nullptr);
+
+    ggml_backend_tensor_set(inp, mel.data(), 0, ggml_nbytes(inp));
+
+    assert(ggml_backend_graph_compute(backend, gf) == GGML_STATUS_SUCCESS);
+
+    std::vector<float> result = tensor_to_f32(out);
+
+    ggml_backend_buffer_free(buf);
+    ggml_free(ctx0);
+
+    return result;
+}
+
+// the fused conv stem matches im2col + mul_mat + add + ggml_gelu
+// ggml_gelu looks the tanh approximation up in a table of fp16 values, the fused kernels evaluate it in fp32,
+// so the two differ by the fp16 rounding of the activations
+static void test_conv_fused(whisper_context * ctx) {
+    ggml_backend_t backend = ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_CPU, nullptr);
+    assert(backend != nullptr);
+
+    if (!whisper_conv_fused_supported(ctx->model, { backend })) {
+        printf("%s: skipped, the fused conv stem is not supported for this model\n", __func__);
+        ggml_backend_free(backend);
+        return;
+    }
+
+    const std::vector<float> pcm = make_audio(3*WHISPER_SAMPLE_RATE, 6);
+
+    whisper_state * state = init_state(ctx);
+
+    assert(whisper_pcm_to_mel_with_state(ctx, state, pcm.data(), pcm.size(), 1) == 0);
+
+    // two windows, so that the batched layout of both paths is compared as well
+    const int n_batch = 2;
+    const int offsets[n_batch] = { 0, 100, };
+
+    for (int n_ctx : { n_audio_ctx_test, 1500, }) {
+        // the windows at the offsets, zero past the end of the spectrogram
+        const whisper_mel & mel = state->mel;
+
+        std::vector<float> inp(2*n_ctx*mel.n_mel*n_batch, 0.0f);
+        for (int ib = 0; ib < n_batch; ++ib) {
+            for (int j = 0; j < mel.n_mel; ++j) {
+                for (int i = 0; i < std::min(2*n_ctx, mel.n_len - offsets[ib]); ++i) {
+                    inp[(ib*mel.n_mel + j)*2*n_ctx + i] = mel.data[j*mel.n_len + offsets[ib] + i];
+                }
+            }
+        }
+
+        const std::vector<float> ref = conv_stem(ctx, backend, inp, n_ctx, n_batch, false);
+        const std::vector<float> out = conv_stem(ctx, backend, inp, n_ctx, n_batch, true);
+
+        float max_ref = 0.0f;
+        for (float v : ref) {
+            max_ref = std::max(max_ref, std::fabs(v));
+        }
+
+        const float diff = max_abs_diff(out, ref);
+
+        printf("%s: n_ctx = %4d, max |ref| = %.4f, max diff = %.2e\n", __func__, n_ctx, max_ref, diff);
+
+        assert(max_ref > 0.0f);
+        assert(diff <= 5e-3f*max_ref);
+    }
+
+    whisper_free_state(state);
+    ggml_backend_free(backend);
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s MODEL\n", argv[0]);
+        return 1;
+    }
+
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = false;
+
+    whisper_context * ctx = whisper_init_from_file_with_params_no_state(argv[1], cparams);
+    assert(ctx != nullptr);
+
+    init_weights(ctx);
+
+    test_encode_cache(ctx);
+    test_encode_cache_stream(ctx);
+    test_encode_cache_mel_batch(ctx);
+    test_encode_batch(ctx);
+    test_encode_cache_lang_detect(ctx);
+    test_conv_fused(ctx);
+
+    whisper_free(ctx);
+
+    return 0;
+}
@@ -0,0 +1,362 @@
+// Tests of the log mel spectrogram
+// whisper.cpp is compiled into the test, so the spectrograms stored in a state can be compared directly
+#include "whisper.cpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+// deterministic test audio: a few tones with a slow chirp and some noise
+static std::vector<float> make_audio(int n_samples, uint32_t seed) {
+    std::vector<float> pcm(n_samples);
+
+    uint32_t rng = seed;
+    for (int i = 0; i < n_samples; ++i) {
+        const double t = double(i)/WHISPER_SAMPLE_RATE;
+
+        rng = rng*1664525u + 1013904223u;
+        const float noise = float(rng >> 8)/float(1 << 24) - 0.5f;
+
+        pcm[i] = float(0.3*sin(2*M_PI*440*t) + 0.2*sin(2*M_PI*(200 + 300*t)*t) + 0.1*sin(2*M_PI*3100*t)) + 0.05f*noise;
+    }
+
+    return pcm;
+}
+
+static std::unique_ptr<whisper_state> pcm_to_mel(whisper_context * ctx, const float * samples, int n_samples, int n_threads = 1) {
+    std::unique_ptr<whisper_state> state(new whisper_state);
+    assert(whisper_pcm_to_mel_with_state(ctx, state.get(), samples, n_samples, n_threads) == 0);
+
+    return state;
+}
+
+// frames [i0, n_len) of both spectrograms must be equal
+static void assert_mel_equal(const whisper_mel & a, const whisper_mel & b, int i0) {
+    assert(a.n_mel     == b.n_mel);
+    assert(a.n_len     == b.n_len);
+    assert(a.n_len_org == b.n_len_org);
+
+    for (int j = 0; j < a.n_mel; ++j) {
+        for (int i = i0; i < a.n_len; ++i) {
+            assert(a.data[j*a.n_len + i] == b.data[j*b.n_len + i]);
+        }
+    }
+}
+
+// X[k] = sum_i x[i]*exp(-2*pi*i*k*i/n), k <= n/2, in double precision
+static std::vector<double> naive_dft(const std::vector<double> & x) {
+    const int n = x.size();
+
+    std::vector<double> out(2*(n/2 + 1));
+    for (int k = 0; k <= n/2; k++) {
+        double re = 0.0;
+        double im = 0.0;
+        for (int i = 0; i < n; i++) {
+            const double theta = (2*M_PI*((int64_t(i)*k) % n))/n;
+            re += x[i]*cos(theta);
+            im -= x[i]*sin(theta);
+        }
+        out[2*k + 0] = re;
+        out[2*k + 1] = im;
+    }
+
+    return out;
+}
+
+// the planned FFT matches a naive DFT to within 1e-5 of the largest bin
+// besides the mel frame size, a few sizes exercise the other radices and the naive butterfly (98 = 2*7*7, 52 = 4*13)
+static void test_fft() {
+    for (int n : { WHISPER_N_FFT, 2, 8, 30, 52, 98, 210, 512, }) {
+        whisper_fft_plan plan;
+        plan.init(n);
+
+        std::vector<float> x(n);
+        uint32_t rng = n;
+        for (auto & v : x) {
+            rng = rng*1664525u + 1013904223u;
+            v = float(rng >> 8)/float(1 << 24) - 0.5f;
+        }
+
+        std::vector<float> out(n + 2);
+        std::vector<float> work(2*n);
+        fft(plan, x.data(), out.data(), work.data());
+
+        const std::vector<double> ref = naive_dft(std::vector<double>(x.begin(), x.end()));
+
+        double max_abs = 0.0;
+        double max_err = 0.0;
+        for (int i = 0; i < n + 2; i++) {
+            max_abs = std::max(max_abs, std::abs(ref[i]));
+            max_err = std::max(max_err, std::abs(ref[i] - out[i]));
+        }
+
+        assert(max_err <= 1e-5*max_abs);
+    }
+
+    printf("%s: ok\n", __func__);
+}
+
+// log10_fast is within 4e-6 (a few ulp of the result) of log10 from the smallest sum (1e-10) to well beyond the largest power
+static void test_log10_fast() {
+    double max_err = 0.0;
+    for (double x = 1e-10; x < 1e12; x *= 1.0001) {
+        const float xf = x;
+        max_err = std::max(max_err, std::abs(log10_fast(xf) - log10(double(xf))));
+    }
+
+    assert(max_err <= 4e-6);
+
+    printf("%s: ok\n", __func__);
+}
+
+// the sparse spans of the filters give the same mel energies as the dense filterbank in double precision,
+// to within a relative error of 1e-5
+static void test_filters_spans(whisper_context * ctx) {
+    const whisper_filters & filters = ctx->model.filters;
+
+    assert(int(filters.start.size()) == filters.n_mel);
+
+    // the spans hold every nonzero weight
+    for (int j = 0; j < filters.n_mel; j++) {
+        for (int k = 0; k < filters.n_fft; k++) {
+            const float w = filters.data[j*filters.n_fft + k];
+            if (k < filters.start[j] || k >= filters.start[j] + filters.len[j]) {
+                assert(w == 0.0f);
+            } else {
+                assert(w == filters.weights[filters.offset[j] + k - filters.start[j]]);
+            }
+        }
+    }
+
+    std::vector<float> power(filters.n_fft);
+
+    uint32_t rng = 1;
+    for (int t = 0; t < 100; t++) {
+        // power spectra spanning a few orders of magnitude
+        for (auto & p : power) {
+            rng = rng*1664525u + 1013904223u;
+            p = powf(10.0f, 6.0f*float(rng >> 8)/float(1 << 24) - 3.0f);
+        }
+
+        for (int j = 0; j < filters.n_mel; j++) {
+            double dense = 0.0;
+            for (int k = 0; k < filters.n_fft; k++) {
+                dense += double(power[k])*filters.data[j*filters.n_fft + k];
+            }
+
+            float sparse = 0.0f;
+            for (int k = 0; k < filters.len[j]; k++) {
+                sparse += power[filters.start[j] + k]*filters.weights[filters.offset[j] + k];
+            }
+
+            assert(std::abs(sparse - dense) <= 1e-5*dense);
+        }
+    }
+
+    printf("%s: ok\n", __func__);
+}
+
+// reference log mel spectrogram, following whisper/audio.py in double precision: reflective padding of
+// WHISPER_N_FFT/2 samples, 30 s of zeros at the end, Hann window, naive DFT, dense filterbank, log10,
+// clamping to 8 below the maximum and normalization
+static std::vector<double> mel_reference(const whisper_filters & filters, const float * samples, int n_samples, int & n_len) {
+    const int frame_size = WHISPER_N_FFT;
+    const int frame_step = WHISPER_HOP_LENGTH;
+    const int pad        = frame_size/2;
+
+    std::vector<double> padded(n_samples + 30*WHISPER_SAMPLE_RATE + 2*pad, 0.0);
+    for (int i = 0; i < n_samples; i++) {
+        padded[pad + i] = samples[i];
+    }
+    for (int i = 0; i < pad; i++) {
+        padded[i] = samples[pad - i];
+    }
+
+    n_len = (padded.size() - frame_size)/frame_step;
+
+    std::vector<double> mel(filters.n_mel*n_len);
+
+    std::vector<double> frame(frame_size);
+    for (int i = 0; i < n_len; i++) {
+        bool zero = true;
+        for (int j = 0; j < frame_size; j++) {
+            frame[j] = 0.5*(1.0 - cos((2*M_PI*j)/frame_size))*padded[i*frame_step + j];
+            zero = zero && frame[j] == 0.0;
+        }
+
+        const std::vector<double> spectrum = zero ? std::vector<double>(frame_size + 2, 0.0) : naive_dft(frame);
+
+        for (int m = 0; m < filters.n_mel; m++) {
+            double sum = 0.0;
+            for (int k = 0; k < filters.n_fft; k++) {
+                const double power = spectrum[2*k]*spectrum[2*k] + spectrum[2*k + 1]*spectrum[2*k + 1];
+                sum += power*filters.data[m*filters.n_fft + k];
+            }
+            mel[m*n_len + i] = log10(std::max(sum, 1e-10));
+        }
+    }
+
+    const double mmax = *std::max_element(mel.begin(), mel.end()) - 8.0;
+    for (auto & v : mel) {
+        v = (std::max(v, mmax) + 4.0)/4.0;
+    }
+
+    return mel;
+}
+
+// the spectrogram matches the reference to within 1e-4 and does not depend on the number of threads
+static void test_mel_reference(whisper_context * ctx) {
+    const whisper_filters & filters = ctx->model.filters;
+
+    for (int n_samples : { 201, 4321, 3*WHISPER_SAMPLE_RATE + 77, }) {
+        const std::vector<float> pcm = make_audio(n_samples, n_samples);
+
+        int n_len = 0;
+        const std::vector<double> ref = mel_reference(filters, pcm.data(), n_samples, n_len);
+
+        const auto state = pcm_to_mel(ctx, pcm.data(), n_samples);
+        const whisper_mel & mel = state->mel;
+
+        assert(mel.n_mel == filters.n_mel);
+        assert(mel.n_len == n_len);
+
+        double max_err = 0.0;
+        for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
+            max_err = std::max(max_err, std::abs(ref[i] - mel.data[i]));
+        }
+
+        assert(max_err <= 1e-4);
+
+        assert_mel_equal(mel, pcm_to_mel(ctx, pcm.data(), n_samples, 4)->mel, 0);
+    }
+
+    printf("%s: ok\n", __func__);
+}
+
+// the batch gives every input the spectrogram whisper_pcm_to_mel_with_state computes for it alone,
+// for inputs of different lengths, and both reject inputs of WHISPER_N_FFT/2 samples or less
+static void test_mel_batch(whisper_context * ctx) {
+    const int lengths[] = { 201, 160*7 + 3, WHISPER_SAMPLE_RATE, 5*WHISPER_SAMPLE_RATE + 999, 202, 31*WHISPER_SAMPLE_RATE, };
+    const int n_batch = sizeof(lengths)/sizeof(lengths[0]);
+
+    std::vector<std::vector<float>> pcm;
+    std::vector<std::unique_ptr<whisper_state>> states;
+
+    std::vector<const float *>   samples;
+    std::vector<whisper_state *> state_ptrs;
+    for (int i = 0; i < n_batch; i++) {
+        pcm.push_back(make_audio(lengths[i], 100 + i));
+        states.emplace_back(new whisper_state);
+
+        samples.push_back(pcm[i].data());
+        state_ptrs.push_back(states[i].get());
+    }
+
+    for (int n_threads : { 1, 4, }) {
+        assert(whisper_pcm_to_mel_batch(ctx, state_ptrs.data(), samples.data(), lengths, n_batch, n_threads) == 0);
+
+        for (int i = 0; i < n_batch; i++) {
+            assert_mel_equal(states[i]->mel, pcm_to_mel(ctx, pcm[i].data(), lengths[i])->mel, 0);
+        }
+    }
+
+    const int n_short = WHISPER_N_FFT/2;
+
+    std::unique_ptr<whisper_state> state(new whisper_state);
+    assert(whisper_pcm_to_mel_with_state(ctx, state.get(), pcm[0].data(), n_short, 1) != 0);
+
+    const float * short_samples[] = { pcm[0].data(), pcm[1].data(), };
+    const int     short_lengths[] = { lengths[0], n_short, };
+    assert(whisper_pcm_to_mel_batch(ctx, state_ptrs.data(), short_samples, short_lengths, 2, 1) != 0);
+
+    printf("%s: ok\n", __func__);
+}
+
+// pushing audio in irregular pieces gives the same spectrogram as whisper_pcm_to_mel on the whole window
+static void test_mel_stream(whisper_context * ctx) {
+    const std::vector<float> pcm = make_audio(7*WHISPER_SAMPLE_RATE + 1234, 1);
+
+    const int n_total = pcm.size();
+
+    whisper_mel_stream * stream = whisper_mel_stream_init(ctx);
+
+    std::unique_ptr<whisper_state> state(new whisper_state);
+
+    // piece sizes around the hop and FFT lengths, and a few larger ones
+    const int sizes[] = { 1, 7, 159, 160, 161, 199, 200, 201, 399, 400, 401, 1000, 3333, 16000, };
+
+    int n_pushed = 0;
+    int n_checks = 0;
+    for (int k = 0; n_pushed < n_total; ++k) {
+        const int n = std::min<int>(sizes[k % (sizeof(sizes)/sizeof(sizes[0]))], n_total - n_pushed);
+
+        assert(whisper_mel_stream_push(stream, pcm.data() + n_pushed, n) == 0);
+        n_pushed += n;
+
+        // whisper_pcm_to_mel needs more than WHISPER_N_FFT/2 samples
+        if (n_pushed > WHISPER_N_FFT/2 && k % 5 == 0) {
+            assert(whisper_mel_stream_to_state(ctx, state.get(), stream) == 0);
+
+            assert_mel_equal(state->mel, pcm_to_mel(ctx, pcm.data(), n_pushed)->mel, 0);
+            n_checks++;
+        }
+    }
+
+    assert(whisper_mel_stream_to_state(ctx, state.get(), stream) == 0);
+    assert_mel_equal(state->mel, pcm_to_mel(ctx, pcm.data(), n_total)->mel, 0);
+
+    // slide the window: the kept frames are the frames of the whole stream, so they match the spectrogram of the
+    // kept audio except for the first two, which see the real preceding audio instead of the reflective padding
+    const int n_keep = 5*WHISPER_SAMPLE_RATE;
+
+    whisper_mel_stream_keep(stream, n_keep);
+
+    const int i0 = (n_total - n_keep + WHISPER_HOP_LENGTH - 1)/WHISPER_HOP_LENGTH;
+
+    assert(whisper_mel_stream_to_state(ctx, state.get(), stream) == 0);
+    assert_mel_equal(state->mel, pcm_to_mel(ctx, pcm.data() + i0*WHISPER_HOP_LENGTH, n_total - i0*WHISPER_HOP_LENGTH)->mel, 2);
+
+    // and it keeps streaming from there
+    const std::vector<float> more = make_audio(12345, 2);
+
+    assert(whisper_mel_stream_push(stream, more.data(), 777) == 0);
+    assert(whisper_mel_stream_push(stream, more.data() + 777, more.size() - 777) == 0);
+
+    std::vector<float> window(pcm.begin() + i0*WHISPER_HOP_LENGTH, pcm.end());
+    window.insert(window.end(), more.begin(), more.end());
+
+    assert(whisper_mel_stream_to_state(ctx, state.get(), stream) == 0);
+    assert_mel_equal(state->mel, pcm_to_mel(ctx, window.data(), window.size())->mel, 2);
+
+    whisper_mel_stream_free(stream);
+
+    printf("%s: %d windows match whisper_pcm_to_mel\n", __func__, n_checks + 3);
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s MODEL\n", argv[0]);
+        return 1;
+    }
+
+    whisper_context * ctx = whisper_init_from_file_with_params_no_state(argv[1], whisper_context_default_params());
+    assert(ctx != nullptr);
+
+    test_fft();
+    test_log10_fast();
+    test_filters_spans(ctx);
+    test_mel_reference(ctx);
+    test_mel_batch(ctx);
+    test_mel_stream(ctx);
+
+    whisper_free(ctx);
+
+    return 0;
+}